@@ -269,13 +269,14 @@ function on_wifi_settings() {
 }
 
 function on_display_data() {
-    post(['output_usb', 'usb_baud_rate',
+    post(['output_usb', 'usb_baud_rate', 'nmea_output_intervals', 'nmea_wifi_rate',
           'input_nmea_pypilot', 'output_nmea_pypilot',
           //'input_nmea_signalk', 'output_nmea_signalk',
           'input_nmea_tcp_client', 'output_nmea_tcp_client', 'nmea_tcp_client_addr',
           'nmea_tcp_client_port',
           'input_nmea_tcp_server', 'output_nmea_tcp_server',
-          'nmea_tcp_server_port',
+          'nmea_tcp_server_port', 'nmea_tcp_drop_policy',
+          'input_nmea_udp', 'output_nmea_udp', 'nmea_udp_addr', 'nmea_udp_port',
           //'input_signalk', 'output_signalk',
           'forward_nmea_serial_to_wifi',
           'compensate_wind_with_accelerometer',
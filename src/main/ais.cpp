@@ -6,12 +6,30 @@
  * version 3 of the License, or (at your option) any later version.
  */
 
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef __linux__
+uint32_t millis(); // supplied by the host program
+#else
+#include "Arduino.h"
+#endif
+
+#include "settings.h"
 #include "display.h"
 #include "ais.h"
 #include "utils.h"
 
 // decode nmea AIS packets as well as compute cpa and tcpa
-std::map<int, ship> ships;
+ship ships[AIS_SHIPS_MAX];
+int ships_count;
 
 float ship::simple_x(float slon)
 {
@@ -23,43 +41,277 @@ float ship::simple_y(float slat)
     return (lat-slat)*60;
 }
 
-void ship::compute(float slat, float slon, float ssog, float scog, uint32_t t0)
+float ship::tcpa()
 {
-    float dt = (t0 - timestamp) / 1000.0f;
-    
-    // now compute cpa and tcpa
-    //if 'rot' in ais_data:
-    //acog += ais_data['rot']/60*5
-    float x = simple_x(slon);
-    float y = simple_y(slat);
-    dist = hypot(x, y);
-
-    // velocity vectors in x, y
-    float rcog = deg2rad(cog), rscog = deg2rad(scog);
-    float bvx = ssog*sinf(rscog), bvy = ssog*cosf(rscog);
-    float avx = sog*sinf(rcog), avy = sog*cosf(rcog);
-
-    // update from now to time difference since last ais fix
-    x += avx*dt;
-    y += avy*dt;
-
-    // relative velocity of ais target
-    float vx = avx - bvx, vy = avy - bvy;
-
-    // the formula for time of closest approach is when the
-    // derivative of the distance with respect to time is zero
-    // dd/dt = 2*t*vx^2 + 2*vx*x + 2*t*vy^2 + 2*vy*y
-    float v2 = (vx*vx + vy*vy), t;
-    if(v2 < 1e-4) // tracks are nearly parallel courses
-        t = 0;
-    else
-        t = (vx*x + vy*y)/v2;
-
-    // closest point of approach distance in nautical miles
-    cpa = hypotf(t*vx - x, t*vy - y);
-    
-    // time till closest point of approach is in hours, convert to seconds
-    tcpa = t * 3600;
+    return isnan(cpa) ? NAN : int32_t(cpa_time - millis()) / 1000.0f;
+}
+
+// own ship and target kinematics in arrays parallel to ships[], so the cpa
+// pass runs over contiguous floats and only for targets with a new position,
+// or for all of them when our own position, speed or course changes
+static struct {
+    bool valid;
+    float lat, lon, sog, cog;    // own ship the results are from
+    uint32_t time;               // when it last changed
+    float vx, vy;                // own velocity in knots
+
+    int mmsi[AIS_SHIPS_MAX];     // target and fix each entry is from
+    uint32_t timestamp[AIS_SHIPS_MAX];
+    float lat_[AIS_SHIPS_MAX], lon_[AIS_SHIPS_MAX];
+    float coslat[AIS_SHIPS_MAX]; // miles per degree of longitude
+    float vx_[AIS_SHIPS_MAX], vy_[AIS_SHIPS_MAX];
+
+    int count;                   // targets computed in this pass
+    int index[AIS_SHIPS_MAX];
+} ais_cpa;
+
+static float ais_speed(float v)
+{
+    return isnan(v) ? 0 : v;
+}
+
+// targets closing to within a cpa limit in a min-heap by cpa_time, moved as
+// each result changes and rebuilt after targets are added or removed
+#define AIS_THREAT_AGE (5*60*1000) // ms without a position before a target is ignored
+
+static struct {
+    bool stale;
+    float cpa;                  // limit the heap holds targets for
+    int count;
+    int16_t heap[AIS_SHIPS_MAX];
+    int16_t pos[AIS_SHIPS_MAX]; // where each target is in the heap, -1 if not
+} ais_threats = {true};
+
+// not yet past its closest approach and heard from recently
+static bool ais_threatens(int i)
+{
+    ship &s = ships[i];
+    uint32_t t = millis();
+    return s.cpa < ais_threats.cpa && int32_t(s.cpa_time - t) >= 0 &&
+        t - s.timestamp <= AIS_THREAT_AGE;
+}
+
+// compared as a difference so the heap survives millis() wrapping
+static bool ais_sooner(int a, int b)
+{
+    return int32_t(ships[a].cpa_time - ships[b].cpa_time) < 0;
+}
+
+static void ais_threat_set(int p, int i)
+{
+    ais_threats.heap[p] = i;
+    ais_threats.pos[i] = p;
+}
+
+// move the target at p down to below any that reach cpa later
+static void ais_threat_down(int p)
+{
+    int i = ais_threats.heap[p];
+    for(;;) {
+        int c = 2*p + 1;
+        if(c >= ais_threats.count)
+            break;
+        if(c + 1 < ais_threats.count && ais_sooner(ais_threats.heap[c+1], ais_threats.heap[c]))
+            c++;
+        if(!ais_sooner(ais_threats.heap[c], i))
+            break;
+        ais_threat_set(p, ais_threats.heap[c]);
+        p = c;
+    }
+    ais_threat_set(p, i);
+}
+
+// the target at p has a new cpa_time
+static void ais_threat_sift(int p)
+{
+    int i = ais_threats.heap[p];
+    while(p > 0 && ais_sooner(i, ais_threats.heap[(p-1)/2])) {
+        ais_threat_set(p, ais_threats.heap[(p-1)/2]);
+        p = (p-1)/2;
+    }
+    ais_threat_set(p, i);
+    ais_threat_down(p);
+}
+
+static void ais_threat_remove(int i)
+{
+    int p = ais_threats.pos[i];
+    ais_threats.pos[i] = -1;
+    int last = ais_threats.heap[--ais_threats.count];
+    if(p == ais_threats.count)
+        return;
+    ais_threat_set(p, last);
+    ais_threat_sift(p);
+}
+
+// target i has a new cpa and cpa_time
+static void ais_threat_update(int i)
+{
+    if(ais_threats.stale)
+        return;
+    bool in = ais_threats.pos[i] >= 0;
+    if(ais_threatens(i)) {
+        if(!in) {
+            ais_threat_set(ais_threats.count, i);
+            ais_threats.count++;
+        }
+        ais_threat_sift(ais_threats.pos[i]);
+    } else if(in)
+        ais_threat_remove(i);
+}
+
+static void ais_threat_rebuild(float cpa)
+{
+    ais_threats.cpa = cpa;
+    ais_threats.count = 0;
+    for(int i=0; i<ships_count; i++) {
+        ais_threats.pos[i] = -1;
+        if(ais_threatens(i))
+            ais_threat_set(ais_threats.count++, i);
+    }
+    for(int p=ais_threats.count/2-1; p>=0; p--)
+        ais_threat_down(p);
+    ais_threats.stale = false;
+}
+
+static void ais_threat_check(float cpa)
+{
+    if(ais_threats.stale || cpa != ais_threats.cpa)
+        ais_threat_rebuild(cpa);
+
+    // targets pass their closest approach or go quiet without a new result,
+    // those past it are all on top, ais_threats_top skips quiet ones below
+    while(ais_threats.count && !ais_threatens(ais_threats.heap[0]))
+        ais_threat_remove(ais_threats.heap[0]);
+}
+
+// the target reaching its closest point soonest among those that will
+// pass within cpa miles, or NULL
+ship *ais_threat(float cpa)
+{
+    ais_threat_check(cpa);
+    return ais_threats.count ? &ships[ais_threats.heap[0]] : NULL;
+}
+
+// seconds until the soonest closest approach of any recent target,
+// not only those within a cpa limit, infinity without one
+float ais_soonest_tcpa()
+{
+    uint32_t t = millis();
+    int32_t soonest = INT32_MAX;
+    for(int i=0; i<ships_count; i++) {
+        ship &s = ships[i];
+        int32_t dt = s.cpa_time - t;
+        if(!isnan(s.cpa) && dt >= 0 && dt < soonest && t - s.timestamp <= AIS_THREAT_AGE)
+            soonest = dt;
+    }
+    return soonest == INT32_MAX ? INFINITY : soonest / 1000.0f;
+}
+
+// indices of up to n such targets soonest first
+int ais_threats_top(float cpa, int *found, int n)
+{
+    ais_threat_check(cpa);
+
+    // walk the heap keeping a frontier of candidates, at most n+1
+    static int16_t frontier[AIS_SHIPS_MAX + 1];
+    int count = 0, fn = 0;
+    if(ais_threats.count)
+        frontier[fn++] = 0;
+    while(count < n && fn) {
+        int best = 0;
+        for(int j=1; j<fn; j++)
+            if(ais_sooner(ais_threats.heap[frontier[j]], ais_threats.heap[frontier[best]]))
+                best = j;
+        int p = frontier[best];
+        frontier[best] = frontier[--fn];
+        int i = ais_threats.heap[p];
+        if(ais_threatens(i))
+            found[count++] = i;
+        for(int c = 2*p + 1; c <= 2*p + 2 && c < ais_threats.count; c++)
+            frontier[fn++] = c;
+    }
+    return count;
+}
+
+int ais_compute_cpa()
+{
+    float slat, slon, ssog = NAN, scog = NAN;
+    if(!display_data_get(LATITUDE, slat) || !display_data_get(LONGITUDE, slon)) {
+        if(ais_cpa.valid)
+            for(int i=0; i<ships_count; i++)
+                ships[i].cpa = ships[i].dist = NAN;
+        ais_cpa.valid = false;
+        ais_threats.stale = true;
+        return 0;
+    }
+    display_data_get(GPS_SPEED, ssog);
+    display_data_get(GPS_HEADING, scog);
+
+    bool own_changed = !ais_cpa.valid || slat != ais_cpa.lat || slon != ais_cpa.lon ||
+        memcmp(&ssog, &ais_cpa.sog, sizeof ssog) || memcmp(&scog, &ais_cpa.cog, sizeof scog);
+    if(own_changed) {
+        ais_cpa.valid = true;
+        ais_cpa.lat = slat, ais_cpa.lon = slon, ais_cpa.sog = ssog, ais_cpa.cog = scog;
+        ais_cpa.time = millis();
+        float rscog = deg2rad(ais_speed(scog));
+        ais_cpa.vx = ais_speed(ssog)*sinf(rscog);
+        ais_cpa.vy = ais_speed(ssog)*cosf(rscog);
+    }
+
+    // refresh the kinematics of targets with a new fix
+    int n = 0;
+    for(int i=0; i<ships_count; i++) {
+        ship &s = ships[i];
+        if(ais_cpa.mmsi[i] != s.mmsi || ais_cpa.timestamp[i] != s.timestamp) {
+            ais_cpa.mmsi[i] = s.mmsi;
+            ais_cpa.timestamp[i] = s.timestamp;
+            float rcog = deg2rad(ais_speed(s.cog));
+            ais_cpa.lat_[i] = s.lat;
+            ais_cpa.lon_[i] = s.lon;
+            ais_cpa.coslat[i] = cosf(deg2rad(s.lat)) * 60;
+            ais_cpa.vx_[i] = ais_speed(s.sog)*sinf(rcog);
+            ais_cpa.vy_[i] = ais_speed(s.sog)*cosf(rcog);
+        } else if(!own_changed)
+            continue;
+
+        if(!s.timestamp) { // no position yet
+            s.cpa = s.dist = NAN;
+            ais_threat_update(i);
+            continue;
+        }
+        ais_cpa.index[n++] = i;
+    }
+    ais_cpa.count = n;
+
+    for(int j=0; j<n; j++) {
+        int i = ais_cpa.index[j];
+        float dlon = ais_cpa.lon_[i] - slon;
+        dlon -= 360 * rintf(dlon / 360);
+        float x = ais_cpa.coslat[i] * dlon, y = (ais_cpa.lat_[i] - slat) * 60;
+
+        // bring both to whichever was heard last, times in hours
+        int32_t dt = ais_cpa.time - ais_cpa.timestamp[i];
+        float ta = dt > 0 ? dt / 3600000.0f : 0, to = dt < 0 ? -dt / 3600000.0f : 0;
+        x += ais_cpa.vx_[i]*ta - ais_cpa.vx*to;
+        y += ais_cpa.vy_[i]*ta - ais_cpa.vy*to;
+
+        // relative velocity, the time of closest approach is when the
+        // derivative of the distance with respect to time is zero
+        float vx = ais_cpa.vx_[i] - ais_cpa.vx, vy = ais_cpa.vy_[i] - ais_cpa.vy;
+        float v2 = vx*vx + vy*vy;
+        float t = v2 < 1e-4f ? 0 : -(vx*x + vy*y) / v2; // nearly parallel courses
+        float cx = x + t*vx, cy = y + t*vy;
+
+        ship &s = ships[i];
+        s.cpa = sqrtf(cx*cx + cy*cy);
+        // from whichever was heard last, hours to ms kept within an int32_t
+        float ms = fminf(fmaxf(t * 3600000, -1e9f), 1e9f);
+        s.cpa_time = (dt > 0 ? ais_cpa.time : ais_cpa.timestamp[i]) + int32_t(ms);
+        s.dist = sqrtf(x*x + y*y);
+        ais_threat_update(i);
+    }
+    return n;
 }
 
 static const char *skip(const char *line, int count)
@@ -74,38 +326,97 @@ static const char *skip(const char *line, int count)
     return line;
 }
 
-static std::vector<bool> ais_data[2];
+// de-armoured payload, 6 bits per character packed msb first
+#define AIS_MAX_BYTES 176 // 3 fragments of 77 characters
 
-static int ais_n(std::vector<bool> &data, int start, int len, bool sign=false)
+struct ais_payload {
+    uint8_t bytes[AIS_MAX_BYTES + 8]; // zero padding for reading whole words
+    int bits;
+
+    void clear() { memset(bytes, 0, (bits >> 3) + 2); bits = 0; } // only what append set
+    bool append(const char *armor, int len);
+};
+
+// multi-part messages being reassembled, several may interleave on one channel
+#define AIS_FRAGMENT_SLOTS 4
+#define AIS_FRAGMENT_TIMEOUT 2000 // ms allowed between fragments of one message
+
+struct ais_fragments {
+    char channel;
+    char seq;        // sequential message id
+    uint8_t count;
+    uint8_t next;    // fragment expected next, 0 when the slot is free
+    uint32_t time;   // when the last fragment arrived
+    ais_payload data;
+};
+
+static ais_fragments ais_slots[AIS_FRAGMENT_SLOTS];
+static ais_payload ais_single; // single fragment messages need no slot
+static struct {
+    uint32_t messages, orphaned, discarded, invalid;
+    uint32_t expired, evicted;
+} ais_stats;
+
+bool ais_payload::append(const char *armor, int len)
 {
-    //printf("ais_n %d %d %d\n", data.size(), start, len);
-    if(data.size() < start+len) {
+    if(bits + len*6 > AIS_MAX_BYTES*8)
+        return false;
+    for(int i=0; i < len; i++) {
+        unsigned d = armor[i] - 48;
+        if(d > 40)
+            d -= 8;
+        if(d > 63)
+            return false;
+        // the 6 bits land in at most two bytes
+        int byte = bits >> 3, shift = 10 - (bits & 7);
+        uint16_t v = d << shift;
+        bytes[byte] |= v >> 8;
+        bytes[byte+1] |= v;
+        bits += 6;
+    }
+    return true;
+}
+
+static int ais_n(const ais_payload &data, int start, int len, bool sign=false)
+{
+    if(data.bits < start+len) {
         printf("warning, empty ais data\n");
         return 0;
     }
-    bool negative = false;
-    if (sign) {
-        if (data[start])
-            negative = true;
-        start++;
-        len--;
-    }
-            
-    int result = 0;
-    for(int i=0; i<len; i++)
-        if(data[start+i] != negative)
-            result |= (1<<(len-i-1));
 
-    if(negative) // 2's compliment
-        result = -(result + 1);
+    // fields are at most 30 bits so 5 bytes always cover one
+    const uint8_t *p = data.bytes + (start >> 3);
+    uint64_t w = (uint64_t)p[0] << 32 | (uint64_t)p[1] << 24 | p[2] << 16 | p[3] << 8 | p[4];
+    uint32_t v = (w >> (40 - (start & 7) - len)) & ((1u << len) - 1);
 
-    return result;
+    if(sign) // sign extend from the top bit of the field
+        return (int32_t)(v << (32 - len)) >> (32 - len);
+    return v;
+}
+
+// copy a text field out of the payload still as six bit characters
+static void ais_t(const ais_payload &data, int start, int chars, uint8_t *packed)
+{
+    memset(packed, 0, AIS_TEXT_BYTES(chars));
+    for(int i=0; i<chars && start + i*6 + 6 <= data.bits; i++) {
+        int bit = i*6, shift = 10 - (bit & 7);
+        uint16_t v = ais_n(data, start + i*6, 6) << shift;
+        packed[bit >> 3] |= v >> 8;
+        if((bit >> 3) + 1 < AIS_TEXT_BYTES(chars))
+            packed[(bit >> 3) + 1] |= v;
+    }
 }
 
-std::string ais_t(std::vector<bool> &data, int start, int len) {
-    std::string result = "";
-    for(int i=0; i<len; i+=6) {
-        char d = ais_n(data, start+i, 6);
+// a text field as ascii, it ends at the first '@'
+std::string ais_text(const uint8_t *packed, int chars)
+{
+    std::string result;
+    for(int i=0; i<chars; i++) {
+        int bit = i*6;
+        uint16_t w = packed[bit >> 3] << 8;
+        if((bit >> 3) + 1 < AIS_TEXT_BYTES(chars))
+            w |= packed[(bit >> 3) + 1];
+        char d = (w >> (10 - (bit & 7))) & 0x3f;
         if( d == 0 )
             break;
         if( d <= 31)
@@ -115,7 +426,7 @@ std::string ais_t(std::vector<bool> &data, int start, int len) {
     return result;
 }
 
-std::string ais_status(int index) {
+const char *ais_status(int index) {
     switch(index) {
     case 0: return "Under way using engine";
     case 1: return "At anchor";
@@ -174,7 +485,7 @@ float ais_ll(int n) {
     return n / 600000.0;
 }
 
-std::string ais_e(int type) {
+const char *ais_e(int type) {
     if(type == 0)                       return "N/A";
     if(type >= 20 && type <= 29)        return "WIG";
     switch(type) {
@@ -206,20 +517,396 @@ std::string ais_e(int type) {
     return "Unknown";
 }
     
-static bool decode_ais_data(std::vector<bool> &data)
+// index of mmsi in the table, or where it would be inserted
+static int ais_lower_bound(int mmsi)
+{
+    int lo = 0, hi = ships_count;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(ships[mid].mmsi < mmsi)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+ship *ais_find_ship(int mmsi)
+{
+    int i = ais_lower_bound(mmsi);
+    if(i < ships_count && ships[i].mmsi == mmsi)
+        return &ships[i];
+    return NULL;
+}
+
+static int ais_capacity()
+{
+    return settings.ais_max_targets < AIS_SHIPS_MAX ? settings.ais_max_targets : AIS_SHIPS_MAX;
+}
+
+// targets with a position hashed by grid cell, so range and nearest queries
+// visit only nearby cells.  Entries are table indices, rebuilt on the next
+// query after targets are added or removed and moved on each position report
+#define AIS_GRID_CELL 2         // minutes of latitude and of longitude
+#define AIS_GRID_COLUMNS (360*60/AIS_GRID_CELL)
+#define AIS_GRID_BUCKETS 256
+#define AIS_GRID_NONE -32768
+
+static struct {
+    bool stale;
+    int16_t head[AIS_GRID_BUCKETS];
+    int16_t next[AIS_SHIPS_MAX];
+    int16_t cx[AIS_SHIPS_MAX], cy[AIS_SHIPS_MAX]; // cell of each target
+} ais_grid = {true};
+
+static void ais_remove(int i)
+{
+    std::move(ships + i + 1, ships + ships_count, ships + i);
+    ships_count--;
+    ais_grid.stale = ais_threats.stale = true;
+}
+
+// how little a target matters, the farthest or the one not heard from
+// the longest: a nautical mile counts the same as a minute
+static float ais_irrelevance(ship &s, bool position, float slat, float slon, uint32_t t)
+{
+    float score = (t - s.heard) / 60000.0f;
+    if(position)
+        score += s.timestamp ? hypotf(s.simple_x(slon), s.simple_y(slat)) : 1000;
+    return score;
+}
+
+// the target to give up when the table is full
+static int ais_evict_index()
+{
+    float slat, slon;
+    bool position = display_data_get(LATITUDE, slat) && display_data_get(LONGITUDE, slon);
+    uint32_t t = millis();
+
+    int worst = 0;
+    float worst_score = -1;
+    for(int i=0; i<ships_count; i++) {
+        float score = ais_irrelevance(ships[i], position, slat, slon, t);
+        if(score > worst_score) {
+            worst = i;
+            worst_score = score;
+        }
+    }
+    return worst;
+}
+
+// recent positions of the most relevant targets, each trail a ring of points
+// at least AIS_TRAIL_INTERVAL and AIS_TRAIL_DISTANCE apart, in a fixed budget
+#define AIS_TRAIL_POINTS 1024
+#define AIS_TRAIL_LENGTH 16
+#define AIS_TRAILS (AIS_TRAIL_POINTS / AIS_TRAIL_LENGTH)
+#define AIS_TRAIL_INTERVAL 30   // seconds
+#define AIS_TRAIL_DISTANCE .05f // miles
+#define AIS_TRAIL_AGE 3600      // seconds a point is shown
+
+struct ais_trail_t {
+    int mmsi;                    // owner, 0 when free
+    uint8_t head, count;
+    int32_t lat[AIS_TRAIL_LENGTH], lon[AIS_TRAIL_LENGTH]; // 1/10000 minute as sent
+    uint16_t time[AIS_TRAIL_LENGTH];                       // seconds, wrapping
+};
+
+static ais_trail_t ais_trails[AIS_TRAILS];
+
+// a trail for s, free or taken from a less relevant target
+static int ais_trail_take(ship &s)
+{
+    for(int j=0; j<AIS_TRAILS; j++)
+        if(!ais_trails[j].mmsi) {
+            ais_trails[j].mmsi = s.mmsi;
+            ais_trails[j].count = 0;
+            return j;
+        }
+
+    // finding orphans and owners searches the table, so only once a second
+    static uint32_t take_time;
+    uint32_t t = millis();
+    if(t - take_time < 1000)
+        return AIS_TRAIL_NONE;
+    take_time = t;
+
+    float slat, slon;
+    bool position = display_data_get(LATITUDE, slat) && display_data_get(LONGITUDE, slon);
+    int worst = AIS_TRAIL_NONE;
+    float worst_score = ais_irrelevance(s, position, slat, slon, t) + 2; // so trails do not flap
+    for(int j=0; j<AIS_TRAILS; j++) {
+        ship *o = ais_find_ship(ais_trails[j].mmsi);
+        if(!o || o->trail != j) { // its target is gone
+            worst = j;
+            break;
+        }
+        float score = ais_irrelevance(*o, position, slat, slon, t);
+        if(score > worst_score) {
+            worst = j;
+            worst_score = score;
+        }
+    }
+    if(worst == AIS_TRAIL_NONE)
+        return worst;
+
+    ship *o = ais_find_ship(ais_trails[worst].mmsi);
+    if(o && o->trail == worst)
+        o->trail = AIS_TRAIL_NONE;
+    ais_trails[worst].mmsi = s.mmsi;
+    ais_trails[worst].count = 0;
+    return worst;
+}
+
+// s has a new position
+static void ais_trail_update(ship &s)
+{
+    if(s.trail == AIS_TRAIL_NONE && (s.trail = ais_trail_take(s)) == AIS_TRAIL_NONE)
+        return;
+
+    ais_trail_t &tr = ais_trails[s.trail];
+    uint16_t now = millis() / 1000;
+    int32_t lat = lroundf(s.lat * 600000), lon = lroundf(s.lon * 600000);
+    if(tr.count && (uint16_t)(now - tr.time[tr.head]) > AIS_TRAIL_AGE)
+        tr.count = 0; // all hidden, start over before the seconds wrap
+    if(tr.count) {
+        int h = tr.head;
+        if((uint16_t)(now - tr.time[h]) < AIS_TRAIL_INTERVAL)
+            return;
+        float dlat = (lat - tr.lat[h]) / 10000.0f, dlon = (lon - tr.lon[h]) / 10000.0f;
+        if(hypotf(dlat, cosf(deg2rad(s.lat)) * dlon) < AIS_TRAIL_DISTANCE)
+            return;
+        tr.head = (h + 1) % AIS_TRAIL_LENGTH;
+    }
+    tr.lat[tr.head] = lat;
+    tr.lon[tr.head] = lon;
+    tr.time[tr.head] = now;
+    if(tr.count < AIS_TRAIL_LENGTH)
+        tr.count++;
+}
+
+// the kth point of the trail of s newest first, false past the end
+bool ais_trail_point(const ship &s, int k, float &lat, float &lon)
+{
+    if(s.trail == AIS_TRAIL_NONE)
+        return false;
+    const ais_trail_t &tr = ais_trails[s.trail];
+    if(tr.mmsi != s.mmsi || k >= tr.count)
+        return false;
+    int p = (tr.head + AIS_TRAIL_LENGTH - k) % AIS_TRAIL_LENGTH;
+    if((uint16_t)(millis() / 1000 - tr.time[p]) > AIS_TRAIL_AGE)
+        return false;
+    lat = tr.lat[p] / 600000.0f;
+    lon = tr.lon[p] / 600000.0f;
+    return true;
+}
+
+// the entry for mmsi, added if it is new
+static ship &ais_ship(int mmsi)
+{
+    int i = ais_lower_bound(mmsi);
+    if(i < ships_count && ships[i].mmsi == mmsi)
+        return ships[i];
+
+    if(ships_count >= ais_capacity()) {
+        int e = ais_evict_index();
+        ais_remove(e);
+        ais_stats.evicted++;
+        if(e < i)
+            i--;
+    }
+
+    std::move_backward(ships + i, ships + ships_count, ships + ships_count + 1);
+    ships_count++;
+    ais_grid.stale = ais_threats.stale = true;
+    ships[i] = ship();
+    ships[i].mmsi = mmsi;
+    ships[i].cpa = ships[i].dist = NAN;
+    ships[i].trail = AIS_TRAIL_NONE;
+    return ships[i];
+}
+
+// drop targets not heard within the timeout, at most once a second
+void ais_expire()
+{
+    static uint32_t expire_time;
+    uint32_t t = millis();
+    if(t - expire_time < 1000)
+        return;
+    expire_time = t;
+
+    uint32_t timeout = settings.ais_target_timeout * 60000;
+    int n = 0;
+    for(int i=0; i<ships_count; i++) {
+        if(t - ships[i].heard > timeout) {
+            ais_stats.expired++;
+            continue;
+        }
+        if(n != i)
+            ships[n] = std::move(ships[i]);
+        n++;
+    }
+    if(n != ships_count)
+        ais_grid.stale = ais_threats.stale = true;
+    ships_count = n;
+
+    while(ships_count > ais_capacity()) { // the setting was lowered
+        ais_remove(ais_evict_index());
+        ais_stats.evicted++;
+    }
+}
+
+static void ais_grid_cell(float lat, float lon, int &cx, int &cy)
+{
+    cy = floorf(lat * 60 / AIS_GRID_CELL);
+    cx = floorf(lon * 60 / AIS_GRID_CELL);
+    cx = (cx % AIS_GRID_COLUMNS + AIS_GRID_COLUMNS) % AIS_GRID_COLUMNS;
+}
+
+static int ais_grid_bucket(int cx, int cy)
+{
+    return (cx * 73856093u ^ cy * 19349663u) % AIS_GRID_BUCKETS;
+}
+
+static void ais_grid_link(int i)
+{
+    int cx, cy;
+    ais_grid_cell(ships[i].lat, ships[i].lon, cx, cy);
+    int b = ais_grid_bucket(cx, cy);
+    ais_grid.cx[i] = cx;
+    ais_grid.cy[i] = cy;
+    ais_grid.next[i] = ais_grid.head[b];
+    ais_grid.head[b] = i;
+}
+
+static void ais_grid_rebuild()
+{
+    for(int b=0; b<AIS_GRID_BUCKETS; b++)
+        ais_grid.head[b] = -1;
+    for(int i=0; i<ships_count; i++) {
+        if(ships[i].timestamp)
+            ais_grid_link(i);
+        else
+            ais_grid.cy[i] = AIS_GRID_NONE;
+    }
+    ais_grid.stale = false;
+}
+
+// target i has a new position
+static void ais_grid_update(int i)
+{
+    if(ais_grid.stale)
+        return;
+
+    int cx, cy;
+    ais_grid_cell(ships[i].lat, ships[i].lon, cx, cy);
+    if(ais_grid.cy[i] != AIS_GRID_NONE) {
+        if(cx == ais_grid.cx[i] && cy == ais_grid.cy[i])
+            return;
+        int16_t *p = &ais_grid.head[ais_grid_bucket(ais_grid.cx[i], ais_grid.cy[i])];
+        while(*p != i)
+            p = &ais_grid.next[*p];
+        *p = ais_grid.next[i];
+    }
+    ais_grid_link(i);
+}
+
+// indices of targets within range miles in no particular order,
+// found must have room for AIS_SHIPS_MAX
+int ais_within(float lat, float lon, float range, int *found)
+{
+    if(isnan(lat) || isnan(lon))
+        return 0;
+    if(ais_grid.stale)
+        ais_grid_rebuild();
+
+    int n = 0;
+    // a minute of latitude is a mile, longitude is narrowest nearest the pole
+    float rows = range / AIS_GRID_CELL;
+    float cols = rows / fmaxf(cosf(deg2rad(fminf(fabsf(lat) + range/60, 90))), 1e-3f);
+    int cx0, cy0, cx1, cy1;
+    ais_grid_cell(lat - rows*AIS_GRID_CELL/60, lon, cx0, cy0);
+    ais_grid_cell(lat + rows*AIS_GRID_CELL/60, lon, cx1, cy1);
+
+    // for large ranges visiting every target is cheaper than every cell
+    if((cy1 - cy0 + 1) * (2*cols + 3) > AIS_GRID_BUCKETS) {
+        for(int i=0; i<ships_count; i++)
+            if(ships[i].timestamp && hypotf(ships[i].simple_x(lon), ships[i].simple_y(lat)) <= range)
+                found[n++] = i;
+        return n;
+    }
+
+    int half = ceilf(cols);
+    for(int cy=cy0; cy<=cy1; cy++)
+        for(int d=-half; d<=half; d++) {
+            int cx = ((cx0 + d) % AIS_GRID_COLUMNS + AIS_GRID_COLUMNS) % AIS_GRID_COLUMNS;
+            for(int i = ais_grid.head[ais_grid_bucket(cx, cy)]; i >= 0; i = ais_grid.next[i]) {
+                if(ais_grid.cx[i] != cx || ais_grid.cy[i] != cy)
+                    continue; // another cell in the same bucket
+                ship &s = ships[i];
+                if(hypotf(s.simple_x(lon), s.simple_y(lat)) <= range)
+                    found[n++] = i;
+            }
+        }
+    return n;
+}
+
+// indices of up to k targets within range miles, nearest first
+int ais_closest(float lat, float lon, float range, int k, int *found, bool moving)
+{
+    if(isnan(lat) || isnan(lon))
+        return 0;
+
+    // widen the search until it holds k targets or reaches the range
+    int n;
+    for(float r = AIS_GRID_CELL; ; r *= 2) {
+        if(r > range)
+            r = range;
+        n = ais_within(lat, lon, r, found);
+        if(moving) {
+            int m = 0;
+            for(int j=0; j<n; j++)
+                if(ships[found[j]].sog > 0)
+                    found[m++] = found[j];
+            n = m;
+        }
+        if(n >= k || r >= range)
+            break;
+    }
+
+    static float dist[AIS_SHIPS_MAX];
+    for(int j=0; j<n; j++)
+        dist[j] = hypotf(ships[found[j]].simple_x(lon), ships[found[j]].simple_y(lat));
+
+    // selection sort of the first k
+    if(k > n)
+        k = n;
+    for(int j=0; j<k; j++) {
+        int m = j;
+        for(int l=j+1; l<n; l++)
+            if(dist[l] < dist[m])
+                m = l;
+        std::swap(found[j], found[m]);
+        std::swap(dist[j], dist[m]);
+    }
+    return k;
+}
+
+static bool decode_ais_data(const ais_payload &data)
 {
     int message_type = ais_n(data, 0, 6);
     int mmsi = ais_n(data, 8, 30);
 
     //printf("decode ais_data %d %d\n", message_type, mmsi);
 
-    if(ships.find(mmsi) == ships.end())
-        ships[mmsi] = ship();
+    if(message_type != 5 && message_type != 24 && (message_type < 1 || message_type > 3) &&
+       message_type != 18 && message_type != 19)
+        return false;
 
-    ship &s = ships[mmsi];
-    s.mmsi = mmsi;
+    ais_expire();
+    ship &s = ais_ship(mmsi);
+    s.heard = millis();
     if(message_type >=1 && message_type <=3) {
-        s.status = ais_status(ais_n(data, 38, 4));
+        s.status = ais_n(data, 38, 4);
         s.rot = ais_rot(ais_n(data, 42, 8, true));
         s.sog = ais_sog(ais_n(data, 50, 10));
         //'pos_acc': ais_n(data[60:61)),
@@ -228,17 +915,19 @@ static bool decode_ais_data(std::vector<bool> &data)
         s.cog = ais_cog(ais_n(data, 116, 12));
         //'hdg' = ais_hdg(data[128:137)),
         s.timestamp = millis();
+        ais_grid_update(&s - ships);
+        ais_trail_update(s);
         //printf("ais 1 %s %f %f %f %f %f\n", s.status.c_str(), s.rot, s.sog, s.lon, s.lat, s.cog);
     } else if(message_type == 5) {
-        s.callsign = ais_t(data, 70, 42);
-        s.name = ais_t(data, 112, 120);
-        s.shiptype = ais_e(ais_n(data, 232, 8));
+        ais_t(data, 70, 7, s.callsign);
+        ais_t(data, 112, 20, s.name);
+        s.shiptype = ais_n(data, 232, 8);
         s.to_bow = ais_n(data, 240, 9);
         s.to_stern = ais_n(data, 249, 9);
         s.to_port = ais_n(data, 258, 6);
         s.to_starboard = ais_n(data, 264, 6);
         s.draught = ais_n(data, 294, 8);
-        s.destination = ais_t(data, 302, 120);
+        ais_t(data, 302, 20, s.destination);
     } else if(message_type == 18) {
         s.sog = ais_sog(ais_n(data, 46, 10));
         s.lon = ais_ll(ais_n(data, 57, 28, true));
@@ -246,26 +935,30 @@ static bool decode_ais_data(std::vector<bool> &data)
         s.cog = ais_cog(ais_n(data, 112, 12));
         s.hdg = ais_hdg(ais_n(data, 124, 9));
         s.timestamp = millis();
+        ais_grid_update(&s - ships);
+        ais_trail_update(s);
     } else if(message_type == 19) {
         s.sog = ais_sog(ais_n(data, 46, 10));
         s.lon = ais_ll(ais_n(data, 57, 28, true));
         s.lat = ais_ll(ais_n(data, 85, 27, true));
         s.cog = ais_cog(ais_n(data, 112, 12));
         s.hdg = ais_hdg(ais_n(data, 124, 9));
-        s.name = ais_t(data, 143, 120);
-        s.shiptype = ais_e(ais_n(data, 263, 8));
+        ais_t(data, 143, 20, s.name);
+        s.shiptype = ais_n(data, 263, 8);
         s.to_bow = ais_n(data, 271, 9);
-        s.to_stern = ais_n(data, 80, 9);
+        s.to_stern = ais_n(data, 280, 9);
         s.to_port = ais_n(data, 289, 6);
         s.to_starboard = ais_n(data, 295, 6);
         s.timestamp = millis();
+        ais_grid_update(&s - ships);
+        ais_trail_update(s);
     } else if(message_type == 24) {
         int part_num = ais_n(data, 38, 2);
         if(part_num == 0)
-            s.name = ais_t(data, 40, 120);
+            ais_t(data, 40, 20, s.name);
         else if(part_num == 1) {
-            s.shiptype = ais_e(ais_n(data, 40, 8));
-            s.callsign = ais_t(data, 90, 42);
+            s.shiptype = ais_n(data, 40, 8);
+            ais_t(data, 90, 7, s.callsign);
             s.to_bow = ais_n(data, 132, 9);
             s.to_stern = ais_n(data, 141, 9);
             s.to_port = ais_n(data, 150, 6);
@@ -277,6 +970,57 @@ static bool decode_ais_data(std::vector<bool> &data)
     return true;
 }
 
+static void ais_discard(ais_fragments &f)
+{
+    ais_stats.discarded += f.next - 1;
+    f.data.clear();
+    f.next = 0;
+}
+
+// the slot for the first fragment of a message, replacing an unfinished
+// message with the same id or else the one idle the longest
+static ais_fragments &ais_first_slot(char channel, char seq, int count)
+{
+    ais_fragments *slot = NULL;
+    for(int i=0; i<AIS_FRAGMENT_SLOTS; i++) {
+        ais_fragments &f = ais_slots[i];
+        if(f.next && f.channel == channel && f.seq == seq && f.count == count) {
+            slot = &f;
+            break;
+        }
+        if(!slot || (slot->next && (!f.next || (int32_t)(f.time - slot->time) < 0)))
+            slot = &f;
+    }
+    if(slot->next)
+        ais_discard(*slot);
+    slot->channel = channel;
+    slot->seq = seq;
+    slot->count = count;
+    return *slot;
+}
+
+static ais_fragments *ais_find_slot(char channel, char seq, int count)
+{
+    for(int i=0; i<AIS_FRAGMENT_SLOTS; i++) {
+        ais_fragments &f = ais_slots[i];
+        if(f.next && f.channel == channel && f.seq == seq && f.count == count)
+            return &f;
+    }
+    return NULL;
+}
+
+static bool ais_decode(ais_payload &data, data_source_e source)
+{
+    bool result = decode_ais_data(data);
+    data.clear();
+    if(result) {
+        ais_stats.messages++;
+        display_data_update(AIS_DATA, 0, source);
+    } else
+        ais_stats.invalid++;
+    return result;
+}
+
 // decode nmea ais messages and store ship information for display
 bool ais_parse_line(const char *line, data_source_e source)
 {
@@ -289,8 +1033,14 @@ bool ais_parse_line(const char *line, data_source_e source)
     int fragcount, fragindex;
     if(sscanf(line+6, ",%d,%d,", &fragcount, &fragindex) != 2)
         return false;
+    if(fragcount < 1 || fragcount > 3 || fragindex < 1 || fragindex > fragcount)
+        return false;
 
-    const char *l = skip(line+6, 4);
+    const char *l = skip(line+6, 3);
+    if(!l)
+        return false;
+    char seq = *l == ',' ? 0 : *l;
+    l = skip(l, 1);
     if(!l)
         return false;
     char channel = 'A';
@@ -307,25 +1057,68 @@ bool ais_parse_line(const char *line, data_source_e source)
     if(len > 77)
         return false;
 
-    std::vector<bool> &data = ais_data[channel == 'B'];
-    for(int i=0; i < len; i++) {
-        int d = l[i] - 48;
-        if(d > 40)
-            d -= 8;
-        for(int b=5; b>=0; b--)
-            if((1<<b) & d)
-                data.push_back(1);
-            else
-                data.push_back(0);
+    if(fragcount == 1) {
+        ais_single.clear();
+        if(!ais_single.append(l, len)) {
+            ais_single.clear();
+            ais_stats.invalid++;
+            return false;
+        }
+        return ais_decode(ais_single, source);
+    }
+
+    uint32_t t = millis();
+    for(int i=0; i<AIS_FRAGMENT_SLOTS; i++)
+        if(ais_slots[i].next && t - ais_slots[i].time > AIS_FRAGMENT_TIMEOUT)
+            ais_discard(ais_slots[i]);
+
+    ais_fragments *f;
+    if(fragindex == 1) {
+        f = &ais_first_slot(channel, seq, fragcount);
+        f->next = 1;
+    } else {
+        f = ais_find_slot(channel, seq, fragcount);
+        if(!f) {
+            ais_stats.orphaned++; // its first part was lost or timed out
+            return false;
+        }
+        if(f->next != fragindex) { // out of order or repeated, the message is lost
+            ais_stats.orphaned++;
+            ais_discard(*f);
+            return false;
+        }
+    }
+
+    f->time = t;
+    if(!f->data.append(l, len)) {
+        ais_stats.invalid++;
+        ais_discard(*f);
+        return false;
     }
 
     if(fragindex == fragcount) {
-        bool result = decode_ais_data(data);
-        //printf("decode ais data %d %d\n", result, source);
-        data.clear();
-        if(result)
-            display_data_update(AIS_DATA, 0, source);
-        return result;
-    }
-    return false;
+        f->next = 0;
+        return ais_decode(f->data, source);
+    }
+    f->next++;
+    return true; // waiting for the remaining fragments
+}
+
+// once per main loop, so the alarm and display only read the results
+void ais_poll()
+{
+    ais_expire();
+    ais_compute_cpa();
+}
+
+void ais_print_stats()
+{
+    int pending = 0;
+    for(int i=0; i<AIS_FRAGMENT_SLOTS; i++)
+        pending += ais_slots[i].next != 0;
+    printf("ais %" PRIu32 " messages, %" PRIu32 " invalid, %" PRIu32 " orphaned fragments, "
+           "%" PRIu32 " fragments discarded, %d partial\n", ais_stats.messages, ais_stats.invalid,
+           ais_stats.orphaned, ais_stats.discarded, pending);
+    printf("ais %d of %d targets, %" PRIu32 " expired, %" PRIu32 " evicted\n", ships_count, ais_capacity(),
+           ais_stats.expired, ais_stats.evicted);
 }
@@ -5,29 +5,60 @@
  * License as published by the Free Software Foundation; either
  * version 3 of the License, or (at your option) any later version.
  */
-#include <map>
+
+#define AIS_TRAIL_NONE 0xff
+
+// text fields are kept as the six bit characters received, packed msb first
+#define AIS_TEXT_BYTES(chars) (((chars)*6 + 7) / 8)
 
 struct ship
 {
     int mmsi;
-    uint32_t timestamp;
+    uint32_t timestamp; // of the last position
+    uint32_t heard;     // last message of any type
 
-    std::string status;
-    
     float lat, lon, sog, cog, hdg, rot;
-    std::string name, callsign, shiptype;
-    int to_bow, to_stern, to_port, to_starboard;
-
-    int draught;
+    float cpa, dist;    // miles, from ais_compute_cpa
+    uint32_t cpa_time;  // millis() at the closest approach
 
-    std::string destination;
+    uint16_t to_bow, to_stern;
+    uint8_t to_port, to_starboard;
+    uint8_t draught;    // in tenths of a meter
+    uint8_t status;     // navigational status, see ais_status
+    uint8_t shiptype;   // see ais_e
+    uint8_t trail;      // of recent positions, AIS_TRAIL_NONE without one
 
-    float cpa, tcpa, dist;
+    uint8_t name[AIS_TEXT_BYTES(20)];
+    uint8_t callsign[AIS_TEXT_BYTES(7)];
+    uint8_t destination[AIS_TEXT_BYTES(20)];
 
     float simple_x(float slon);
     float simple_y(float slat);
-    void compute(float slat, float slon, float ssog, float scog, uint32_t t0);
+    float tcpa();       // seconds until cpa_time, nan without a cpa
 };
 
-extern std::map<int, ship> ships;
+// memory for the table is fixed, the ais_max_targets setting may use less.
+// the table and its index are in internal ram, so the device keeps at most
+// 128 targets, host tests build with more (testais, aisswarm use 5000)
+#ifndef AIS_SHIPS_MAX
+#define AIS_SHIPS_MAX 128
+#endif
+
+extern ship ships[AIS_SHIPS_MAX]; // live targets sorted by mmsi
+extern int ships_count;
+
+ship *ais_find_ship(int mmsi);
+const char *ais_status(int status);
+const char *ais_e(int type);
+std::string ais_text(const uint8_t *packed, int chars);
+void ais_expire();
+int ais_compute_cpa();
+int ais_within(float lat, float lon, float range, int *found);
+int ais_closest(float lat, float lon, float range, int k, int *found, bool moving);
+ship *ais_threat(float cpa);
+float ais_soonest_tcpa();
+int ais_threats_top(float cpa, int *found, int n);
+bool ais_trail_point(const ship &s, int k, float &lat, float &lon);
 bool ais_parse_line(const char *line, data_source_e source);
+void ais_poll();
+void ais_print_stats();
@@ -0,0 +1,493 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// simulate a fleet of ais targets for hours and drive the sentences they
+// would send through ais.cpp, then poll the table, cpa and the ais alarm
+// every second the way alarm.cpp does, reporting what each costs
+
+// g++ -std=c++20 -O2 -g -DAIS_SHIPS_MAX=5000 -o aisswarm aisswarm.cpp ais.cpp utils.cpp && ./aisswarm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "display.h"
+#include "ais.h"
+#include "utils.h"
+
+// the simulation clock, one tick a second
+static uint64_t sim_ms = 1000;
+uint32_t millis() { return sim_ms; }
+uint64_t esp_timer_get_time() { return sim_ms * 1000; }
+
+// own ship, in miles east and north of where it started
+#define ORIGIN_LAT 49.0
+#define ORIGIN_LON -123.0
+static double own_x, own_y, own_sog = 6, own_cog = 90;
+
+static double frame_lat(double y) { return ORIGIN_LAT + y / 60; }
+static double frame_lon(double x) { return ORIGIN_LON + x / 60 / cos(deg2rad(ORIGIN_LAT)); }
+
+// stubs for what ais.cpp needs from the rest of the firmware
+settings_t settings;
+void display_data_update(display_item_e item, float value, data_source_e source) {}
+bool display_data_get(display_item_e item, float &value)
+{
+    switch(item) {
+    case LATITUDE:    value = frame_lat(own_y); return true;
+    case LONGITUDE:   value = frame_lon(own_x); return true;
+    case GPS_SPEED:   value = own_sog; return true;
+    case GPS_HEADING: value = own_cog; return true;
+    default:          return false;
+    }
+}
+
+// live and peak heap, each block remembers its size
+static size_t heap_live, heap_peak;
+static uint32_t heap_allocations;
+void *operator new(size_t size)
+{
+    size_t *p = (size_t*)malloc(size + 16);
+    *p = size;
+    heap_live += size;
+    heap_peak = std::max(heap_peak, heap_live);
+    heap_allocations++;
+    return (char*)p + 16;
+}
+void operator delete(void *p) noexcept
+{
+    if(!p)
+        return;
+    size_t *b = (size_t*)((char*)p - 16);
+    heap_live -= *b;
+    free(b);
+}
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+static uint64_t clock_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+// resident set now and at most so far in kB
+static void rss(int &now, int &peak)
+{
+    now = peak = 0;
+    FILE *f = fopen("/proc/self/status", "r");
+    if(!f)
+        return;
+    char line[128];
+    while(fgets(line, sizeof line, f)) {
+        sscanf(line, "VmRSS: %d", &now);
+        sscanf(line, "VmHWM: %d", &peak);
+    }
+    fclose(f);
+}
+
+// ais payload bits, 6 to a character
+struct ais_bits {
+    uint8_t bits[64];
+    int len;
+
+    ais_bits() : len(0) { memset(bits, 0, sizeof bits); }
+
+    void put(uint32_t value, int n) {
+        for(int i=n-1; i>=0; i--, len++)
+            if(value >> i & 1)
+                bits[len/8] |= 0x80 >> len%8;
+    }
+
+    void text(const char *s, int chars) {
+        for(int i=0; i<chars; i++) {
+            int c = *s ? *s++ : '@';
+            put(c >= 64 ? c - 64 : c, 6);
+        }
+    }
+
+    int armor(char *out, int start, int count) {
+        int n = 0;
+        for(int b=start; b<start+count && b<len; b+=6) {
+            int v = 0;
+            for(int i=0; i<6; i++)
+                v = v << 1 | (b+i < len && bits[(b+i)/8] & 0x80 >> (b+i)%8);
+            out[n++] = v < 40 ? v + 48 : v + 56;
+        }
+        out[n] = '\0';
+        return n;
+    }
+};
+
+#define LINE_SIZE 96
+
+static void vdm_sentence(char *out, int count, int index, int id, const char *payload, int fill)
+{
+    char body[LINE_SIZE - 8];
+    char seq[4] = "";
+    if(count > 1)
+        snprintf(seq, sizeof seq, "%d", id);
+    snprintf(body, sizeof body, "AIVDM,%d,%d,%s,%c,%s,%d", count, index, seq, "AB"[id & 1], payload, fill);
+    uint8_t cksum = 0;
+    for(const char *c = body; *c; c++)
+        cksum ^= *c;
+    snprintf(out, LINE_SIZE, "!%s*%02X", body, cksum);
+}
+
+enum kind_e {ANCHORED, TRANSITING, CONVERGING, KIND_COUNT};
+static const char *kind_name[] = {"anchored", "transiting", "converging"};
+
+struct target_t {
+    kind_e kind;
+    bool class_b;
+    uint32_t mmsi;
+    double x, y;     // miles from the origin
+    double sog, cog; // knots, degrees
+    int next_position, next_static; // simulated seconds
+    int retire;      // stop sending and come back as a new target, 0 never
+};
+
+struct fleet_t {
+    std::vector<target_t> targets;
+    uint32_t next_mmsi;
+    int fragment_id;
+    double radius;        // miles around own ship targets are spread over
+    float cpa_limit;      // miles, for aiming converging targets
+    uint32_t spawned;
+};
+
+static double uniform(double a, double b) { return a + (b - a) * (rand() / (RAND_MAX + 1.0)); }
+
+// a new target somewhere around own ship at time t
+static void spawn(fleet_t &f, target_t &s, kind_e kind, int t)
+{
+    s = {};
+    s.kind = kind;
+    s.mmsi = f.next_mmsi++;
+    s.class_b = kind != CONVERGING && rand() % 3 == 0;
+    f.spawned++;
+
+    double r = f.radius * sqrt(uniform(0, 1)), b = uniform(0, 2*M_PI);
+    s.x = own_x + r * sin(b);
+    s.y = own_y + r * cos(b);
+    s.cog = uniform(0, 360);
+    if(kind == ANCHORED)
+        s.sog = 0;
+    else
+        s.sog = uniform(5, 20);
+
+    if(kind == CONVERGING) {
+        // aim to pass own ship after tcpa at a miss distance around the alarm limit
+        double tcpa = uniform(10, 40) / 60, miss = uniform(0, 2 * f.cpa_limit);
+        double vx = s.sog * sin(deg2rad(s.cog)) - own_sog * sin(deg2rad(own_cog));
+        double vy = s.sog * cos(deg2rad(s.cog)) - own_sog * cos(deg2rad(own_cog));
+        double v = hypot(vx, vy);
+        if(v < 1) { // too little closing speed, reverse course
+            s.cog = fmod(s.cog + 180, 360);
+            vx = s.sog * sin(deg2rad(s.cog)) - own_sog * sin(deg2rad(own_cog));
+            vy = s.sog * cos(deg2rad(s.cog)) - own_sog * cos(deg2rad(own_cog));
+            v = hypot(vx, vy);
+        }
+        s.x = own_x - vx * tcpa + miss * vy / v;
+        s.y = own_y - vy * tcpa - miss * vx / v;
+        s.retire = t + tcpa * 3600 + 15 * 60;
+    }
+
+    // report intervals as a transponder would, starting at random phases
+    s.next_position = t + rand() % 10;
+    s.next_static = t + rand() % 360;
+}
+
+static void fleet_init(fleet_t &f, int count, int converging_percent)
+{
+    f.next_mmsi = 200000000;
+    for(int i=0; i<count; i++) {
+        target_t s;
+        int k = rand() % 100;
+        kind_e kind = k < converging_percent ? CONVERGING : k < converging_percent + (100 - converging_percent) / 3 ? ANCHORED : TRANSITING;
+        spawn(f, s, kind, 0);
+        f.targets.push_back(s);
+    }
+}
+
+// seconds between position reports
+static int report_interval(const target_t &s)
+{
+    if(s.class_b)
+        return s.sog > 2 ? 30 : 180;
+    if(s.sog < .1)
+        return 180;
+    return s.sog > 14 ? 6 : 10;
+}
+
+// the sentences target s sends at time t, appended to lines
+static int target_sentences(fleet_t &f, target_t &s, int t, char (*lines)[LINE_SIZE])
+{
+    int n = 0;
+    char payload[80];
+    int lat = lround(frame_lat(s.y) * 600000), lon = lround(frame_lon(s.x) * 600000);
+    if(t >= s.next_position) {
+        ais_bits a;
+        if(s.class_b) {
+            a.put(18, 6); a.put(0, 2); a.put(s.mmsi, 30); a.put(0, 8);
+            a.put(s.sog * 10, 10); a.put(1, 1); a.put(lon & 0xfffffff, 28); a.put(lat & 0x7ffffff, 27);
+            a.put(s.cog * 10, 12); a.put(s.cog, 9); a.put(t % 60, 6); a.put(0, 2);
+            a.put(1, 1); a.put(0, 1); a.put(1, 1); a.put(1, 1); a.put(1, 1); a.put(0, 1); a.put(0, 20);
+        } else {
+            a.put(1, 6); a.put(0, 2); a.put(s.mmsi, 30); a.put(s.kind == ANCHORED ? 1 : 0, 4);
+            a.put(0, 8); a.put(s.sog * 10, 10); a.put(1, 1);
+            a.put(lon & 0xfffffff, 28); a.put(lat & 0x7ffffff, 27);
+            a.put(s.cog * 10, 12); a.put(s.cog, 9); a.put(t % 60, 6);
+            a.put(0, 2); a.put(0, 3); a.put(0, 1); a.put(0, 19);
+        }
+        a.armor(payload, 0, a.len);
+        vdm_sentence(lines[n++], 1, 1, 0, payload, 0);
+        s.next_position = t + report_interval(s);
+    }
+
+    if(t >= s.next_static) {
+        char name[21];
+        snprintf(name, sizeof name, "%s %u", kind_name[s.kind], (unsigned)s.mmsi % 100000);
+        if(s.class_b) {
+            // type 24 in two single sentence parts
+            ais_bits a;
+            a.put(24, 6); a.put(0, 2); a.put(s.mmsi, 30); a.put(0, 2); a.text(name, 20); a.put(0, 8);
+            a.armor(payload, 0, a.len);
+            vdm_sentence(lines[n++], 1, 1, 0, payload, 0);
+            ais_bits b;
+            b.put(24, 6); b.put(0, 2); b.put(s.mmsi, 30); b.put(1, 2); b.put(37, 8);
+            b.text("SIM", 3); b.put(0, 4); b.put(s.mmsi & 0xfffff, 20); b.text("CALL", 7);
+            b.put(6, 9); b.put(4, 9); b.put(2, 6); b.put(2, 6); b.put(1, 4); b.put(0, 2);
+            b.armor(payload, 0, b.len);
+            vdm_sentence(lines[n++], 1, 1, 0, payload, 0);
+        } else {
+            // type 5 in two fragments
+            ais_bits a;
+            a.put(5, 6); a.put(0, 2); a.put(s.mmsi, 30); a.put(0, 2); a.put(0, 30);
+            a.text("CALL", 7); a.text(name, 20); a.put(70, 8);
+            a.put(100, 9); a.put(20, 9); a.put(10, 6); a.put(10, 6); a.put(1, 4);
+            a.put(0, 4); a.put(0, 5); a.put(24, 5); a.put(60, 6); a.put(80, 8);
+            a.text("VANCOUVER", 20); a.put(0, 2);
+            int fill = (6 - a.len % 6) % 6;
+            f.fragment_id = (f.fragment_id + 1) % 10;
+            a.armor(payload, 0, 360);
+            vdm_sentence(lines[n++], 2, 1, f.fragment_id, payload, 0);
+            a.armor(payload, 360, a.len - 360);
+            vdm_sentence(lines[n++], 2, 2, f.fragment_id, payload, fill);
+        }
+        s.next_static = t + 360;
+    }
+    return n;
+}
+
+// move everything one second, replacing targets that are done or far away
+static void fleet_step(fleet_t &f, int t)
+{
+    double h = 1 / 3600.0;
+    own_cog = fmod(90 + 60 * sin(2 * M_PI * t / 7200) + 360, 360);
+    own_x += own_sog * h * sin(deg2rad(own_cog));
+    own_y += own_sog * h * cos(deg2rad(own_cog));
+
+    for(target_t &s : f.targets) {
+        s.x += s.sog * h * sin(deg2rad(s.cog));
+        s.y += s.sog * h * cos(deg2rad(s.cog));
+        if(s.kind == TRANSITING && rand() % 600 == 0)
+            s.cog = fmod(s.cog + uniform(-30, 30) + 360, 360);
+        if((s.retire && t >= s.retire) || hypot(s.x - own_x, s.y - own_y) > 1.5 * f.radius)
+            spawn(f, s, s.kind, t);
+    }
+}
+
+// the threat the alarm should see, by looking at every target
+static float brute_threat(float cpa)
+{
+    float best = INFINITY;
+    for(int i=0; i<ships_count; i++)
+        if(ships[i].tcpa() >= 0 && ships[i].cpa < cpa && millis() - ships[i].timestamp <= 5*60*1000)
+            best = std::min(best, ships[i].tcpa());
+    return best;
+}
+
+struct costs_t {
+    uint64_t sentences, decode_ns;
+    std::vector<uint32_t> tick_ns;
+    size_t heap_max;
+    int ships_max;
+    int alarm_ticks, alarms;
+
+    void clear() {
+        sentences = decode_ns = 0;
+        tick_ns.clear();
+        heap_max = 0;
+        ships_max = alarm_ticks = alarms = 0;
+    }
+};
+
+static void print_costs(const char *label, costs_t &c, int ticks)
+{
+    std::sort(c.tick_ns.begin(), c.tick_ns.end());
+    auto pct = [&](double p) { return c.tick_ns[std::min<size_t>(c.tick_ns.size() - 1, c.tick_ns.size() * p)] / 1000.0; };
+    uint64_t total = 0;
+    for(uint32_t ns : c.tick_ns)
+        total += ns;
+    printf("%-6s %5d targets %8.0f sentences/s decoded  tick us mean %6.1f p50 %6.1f p99 %6.1f max %7.1f"
+           "  heap %6zu  alarm %3d%% (%d)\n",
+           label, c.ships_max, c.sentences * 1e9 / std::max<uint64_t>(c.decode_ns, 1),
+           total / 1000.0 / std::max<size_t>(c.tick_ns.size(), 1), pct(.5), pct(.99), pct(1),
+           c.heap_max, c.alarm_ticks * 100 / std::max(ticks, 1), c.alarms);
+}
+
+static void usage()
+{
+    printf("usage: aisswarm [options]\n");
+    printf("  -n  targets in the fleet (default 1000)\n");
+    printf("  -c  percent of them converging on own ship (default 2)\n");
+    printf("  -r  miles around own ship they are spread over (default 20)\n");
+    printf("  -t  simulated hours (default 4)\n");
+    printf("  -m  ais_max_targets (default %d)\n", AIS_SHIPS_MAX);
+    printf("  -T  ais_target_timeout in minutes (default 10)\n");
+    printf("  -a  ais alarm cpa miles and tcpa minutes (default 1,10)\n");
+    printf("  -s  random seed (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int count = 1000, converging = 2, hours = 4, seed = 1;
+    float cpa_limit = 1, tcpa_limit = 10;
+    static fleet_t f;
+    f.radius = 20;
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+    settings.ais_target_timeout = 10;
+
+    int c;
+    while((c = getopt(argc, argv, "n:c:r:t:m:T:a:s:h")) != -1) {
+        switch(c) {
+        case 'n': count = atoi(optarg); break;
+        case 'c': converging = atoi(optarg); break;
+        case 'r': f.radius = atof(optarg); break;
+        case 't': hours = atoi(optarg); break;
+        case 'm': settings.ais_max_targets = atoi(optarg); break;
+        case 'T': settings.ais_target_timeout = atoi(optarg); break;
+        case 'a': sscanf(optarg, "%f,%f", &cpa_limit, &tcpa_limit); break;
+        case 's': seed = atoi(optarg); break;
+        default: usage(); return 1;
+        }
+    }
+    if(optind != argc || count < 1 || hours < 1) {
+        usage();
+        return 1;
+    }
+    if(settings.ais_max_targets > AIS_SHIPS_MAX) {
+        printf("ais_max_targets is at most %d in this build\n", AIS_SHIPS_MAX);
+        return 1;
+    }
+
+    srand(seed);
+    f.cpa_limit = cpa_limit;
+    fleet_init(f, count, converging);
+
+    // everything the run needs is allocated up front, so the heap is ais.cpp's
+    int ticks = hours * 3600;
+    std::vector<char> buffer(count * 4 * LINE_SIZE);
+    char (*lines)[LINE_SIZE] = (char (*)[LINE_SIZE])buffer.data();
+    costs_t hour, all;
+    hour.clear();
+    all.clear();
+    hour.tick_ns.reserve(3600);
+    all.tick_ns.reserve(ticks);
+    std::vector<int> found(AIS_SHIPS_MAX);
+    size_t heap_base = heap_live, heap_first_hour = 0;
+    int rss_now, rss_peak, failures = 0;
+    bool alarm = false;
+
+    printf("%d targets (%d%% converging) over %.0f miles for %d hours, table of %d, alarm within %.1f miles in %.0f minutes\n",
+           count, converging, f.radius, hours, settings.ais_max_targets, cpa_limit, tcpa_limit);
+    for(int t=1; t<=ticks; t++) {
+        sim_ms += 1000;
+        fleet_step(f, t);
+
+        // decode what was sent during this second
+        int n = 0;
+        for(target_t &s : f.targets)
+            n += target_sentences(f, s, t, lines + n);
+        uint64_t t0 = clock_ns();
+        for(int i=0; i<n; i++)
+            ais_parse_line(lines[i], USB_DATA);
+        hour.decode_ns += clock_ns() - t0;
+        hour.sentences += n;
+
+        // what the main loop, alarm_poll_ais and the ais page do each second
+        t0 = clock_ns();
+        ais_poll();
+        ship *s = ais_threat(cpa_limit);
+        bool alarmed = s && s->tcpa() < tcpa_limit * 60;
+        ais_within(frame_lat(own_y), frame_lon(own_x), 6, found.data());
+        hour.tick_ns.push_back(clock_ns() - t0);
+
+        hour.alarm_ticks += alarmed;
+        hour.alarms += alarmed && !alarm;
+        alarm = alarmed;
+        hour.ships_max = std::max(hour.ships_max, ships_count);
+        hour.heap_max = std::max(hour.heap_max, heap_live - heap_base);
+
+        if(ships_count > settings.ais_max_targets) {
+            printf("FAILED at %d s: %d targets in a table of %d\n", t, ships_count, settings.ais_max_targets);
+            failures++;
+        }
+        if(t % 60 == 0) {
+            float want = brute_threat(cpa_limit), got = s ? s->tcpa() : INFINITY;
+            if(want != got) {
+                printf("FAILED at %d s: threat tcpa %.1f, scan finds %.1f\n", t, got, want);
+                failures++;
+            }
+        }
+
+        if(t % 3600 == 0) {
+            char label[16];
+            snprintf(label, sizeof label, "hour %d", t / 3600);
+            all.sentences += hour.sentences;
+            all.decode_ns += hour.decode_ns;
+            all.tick_ns.insert(all.tick_ns.end(), hour.tick_ns.begin(), hour.tick_ns.end());
+            all.heap_max = std::max(all.heap_max, hour.heap_max);
+            all.ships_max = std::max(all.ships_max, hour.ships_max);
+            all.alarm_ticks += hour.alarm_ticks;
+            all.alarms += hour.alarms;
+            print_costs(label, hour, 3600);
+            hour.clear();
+
+            // after the first hour the table is full and nothing should grow
+            size_t heap = heap_live - heap_base;
+            if(t == 3600)
+                heap_first_hour = heap;
+            else if(heap > heap_first_hour) {
+                printf("FAILED: heap grew from %zu to %zu bytes\n", heap_first_hour, heap);
+                failures++;
+            }
+        }
+    }
+
+    printf("\n");
+    print_costs("total", all, ticks);
+    rss(rss_now, rss_peak);
+    printf("%u targets spawned, %d in the table, table %zu bytes static\n",
+           f.spawned, ships_count, sizeof ships);
+    printf("heap steady %zu bytes peak %zu bytes, %u allocations, rss %d kB peak %d kB\n",
+           heap_live - heap_base, heap_peak - heap_base, heap_allocations, rss_now, rss_peak);
+    ais_print_stats();
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
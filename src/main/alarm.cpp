@@ -189,25 +189,15 @@ static void alarm_poll_depth()
     }
 }
 
-float alarm_ship_tcpa;
 static void alarm_poll_ais()
 {
     if(!settings.ais_alarm)
         return;
 
-    uint32_t t = millis();
-    alarm_ship_tcpa = INFINITY;
-    for(std::map<int, ship>::iterator it = ships.begin(); it != ships.end(); it++) {
-        ship &s = it->second;
-
-        if(t-s.timestamp > 5*60) // out of date
-            return;
-
-        if(s.tcpa < alarm_ship_tcpa)
-            alarm_ship_tcpa = s.tcpa;
-        if(s.cpa < settings.ais_alarm_cpa && s.tcpa < settings.ais_alarm_tcpa*60)
-            trigger(AIS_ALARM, "SHIPS!");
-    }
+    // the target passing within the cpa limit soonest
+    ship *s = ais_threat(settings.ais_alarm_cpa);
+    if(s && s->tcpa() < settings.ais_alarm_tcpa*60)
+        trigger(AIS_ALARM, "SHIPS!");
 }
 
 static void alarm_poll_pypilot()
@@ -19,4 +19,3 @@ void menu_switch_alarm(enum alarm_e alarm);
 
 extern float alarm_anchor_dist;
 extern float lightning_distance;
-extern float alarm_ship_tcpa;
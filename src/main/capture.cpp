@@ -0,0 +1,147 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// record nmea lines and esp-now packets as received so they can be replayed
+
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+#define ESP_LOGI(tag, fmt, ...) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+uint64_t esp_timer_get_time();
+#else
+#include <esp_log.h>
+#include <esp_timer.h>
+#endif
+
+#include "settings.h"
+#include "capture.h"
+
+#define TAG "capture"
+
+#define CAPTURE_MAX_SIZE (1024*1024)
+
+static FILE *capture_file;
+static uint8_t capture_buf[4096];
+static int capture_len;
+static uint32_t capture_size, capture_count;
+static uint64_t capture_time, capture_flush_time;
+
+static void capture_flush()
+{
+    if(!capture_len)
+        return;
+    fwrite(capture_buf, capture_len, 1, capture_file);
+    fflush(capture_file);
+    capture_len = 0;
+}
+
+bool capture_start(const char *filename)
+{
+    capture_stop();
+    capture_file = fopen(filename, "wb");
+    if(!capture_file) {
+        ESP_LOGW(TAG, "failed to open '%s' for writing", filename);
+        return false;
+    }
+
+    fwrite(CAPTURE_MAGIC, strlen(CAPTURE_MAGIC), 1, capture_file);
+    capture_size = strlen(CAPTURE_MAGIC);
+    capture_count = 0;
+    capture_time = capture_flush_time = esp_timer_get_time();
+    ESP_LOGI(TAG, "capture to %s", filename);
+    return true;
+}
+
+void capture_stop()
+{
+    if(!capture_file)
+        return;
+    capture_flush();
+    fclose(capture_file);
+    capture_file = NULL;
+    ESP_LOGI(TAG, "capture stopped %" PRIu32 " records %" PRIu32 " bytes", capture_count, capture_size);
+}
+
+// write out at least once a second so little is lost on reset
+void capture_poll()
+{
+    if(!capture_file)
+        return;
+    uint64_t t = esp_timer_get_time();
+    if(t - capture_flush_time < 1000000)
+        return;
+    capture_flush();
+    capture_flush_time = t;
+}
+
+static void capture_record(uint8_t type, uint8_t source,
+                           const void *data1, int len1, const void *data2, int len2)
+{
+    int len = len1 + len2;
+    if(len > CAPTURE_MAX_DATA)
+        return;
+
+    int size = sizeof(capture_record_t) + len;
+    if(capture_size + size > CAPTURE_MAX_SIZE) {
+        ESP_LOGW(TAG, "capture file full");
+        capture_stop();
+        return;
+    }
+    if(capture_len + size > (int)sizeof capture_buf)
+        capture_flush();
+
+    uint64_t t = esp_timer_get_time();
+    uint64_t dt = t - capture_time;
+    capture_time = t;
+
+    capture_record_t r;
+    r.dt = dt > UINT32_MAX ? UINT32_MAX : dt;
+    r.type = type;
+    r.source = source;
+    r.len = len;
+
+    uint8_t *p = capture_buf + capture_len;
+    memcpy(p, &r, sizeof r);
+    memcpy(p + sizeof r, data1, len1);
+    memcpy(p + sizeof r + len1, data2, len2);
+    capture_len += size;
+    capture_size += size;
+    capture_count++;
+}
+
+void capture_nmea(const char *line, int len, data_source_e source)
+{
+    if(capture_file)
+        capture_record(CAPTURE_NMEA, source, line, len, NULL, 0);
+}
+
+void capture_esp_now(const uint8_t mac[6], const uint8_t *data, int len)
+{
+    if(capture_file)
+        capture_record(CAPTURE_ESP_NOW, ESP_DATA, mac, 6, data, len);
+}
+
+bool capture_read_header(FILE *f)
+{
+    char magic[sizeof CAPTURE_MAGIC];
+    if(fread(magic, strlen(CAPTURE_MAGIC), 1, f) != 1)
+        return false;
+    return !memcmp(magic, CAPTURE_MAGIC, strlen(CAPTURE_MAGIC));
+}
+
+bool capture_read(FILE *f, capture_record_t &r, uint8_t data[CAPTURE_MAX_DATA])
+{
+    if(fread(&r, sizeof r, 1, f) != 1)
+        return false;
+    if(r.len > CAPTURE_MAX_DATA)
+        return false;
+    return !r.len || fread(data, r.len, 1, f) == 1;
+}
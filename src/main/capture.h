@@ -0,0 +1,34 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+// a capture file is CAPTURE_MAGIC followed by records,
+// each a capture_record_t and then len bytes of data
+#define CAPTURE_MAGIC "MFDCAP01"
+#define CAPTURE_MAX_DATA 256
+#define CAPTURE_FILE "/storage/capture.bin"
+
+enum capture_type_e {CAPTURE_NMEA, CAPTURE_ESP_NOW};
+
+struct capture_record_t {
+    uint32_t dt;    // microseconds since the previous record
+    uint8_t type;   // capture_type_e
+    uint8_t source; // data_source_e of nmea lines
+    uint16_t len;   // nmea line, or 6 byte mac then the esp-now packet
+} __attribute__((packed));
+
+bool capture_start(const char *filename);
+void capture_stop();
+void capture_poll();
+void capture_nmea(const char *line, int len, data_source_e source);
+void capture_esp_now(const uint8_t mac[6], const uint8_t *data, int len);
+
+bool capture_read_header(FILE *f);
+bool capture_read(FILE *f, capture_record_t &r, uint8_t data[CAPTURE_MAX_DATA]);
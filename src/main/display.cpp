@@ -12,6 +12,7 @@
 //        test signalk
 
 #include <math.h>
+#include <map>
 #include <esp_log.h>
 
 #include "Arduino.h"
@@ -26,6 +27,7 @@
 #include "history.h"
 #include "buzzer.h"
 #include "extio.h"
+#include "nmea.h"
 
 #define TAG "display"
 
@@ -47,134 +49,53 @@
 static bool display_on = true;
 bool landscape = false;
 
-std::string display_get_item_label(display_item_e item) {
-    switch (item) {
-    case WIND_SPEED: return "Wind Speed";
-    case WIND_ANGLE: return "Wind Angle";
-    case TRUE_WIND_SPEED: return "True Wind Speed";
-    case TRUE_WIND_ANGLE: return "True Wind Angle";
-    case GPS_SPEED: return "GPS Speed";
-    case GPS_HEADING: return "GPS Heading";
-    case LATITUDE: return "Lat";
-    case LONGITUDE: return "Lon";
-    case BAROMETRIC_PRESSURE: return "Baro Pressure";
-    case AIR_TEMPERATURE: return "Air Temp";
-    case RELATIVE_HUMIDITY: return "Rel Humidity";
-    case AIR_QUALITY: return "Air Quality";
-    case BATTERY_VOLTAGE: return "Battery Voltage";
-    case WATER_SPEED: return "Water Speed";
-    case WATER_TEMPERATURE: return "Water Temp";
-    case COMPASS_HEADING: return "Compass Heading";
-    case PITCH: return "Pitch";
-    case HEEL: return "Heel";
-    case DEPTH: return "Depth";
-    case RATE_OF_TURN: return "Rate of Turn";
-    case RUDDER_ANGLE: return "Rudder Angle";
-    case TIME: return "Time";
-    case ROUTE_INFO: return "Route Info";
-    case PYPILOT: return "pypilot";
-    default: break;
-    }
-    return "";
+// fnv-1a hash of what a display shows, to tell when it must be redrawn
+static uint32_t shown_hash(const void *data, int len, uint32_t h = 2166136261u) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (int i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
 }
 
-/* ESP is esp-now
-   USB is via usb
-   RS422 is via isolated second serial port
-   W is wifi either nmea0183 or signalk
-   C is computed from other data, eg: true wind
-*/
-const char *source_name[] = { "ESP", "USB", "RS422", "C", "W" };
-
-struct display_data_t {
-    display_data_t()
-        : time(-10000) {}
-
-    float value;
-    uint32_t time;
-    data_source_e source;
-};
-
-display_data_t display_data[DISPLAY_COUNT];
-
-uint32_t data_source_time[DATA_SOURCE_COUNT];
-
-static void compute_true_wind(float wind_angle) {
-    if (display_data[TRUE_WIND_ANGLE].source != COMPUTED_DATA && !isnan(display_data[TRUE_WIND_ANGLE].value))
-        return;  // already have true wind from a better source
-
-    // first try to compute from water speed
-    float speed = NAN;
-    if (settings.compute_true_wind_from_water)
-        speed = display_data[WATER_SPEED].value;
-    if (settings.compute_true_wind_from_gps && isnan(speed))
-        speed = display_data[GPS_SPEED].value;
-
-    if (isnan(speed))
-        return;
-
-    float wind_speed = display_data[WIND_SPEED].value;
-    if (isnan(wind_speed))
-        return;
-
-    float rad = deg2rad(wind_angle);  // apparent wind in radians
-    float windvx = wind_speed * sinf(rad), windvy = wind_speed * cosf(rad) - speed;
-    float true_wind_speed = hypotf(windvx, windvy);
-    float true_wind_angle = rad2deg(atan2f(windvx, windvy));
-
-    display_data_update(TRUE_WIND_SPEED, true_wind_speed, COMPUTED_DATA);
-    display_data_update(TRUE_WIND_ANGLE, true_wind_angle, COMPUTED_DATA);
+static uint32_t shown_hash(float v, uint32_t h = 2166136261u) {
+    return shown_hash(&v, sizeof v, h);
 }
 
-void display_data_update(display_item_e item, float value, data_source_e source) {
-    //ESP_LOGI(TAG, ("display_data_update %s %f %s\n", display_get_item_label(item).c_str(), value, source_name[source]);
-    uint32_t time = millis();
-    if (isnan(value))
-        ESP_LOGW(TAG, ("invalid display data update %d %d", item, source);
-    //printf("data_update %d %s %f\n", item, display_get_item_label(item).c_str(), value);
-
-    if (source > display_data[item].source) {
-        // ignore if higher priority data source updated in last 5 seconds
-        if (time - display_data[item].time < 5000)
-            return;
-    }
-
-    history_put(item, value);
-    display_data[item].value = value;
-    display_data[item].time = time;
-    display_data[item].source = source;
-    data_source_time[source] = time;
-
-    if (item == WIND_ANGLE)  // possibly compute true wind
-        compute_true_wind(value);
-}
-
-bool display_data_get(display_item_e item, float &value) {
-    if (isnan(display_data[item].value))
-        return false;
-    value = display_data[item].value;
-    return true;
-}
-
-bool display_data_get(display_item_e item, float &value, std::string &source, uint32_t &time) {
-    if (isnan(display_data[item].value))
-        return false;
-    value = display_data[item].value;
-    source = source_name[display_data[item].source];
-    time = display_data[item].time;
-    return true;
+static uint32_t shown_hash(const std::string &str, uint32_t h = 2166136261u) {
+    return shown_hash(str.data(), str.size(), h);
 }
 
 struct display_item : public display {
     display_item(display_item_e _item)
-        : item(_item) {}
+        : item(_item), shown(0) {}
     void getAllItems(std::list<display_item_e> &items) {
         items.push_back(item);
     }
 
+    // redraw when the hash of what is shown changes
+    void invalidate_if(uint32_t state, bool always = false) {
+        if (state != shown || always)
+            draw_invalidate(x, y, w, h);
+        shown = state;
+    }
+
     enum display_item_e item;
+    uint32_t shown;
 };
 
+static int font_fit_searches;
+
+bool font_fit::same_shape(const std::string &str)
+{
+    uint8_t s[FONT_FIT_SHAPE];
+    int n = draw_text_shape(str, s, sizeof s);
+    bool same = n >= 0 && n == len && !memcmp(s, shape, n);
+    len = n;
+    if(n > 0)
+        memcpy(shape, s, n);
+    return same;
+}
+
 struct text_display : public display_item {
     text_display(display_item_e _i, std::string _units = "")
         : display_item(_i), units(_units) {
@@ -185,6 +106,7 @@ struct text_display : public display_item {
 
     void fit() {
         ht = h;
+        fitted = font_fit();
 
         if (centered)  // if centered do not draw label either for now
             label_w = label_h = 0;
@@ -212,18 +134,39 @@ struct text_display : public display_item {
     }
 
     void selectFont(std::string str) {
+        // any size between what was tried and what fit gives the same font
+        if (fitted.same_shape(str) && wt == fitted.w && ht <= fitted.from && ht >= fitted.ht) {
+            ht = fitted.ht;
+            wt = fitted.wt;
+            if (fitted.found)
+                draw_set_font(ht);
+            return;
+        }
+        fitted.w = wt;
+        fitted.from = ht;
+        fitted.found = false;
+        font_fit_searches++;
+
         // based on width and height determine best font
         for (;;) {
             if (!draw_set_font(ht))
-                return;
+                break;
 
             int width = draw_text_width(str)+2;
             if ((width + label_w < wt || ht + label_h < h) && width < wt && ht < h) {
                 wt = width;
+                fitted.found = true;
                 break;
             }
             ht--;
         }
+        fitted.ht = ht;
+        fitted.wt = wt;
+    }
+
+    void select_fonts() {
+        wt = w;
+        selectFont(getText());
     }
 
     void render() {
@@ -281,6 +224,10 @@ struct text_display : public display_item {
         return s + units;
     }
 
+    void invalidate() {
+        invalidate_if(shown_hash(getText()));
+    }
+
     virtual std::string getTextItem() = 0;
 
     virtual std::string getLabel() {
@@ -293,6 +240,7 @@ struct text_display : public display_item {
     int wt, ht, x0;
     int label_w, label_h;
     bool centered;  // currently means centered over x (and no label)  maybe should change this
+    font_fit fitted;
 };
 
 struct generic_text_display : public text_display {
@@ -338,6 +286,12 @@ struct dir_angle_text_display : public angle_text_display {
         ht = h*4/5;
     }
 
+    void invalidate() {
+        // the arrow shows the side
+        float v = display_data[item].value;
+        invalidate_if(shown_hash(getText() + (v > 0 ? ">" : v < 0 ? "<" : "")));
+    }
+
     void render() {
         text_display::render();
         
@@ -615,6 +569,15 @@ struct stat_display : public display_item {
         draw_color(RED);
         draw_text(x + (w - sw) / 2, y + h - ht, history_label);            
     }
+
+    void invalidate() {
+        int totalseconds;
+        float high, low;
+        uint32_t state = shown_hash((float)history_display_range);
+        if (history_find(item, history_display_range, totalseconds, high, low))
+            state = shown_hash(high, shown_hash(low, state));
+        invalidate_if(state);
+    }
 };
 
 struct gauge : public display_item {
@@ -791,6 +754,30 @@ struct gauge : public display_item {
         render_ticks(w > 60);
     }
 
+    // the text eases toward its place for the value over several frames
+    virtual bool text_settled() {
+        float val = display_data[item].value;
+        if (isnan(val))
+            return true;
+        float v = min_ang + (val - min_v) / (max_v - min_v) * (max_ang - min_ang);
+        float rad = deg2rad(v);
+        int txp = -r / 2 * sinf(rad), typ = r / 3 * cosf(rad);
+        return fabsf(txp - nxp) < 1 && fabsf(typ - nyp) < 1;
+    }
+
+    void select_fonts() {
+        text.select_fonts();
+    }
+
+    virtual uint32_t shown_state() {
+        uint32_t state = shown_hash(text.getText(), shown_hash(display_data[item].value));
+        return shown_hash((float)max_v, state);
+    }
+
+    virtual void invalidate() {
+        invalidate_if(shown_state(), !text_settled());
+    }
+
     text_display &text;
 
     int xc, yc, r;
@@ -806,6 +793,10 @@ struct wind_direction_gauge : public gauge {
     wind_direction_gauge(text_display *_text)
         : gauge(_text, -180, 180, -180, 180, 45) {}
 
+    uint32_t shown_state() {
+        return shown_hash(display_data[TRUE_WIND_ANGLE].value, gauge::shown_state());
+    }
+
     void render() {
         gauge::render();
         // now compute true wind from apparent
@@ -833,6 +824,10 @@ struct heading_gauge : public gauge {
     heading_gauge(text_display *_text)
         : gauge(_text, -180, 180, -180, 180, 45) {}
 
+    bool text_settled() {
+        return true;
+    }
+
     void render_dial() {
         float v = display_data[item].value;
         if (isnan(v))
@@ -865,7 +860,7 @@ struct speed_gauge : public gauge {
     speed_gauge(text_display *_text)
         : gauge(_text, 0, 5, -135, 135, 22.5), niceminmax(0) {}
 
-    void render() {
+    void invalidate() {
         float v = display_data[item].value;
         int nicemax = nice_number(v);
 
@@ -889,7 +884,7 @@ struct speed_gauge : public gauge {
             max_v = 5;
 
         //printf("maxv %f %d %d %d\n", v, nicemax, max_v, niceminmax);
-        gauge::render();
+        gauge::invalidate();
     }
 
     int niceminmax;
@@ -941,6 +936,15 @@ struct gps_wind_display : public display_item {
         draw_triangle(x0, y0, x2, y2, x3, y3);
     }
 
+    void invalidate() {
+        const display_item_e shown_items[] = {GPS_SPEED, GPS_HEADING, WIND_ANGLE,
+                                              TRUE_WIND_ANGLE, TRUE_WIND_SPEED};
+        uint32_t state = 0;
+        for (int i = 0; i < (sizeof shown_items) / (sizeof *shown_items); i++)
+            state = shown_hash(display_data[shown_items[i]].value, state);
+        invalidate_if(state);
+    }
+
     virtual void render() {
         int ht = r/3, ht2 = r/4, wt;
 
@@ -1139,6 +1143,27 @@ struct history_display : public display_item {
         }
     }
 
+    void select_fonts() {
+        text.select_fonts();
+    }
+
+    void invalidate() {
+        int totalseconds;
+        float high, low;
+        uint32_t state = shown_hash(text.getText(), shown_hash((float)history_display_range));
+        std::list<history_element> *data = history_find(item, history_display_range,
+                                                        totalseconds, high, low);
+        if (data && !data->empty()) {
+            // the plot moves a pixel at a time
+            uint64_t st = (uint64_t)start_time*1000 + esp_timer_get_time()/1000L;
+            uint64_t scroll = st * w / (totalseconds * 1000ULL);
+            state = shown_hash(&scroll, sizeof scroll, state);
+            state = shown_hash(data->front().value, shown_hash((float)data->front().time, state));
+            state = shown_hash((float)data->size(), shown_hash(high, shown_hash(low, state)));
+        }
+        invalidate_if(state);
+    }
+
     text_display &text;
     bool min_zero, inverted;
 };
@@ -1165,6 +1190,10 @@ struct route_display : public display_item {
         draw_line(x + w / 2 + p + w / 8, y, x + w / 2 + w / 4, y + h);
         draw_line(x + w / 2 + p, y, x + w / 2, y + h);
     }
+
+    void invalidate() {
+        invalidate_if(shown_hash(route_info.target_bearing, shown_hash(display_data[GPS_HEADING].value)));
+    }
 };
 
 static int ships_range = 1;
@@ -1247,23 +1276,15 @@ struct ais_ships_display : public display_item {
             return;
         }
 
-        if (closest->name.empty())
-            str = closest->mmsi;
-        else
-            str = closest->name;
-
-        float slat = display_data[LATITUDE].value;
-        float slon = display_data[LONGITUDE].value;
-        float ssog = display_data[GPS_SPEED].value;
-        float scog = display_data[GPS_HEADING].value;
-        uint32_t gps_time = display_data[GPS_HEADING].time;
+        str = ais_text(closest->name, 20);
+        if (str.empty())
+            str = int_to_str(closest->mmsi);
 
         drawItem("Closest", str);
-        closest->compute(slat, slon, ssog, scog, gps_time);
 
         drawItem("CPA", float_to_str(closest->cpa, 2));
 
-        float tcpa = closest->tcpa, itcpa;
+        float tcpa = closest->tcpa(), itcpa;
         tcpa = 60 * modff(tcpa / 60, &itcpa);
         drawItem("TCPA", float_to_str(itcpa, 0) + ":" + float_to_str(tcpa, 2));
 
@@ -1295,30 +1316,30 @@ struct ais_ships_display : public display_item {
         
         float sr = 1 + w / 90, rp = w / 20;
 
-        ship *closest = NULL;
-        float closest_dist = INFINITY;
         float slat = display_data[LATITUDE].value;
         float slon = display_data[LONGITUDE].value;
         float rng = ships_range_table[ships_range];
-        for (std::map<int, ship>::iterator it = ships.begin(); it != ships.end(); it++) {
-            ship &ship = it->second;
+        static int found[AIS_SHIPS_MAX];
+        int count = ais_within(slat, slon, rng, found);
+        for (int i = 0; i < count; i++) {
+            ship &ship = ships[found[i]];
 
-            float x = ship.simple_x(slon);
-            float y = ship.simple_y(slat);
+            float x = ship.simple_x(slon) * r / rng;
+            float y = ship.simple_y(slat) * r / rng;
 
-            float dist = hypotf(x, y);
-            if (dist > rng)
-                continue;
+            int x0 = xc + x, y0 = yc - y;
 
-            if (ship.sog > 0 && dist < closest_dist) {
-                closest = &ship;
-                closest_dist = dist;
+            // where it has been
+            draw_color(GREY);
+            float tlat, tlon;
+            int px = x0, py = y0;
+            for (int k = 0; ais_trail_point(ship, k, tlat, tlon); k++) {
+                int lx = xc + cosf(deg2rad(tlat)) * resolv(tlon - slon) * 60 * r / rng;
+                int ly = yc - (tlat - slat) * 60 * r / rng;
+                draw_line(px, py, lx, ly);
+                px = lx, py = ly;
             }
 
-            x *= r / rng;
-            y *= r / rng;
-
-            int x0 = xc + x, y0 = yc - y;
             if(isnan(ship.cog))
                 draw_color(GREY);
             else {
@@ -1338,6 +1359,25 @@ struct ais_ships_display : public display_item {
                 draw_line(x0, y0, x1, y1);
             }
         }
+
+        // ring the targets that will pass within the alarm cpa soonest
+        if (settings.ais_alarm) {
+            count = ais_threats_top(settings.ais_alarm_cpa, found, 3);
+            draw_color(RED);
+            for (int i = 0; i < count; i++) {
+                ship &ship = ships[found[i]];
+                float x = ship.simple_x(slon), y = ship.simple_y(slat);
+                if (hypotf(x, y) > rng)
+                    continue;
+                draw_circle(xc + x * r / rng, yc - y * r / rng, 2 * sr, 1);
+            }
+        }
+
+        // the nearest moving target shown
+        ship *closest = NULL;
+        if (ais_closest(slat, slon, rng, 1, found, true))
+            closest = &ships[found[0]];
+
         draw_color(WHITE);
         render_text(closest);
 
@@ -1542,6 +1582,33 @@ void grid_display::render() {
         (*it)->render();
 }
 
+// without a way to tell what changed, redraw each frame
+void display::invalidate() {
+    draw_invalidate(x, y, w, h);
+}
+
+void display::render_region(int rx, int ry, int rw, int rh) {
+    if (x < rx + rw && rx < x + w && y < ry + rh && ry < y + h) {
+        draw_color(WHITE);
+        render();
+    }
+}
+
+void grid_display::invalidate() {
+    for (std::list<display *>::iterator it = items.begin(); it != items.end(); it++)
+        (*it)->invalidate();
+}
+
+void grid_display::render_region(int rx, int ry, int rw, int rh) {
+    for (std::list<display *>::iterator it = items.begin(); it != items.end(); it++)
+        (*it)->render_region(rx, ry, rw, rh);
+}
+
+void grid_display::select_fonts() {
+    for (std::list<display *>::iterator it = items.begin(); it != items.end(); it++)
+        (*it)->select_fonts();
+}
+
 void grid_display::add(display *item) {
     items.push_back(item);
 }
@@ -1929,7 +1996,7 @@ struct pageU : public page {
         d->add(new string_text_display(ROUTE_INFO, "TTG", sttg));
     }
 
-    void render() {
+    void invalidate() {
         // update vmg
         float tbrg = route_info.target_bearing;
         float sog = display_data[GPS_SPEED].value;
@@ -1957,7 +2024,7 @@ struct pageU : public page {
         } else
             sttg = "---";
 
-        page::render();
+        page::invalidate();
     }
 
     std::string srng, sttg;
@@ -1989,9 +2056,9 @@ struct pageW : public page {
         add(new pypilot_text_display("controller T", "servo.controller_temp"));
     }
 
-    void render() {
-        page::render();
+    void invalidate() {
         pypilot_client_strobe();  // indicate we need pypilot data
+        page::invalidate();
     }
 };
 
@@ -2128,6 +2195,7 @@ bool display_toggle(bool on) {
     //extio_set(EXTIO_LED, !display_on);
 
     if(display_on) {
+        draw_invalidate_all();
 //    ledcAttachChannel(BACKLIGHT_PIN, 200, 8, 3);
 //    ledcWriteChannel(3, 254);
 //    pinMode(BACKLIGHT_PIN, OUTPUT);
@@ -2222,6 +2290,17 @@ void display_setup() {
             if (settings.enabled_pages[i] == display_pages[j].name)
                 display_pages[j].enabled = true;
 
+    // fit the text of every page as rendering would, searching each font
+    // the first time and then from the fit caches
+    for (int pass = 0; pass < 2; pass++) {
+        font_fit_searches = 0;
+        uint64_t t0 = esp_timer_get_time();
+        for (int i = 0; i < pages.size(); i++)
+            pages[i]->select_fonts();
+        ESP_LOGI(TAG, "font fit %s: %d us %d searches\n", pass ? "cached" : "search",
+                 (int)(esp_timer_get_time() - t0), font_fit_searches);
+    }
+
     setup_analog_pins();
     display_toggle(true);
 }
@@ -2316,6 +2395,19 @@ static void render_status() {
     draw_text(page_width - w, y, letter);
 }
 
+static void invalidate_status() {
+    static uint32_t shown;
+    uint32_t state = (WiFi.status() == WL_CONNECTED) | (cur_page() << 1);
+    uint32_t t0 = millis();
+    for (int i = 0; i < DATA_SOURCE_COUNT; i++)
+        if (t0 - data_source_time[i] < 5000)
+            state |= 1 << (i + 8);
+
+    if (state != shown)
+        draw_invalidate(0, page_height, page_width, (DRAW_LCD_H_RES + 60) / 18);
+    shown = state;
+}
+
 void data_timeout() {
     uint32_t t = millis();
     for (int i = 0; i < DISPLAY_COUNT; i++)
@@ -2345,9 +2437,6 @@ void display_poll() {
     //printf("draw clear %d\n", display_on);
     uint32_t t1 = millis();
 
-    draw_clear(true);
-    draw_color(WHITE);
-
 #if 0
     draw_color(GREEN);
 //    draw_box(40, 40, 30, 30);
@@ -2379,6 +2468,9 @@ void display_poll() {
     
     static uint32_t safetemp_time;
     if(over_temperature) { // above 75C is an issue...
+        draw_invalidate_all();
+        draw_clear(true);
+        draw_color(WHITE);
         int ht = 14;
         draw_set_font(ht);
         draw_text(0, 0, "OVER TEMPERATURE");
@@ -2399,6 +2491,9 @@ void display_poll() {
     safetemp_time = t0;
     
     if (force_wifi_ap_mode) {
+        draw_invalidate_all();
+        draw_clear(true);
+        draw_color(WHITE);
         int ht = 14;
         draw_set_font(ht);
         draw_text(0, 0, "WIFI AP");
@@ -2417,17 +2512,46 @@ void display_poll() {
     data_timeout();
     uint32_t t2 = millis();
 
-    if (in_menu)
-        menu_render();
-    else
-        pages[cur_page()]->render();
-
+    // everything changes with the page or in the menu
+    static int shown_page = -1;
+    static bool shown_menu;
+    if (in_menu || shown_menu || cur_page() != shown_page)
+        draw_invalidate_all();
+    if (cur_page() != shown_page)
+        draw_unpin_circles();  // keep the sizes of this page instead
+    shown_page = cur_page();
+    shown_menu = in_menu;
+
+    page *p = pages[cur_page()];
+    if (!in_menu)
+        p->invalidate();
     if (settings.show_status)
-        render_status();
+        invalidate_status();
+
+    if (!draw_regions()) {
+        draw_glyph_warmup(4);  // nothing changed, get ahead on glyphs
+        return;
+    }
+
+    int pixels = draw_dirty_pixels();
+    draw_clear(true);
+
+    // redraw what overlaps each region, clipped to it
+    int rx, ry, rw, rh;
+    for (int i = 0; draw_clip(i, rx, ry, rw, rh); i++) {
+        draw_color(WHITE);
+        if (in_menu)
+            menu_render();
+        else
+            p->render_region(rx, ry, rw, rh);
+
+        if (settings.show_status && ry + rh > page_height)
+            render_status();
+    }
 
     uint32_t t3 = millis();
 
     draw_send_buffer();
     uint32_t t4 = millis();
-    ESP_LOGI(TAG, "render took %ld %ld %ld %ld\n", t1-t0, t2-t1, t3-t2, t4-t3);
+    ESP_LOGI(TAG, "render took %ld %ld %ld %ld %d pixels\n", t1-t0, t2-t1, t3-t2, t4-t3, pixels);
 }
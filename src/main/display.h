@@ -44,6 +44,20 @@ void display_change_page(int dir);
 void display_enter_exit_menu();
 void display_menu_scale();
 void display_poll();
+extern const char *source_name[];
+
+// display_data.cpp, a lower source holds an item for 5 seconds after it updates
+struct display_data_t {
+    display_data_t()
+        : time(-10000) {}
+
+    float value;
+    uint32_t time;
+    data_source_e source;
+};
+
+extern display_data_t display_data[DISPLAY_COUNT];
+extern uint32_t data_source_time[DATA_SOURCE_COUNT];
 void display_data_update(display_item_e item, float value, data_source_e);
 bool display_data_get(display_item_e item, float &value);
 bool display_data_get(display_item_e item, float &value, std::string &source, uint64_t &time);
@@ -66,6 +80,23 @@ struct route_info_t {
     float xte, brg;
 };
 
+// the font last fitted to a box, text of the same shape (see draw_text_shape)
+// starting from the same size fits the same way without searching again
+#define FONT_FIT_SHAPE 32 // longer text is fitted every time
+
+struct font_fit {
+    font_fit() : len(-1), w(-1), from(-1), ht(0), wt(0), found(false) {}
+
+    // if str has the shape last fitted, which becomes that of str
+    bool same_shape(const std::string &str);
+
+    uint8_t shape[FONT_FIT_SHAPE];
+    int len;      // of the shape, -1 without one
+    int w, from;  // the box width and largest font size tried
+    int ht, wt;   // what was fitted
+    bool found;
+};
+
 struct display {
     display()
         : x(0), y(0), w(0), h(0), expanding(true) {}
@@ -74,6 +105,9 @@ struct display {
     virtual void render() = 0;
     virtual void fit() {}
     virtual void getAllItems(std::list<display_item_e> &items) {}
+    virtual void invalidate(); // report the area if what is shown changed
+    virtual void render_region(int rx, int ry, int rw, int rh);
+    virtual void select_fonts() {} // fit text as render would
 
     int x, y, w, h;
     bool expanding;
@@ -84,6 +118,9 @@ struct grid_display : public display {
          : cols(_cols), rows(_rows) { if(parent) parent->add(this); }
     void fit();
     void render();
+    void invalidate();
+    void render_region(int rx, int ry, int rw, int rh);
+    void select_fonts();
     void add(display *item);
     void getAllItems(std::list<display_item_e> &items_);
 
@@ -0,0 +1,145 @@
+/* Copyright (C) 2024 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// the latest value of each display item and which source it came from,
+// kept apart from the rendering so replay can run the same priority rules
+
+#include <math.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <stdio.h>
+#define ESP_LOGW(tag, fmt, ...) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+uint32_t millis(); // supplied by the host program
+#else
+#include <esp_log.h>
+
+#include "Arduino.h"
+#endif
+
+#include "settings.h"
+#include "display.h"
+#include "history.h"
+#include "utils.h"
+#include "nmea.h"
+
+#define TAG "display"
+
+std::string display_get_item_label(display_item_e item) {
+    switch (item) {
+    case WIND_SPEED: return "Wind Speed";
+    case WIND_ANGLE: return "Wind Angle";
+    case TRUE_WIND_SPEED: return "True Wind Speed";
+    case TRUE_WIND_ANGLE: return "True Wind Angle";
+    case GPS_SPEED: return "GPS Speed";
+    case GPS_HEADING: return "GPS Heading";
+    case LATITUDE: return "Lat";
+    case LONGITUDE: return "Lon";
+    case BAROMETRIC_PRESSURE: return "Baro Pressure";
+    case AIR_TEMPERATURE: return "Air Temp";
+    case RELATIVE_HUMIDITY: return "Rel Humidity";
+    case AIR_QUALITY: return "Air Quality";
+    case BATTERY_VOLTAGE: return "Battery Voltage";
+    case WATER_SPEED: return "Water Speed";
+    case WATER_TEMPERATURE: return "Water Temp";
+    case COMPASS_HEADING: return "Compass Heading";
+    case PITCH: return "Pitch";
+    case HEEL: return "Heel";
+    case DEPTH: return "Depth";
+    case RATE_OF_TURN: return "Rate of Turn";
+    case RUDDER_ANGLE: return "Rudder Angle";
+    case TIME: return "Time";
+    case ROUTE_INFO: return "Route Info";
+    case PYPILOT: return "pypilot";
+    default: break;
+    }
+    return "";
+}
+
+/* ESP is esp-now
+   USB is via usb
+   RS422 is via isolated second serial port
+   W is wifi either nmea0183 or signalk
+   C is computed from other data, eg: true wind
+*/
+const char *source_name[] = { "ESP", "USB", "RS422", "C", "W" };
+
+display_data_t display_data[DISPLAY_COUNT];
+
+uint32_t data_source_time[DATA_SOURCE_COUNT];
+
+static void compute_true_wind(float wind_angle) {
+    if (display_data[TRUE_WIND_ANGLE].source != COMPUTED_DATA && !isnan(display_data[TRUE_WIND_ANGLE].value))
+        return;  // already have true wind from a better source
+
+    // first try to compute from water speed
+    float speed = NAN;
+#ifdef CONFIG_IDF_TARGET_ESP32S3 // the host has only the base settings, both off by default
+    if (settings.compute_true_wind_from_water)
+        speed = display_data[WATER_SPEED].value;
+    if (settings.compute_true_wind_from_gps && isnan(speed))
+        speed = display_data[GPS_SPEED].value;
+#endif
+
+    if (isnan(speed))
+        return;
+
+    float wind_speed = display_data[WIND_SPEED].value;
+    if (isnan(wind_speed))
+        return;
+
+    float rad = deg2rad(wind_angle);  // apparent wind in radians
+    float windvx = wind_speed * sinf(rad), windvy = wind_speed * cosf(rad) - speed;
+    float true_wind_speed = hypotf(windvx, windvy);
+    float true_wind_angle = rad2deg(atan2f(windvx, windvy));
+
+    display_data_update(TRUE_WIND_SPEED, true_wind_speed, COMPUTED_DATA);
+    display_data_update(TRUE_WIND_ANGLE, true_wind_angle, COMPUTED_DATA);
+}
+
+void display_data_update(display_item_e item, float value, data_source_e source) {
+    //ESP_LOGI(TAG, ("display_data_update %s %f %s\n", display_get_item_label(item).c_str(), value, source_name[source]);
+    uint32_t time = millis();
+    if (isnan(value))
+        ESP_LOGW(TAG, "invalid display data update %d %d", item, source);
+    //printf("data_update %d %s %f\n", item, display_get_item_label(item).c_str(), value);
+
+    if (source > display_data[item].source) {
+        // ignore if higher priority data source updated in last 5 seconds
+        if (time - display_data[item].time < 5000) {
+            nmea_source_stats[source].rejected++;
+            return;
+        }
+    }
+    nmea_source_stats[source].accepted++;
+
+    history_put(item, value);
+    display_data[item].value = value;
+    display_data[item].time = time;
+    display_data[item].source = source;
+    data_source_time[source] = time;
+
+    if (item == WIND_ANGLE)  // possibly compute true wind
+        compute_true_wind(value);
+}
+
+bool display_data_get(display_item_e item, float &value) {
+    if (isnan(display_data[item].value))
+        return false;
+    value = display_data[item].value;
+    return true;
+}
+
+bool display_data_get(display_item_e item, float &value, std::string &source, uint32_t &time) {
+    if (isnan(display_data[item].value))
+        return false;
+    value = display_data[item].value;
+    source = source_name[display_data[item].source];
+    time = display_data[item].time;
+    return true;
+}
@@ -20,9 +20,7 @@
 
 #endif
 
-#include <sys/time.h>
 #include <string>
-#include <list>
 
 #include "settings.h"
 #include "draw.h"
@@ -43,6 +41,24 @@ static uint8_t color;
 uint8_t *framebuffer;
 static int rotation;
 
+#define MAX(a, b) ((a>b) ? (a) : (b))
+#define MIN(a, b) ((a<b) ? (a) : (b))
+
+// a rectangle of the framebuffer in device coordinates, x1 and y1 exclusive
+struct draw_rect {
+    int x0, y0, x1, y1;
+};
+
+// where drawing may touch the framebuffer
+static draw_rect clip = {0, 0, DRAW_LCD_H_RES, DRAW_LCD_V_RES};
+
+// invalidated since the last frame was sent, kept disjoint
+#define DRAW_REGIONS 4
+static draw_rect regions[DRAW_REGIONS];
+static int region_count;
+static uint32_t frames_sent; // cached circles age by it
+static void regions_sent();
+
 #ifdef USE_JLX256160
 #include "jlx256160.h"
 #else
@@ -73,6 +89,148 @@ static void convert_coords(int &x, int &y)
     }
 }
 
+static void unconvert_coords(int &x, int &y)
+{
+    switch(rotation) {
+    case 3: {
+        int t = y;
+        y = x;
+        x = DRAW_LCD_V_RES - t - 1;
+    } break;
+    case 2:
+        x = DRAW_LCD_H_RES - x - 1;
+        y = DRAW_LCD_V_RES - y - 1;
+        break;
+    case 1: {
+        int t = x;
+        x = y;
+        y = DRAW_LCD_H_RES - t - 1;
+    } break;
+    default:
+        break;
+    }
+}
+
+static int rect_area(const draw_rect &r)
+{
+    return (r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+static draw_rect rect_union(const draw_rect &a, const draw_rect &b)
+{
+    return {MIN(a.x0, b.x0), MIN(a.y0, b.y0), MAX(a.x1, b.x1), MAX(a.y1, b.y1)};
+}
+
+static void region_add(draw_rect r)
+{
+    // to whole bytes and lines of what the panel is sent
+    r.x0 = MAX(r.x0, 0) / DRAW_REGION_ALIGN_X * DRAW_REGION_ALIGN_X;
+    r.y0 = MAX(r.y0, 0) / DRAW_REGION_ALIGN_Y * DRAW_REGION_ALIGN_Y;
+    r.x1 = (r.x1 + DRAW_REGION_ALIGN_X - 1) / DRAW_REGION_ALIGN_X * DRAW_REGION_ALIGN_X;
+    r.y1 = (r.y1 + DRAW_REGION_ALIGN_Y - 1) / DRAW_REGION_ALIGN_Y * DRAW_REGION_ALIGN_Y;
+    r.x1 = MIN(r.x1, DRAW_LCD_H_RES);
+    r.y1 = MIN(r.y1, DRAW_LCD_V_RES);
+    if(r.x0 >= r.x1 || r.y0 >= r.y1)
+        return;
+
+    // absorb regions it overlaps, or when there are too many
+    // the one that grows the area the least
+    for(;;) {
+        int j = -1, grow = DRAW_LCD_H_RES*DRAW_LCD_V_RES;
+        for(int i=0; i<region_count; i++) {
+            draw_rect &o = regions[i];
+            if(r.x0 < o.x1 && o.x0 < r.x1 && r.y0 < o.y1 && o.y0 < r.y1) {
+                j = i;
+                break;
+            }
+            if(region_count == DRAW_REGIONS) {
+                int g = rect_area(rect_union(r, o)) - rect_area(r) - rect_area(o);
+                if(g < grow) {
+                    grow = g;
+                    j = i;
+                }
+            }
+        }
+        if(j < 0)
+            break;
+        r = rect_union(r, regions[j]);
+        regions[j] = regions[--region_count];
+    }
+    regions[region_count++] = r;
+
+    // mostly dirty, one rectangle is cheaper
+    if(draw_dirty_pixels() > DRAW_LCD_H_RES*DRAW_LCD_V_RES*3/4 && region_count > 1) {
+        region_count = 0;
+        regions[region_count++] = {0, 0, DRAW_LCD_H_RES, DRAW_LCD_V_RES};
+    }
+}
+
+// in page coordinates, what is drawn there changed
+void draw_invalidate(int x, int y, int w, int h)
+{
+    if(w <= 0 || h <= 0)
+        return;
+    int x0 = x, y0 = y, x1 = x + w - 1, y1 = y + h - 1;
+    convert_coords(x0, y0);
+    convert_coords(x1, y1);
+    // a pixel around for antialiasing
+    region_add({MIN(x0, x1) - 1, MIN(y0, y1) - 1, MAX(x0, x1) + 2, MAX(y0, y1) + 2});
+}
+
+void draw_invalidate_all()
+{
+    region_count = 0;
+    region_add({0, 0, DRAW_LCD_H_RES, DRAW_LCD_V_RES});
+}
+
+int draw_regions()
+{
+    return region_count;
+}
+
+// limit drawing to region i and give its bounds in page coordinates,
+// past the last region drawing is no longer limited
+bool draw_clip(int i, int &x, int &y, int &w, int &h)
+{
+    if(i >= region_count) {
+        clip = {0, 0, DRAW_LCD_H_RES, DRAW_LCD_V_RES};
+        return false;
+    }
+
+    clip = regions[i];
+    int x0 = clip.x0, y0 = clip.y0, x1 = clip.x1 - 1, y1 = clip.y1 - 1;
+    unconvert_coords(x0, y0);
+    unconvert_coords(x1, y1);
+    x = MIN(x0, x1);
+    y = MIN(y0, y1);
+    w = abs(x1 - x0) + 1;
+    h = abs(y1 - y0) + 1;
+    return true;
+}
+
+int draw_dirty_pixels()
+{
+    int area = 0;
+    for(int i=0; i<region_count; i++)
+        area += rect_area(regions[i]);
+    return area;
+}
+
+static void regions_sent()
+{
+    frames_sent++;
+    region_count = 0;
+    clip = {0, 0, DRAW_LCD_H_RES, DRAW_LCD_V_RES};
+}
+
+#ifdef __linux__
+// nothing to send to on a host build
+void draw_send_buffer()
+{
+    regions_sent();
+}
+#endif
+
 void draw_line(int x0, int y0, int x1, int y1, bool convert)
 {
     if(convert) {
@@ -103,8 +261,6 @@ void draw_line(int x0, int y0, int x1, int y1, bool convert)
     }
 }
 
-#define MAX(a, b) ((a>b) ? (a) : (b))
-#define MIN(a, b) ((a<b) ? (a) : (b))
 void draw_thick_line(int x0, int y0, int x1, int y1, int wd)
 {
     convert_coords(x0, y0);
@@ -287,31 +443,154 @@ uint8_t *sp_malloc(int size)
 #endif    
 }
 
-struct circle_cache_t
+// encoded circles by radius and thickness, their memory within a budget.
+// Circles drawn since draw_unpin_circles are pinned, the rest are kept in a
+// least recently used list to be freed first.  Pinned circles not drawn for
+// CIRCLE_PIN_FRAMES go next, as sizes change without a new page
+#ifndef CIRCLE_CACHE_SIZE
+#define CIRCLE_CACHE_SIZE (64*1024)
+#endif
+#define CIRCLE_PIN_FRAMES 16
+#define CIRCLE_ENTRIES 32
+#define CIRCLE_BUCKETS 16
+#define CIRCLE_NONE 0xff
+#define CIRCLE_LRU CIRCLE_ENTRIES        // list sentinels after the entries
+#define CIRCLE_PINNED (CIRCLE_ENTRIES+1)
+
+struct circle_entry {
+    uint8_t prev, next; // in the lru or pinned list, or next free
+    uint8_t chain;      // next in the same bucket
+    uint32_t key;
+    uint32_t frame;     // last drawn
+    int size;
+    uint8_t *data;
+};
+
+static circle_entry circles[CIRCLE_ENTRIES+2];
+static uint8_t circle_buckets[CIRCLE_BUCKETS];
+static uint8_t circle_free = CIRCLE_NONE;
+static int circle_used; // bytes of encoded circles
+static uint32_t circle_hits, circle_misses, circle_evictions, circle_uncached;
+
+static void circle_cache_setup()
 {
-    circle_cache_t(int size, uint8_t *d) : sz(size) {
-        gettimeofday(&tv, 0);
-        enc = sp_malloc(sz);
-        memcpy(enc, d, sz);
+    static bool ready;
+    if(ready)
+        return;
+    ready = true;
+
+    for(int i=CIRCLE_LRU; i<=CIRCLE_PINNED; i++)
+        circles[i].prev = circles[i].next = i;
+    for(int i=0; i<CIRCLE_BUCKETS; i++)
+        circle_buckets[i] = CIRCLE_NONE;
+    for(int i=0; i<CIRCLE_ENTRIES; i++) {
+        circles[i].next = circle_free;
+        circle_free = i;
     }
+}
 
-    uint8_t *get_data() {
-        gettimeofday(&tv, 0);
-        return enc;
-    }
+static uint8_t &circle_bucket(uint32_t key)
+{
+    return circle_buckets[(key * 2654435761u) >> 28];
+}
+
+static uint8_t circle_find(uint32_t key)
+{
+    uint8_t i = circle_bucket(key);
+    while(i != CIRCLE_NONE && circles[i].key != key)
+        i = circles[i].chain;
+    return i;
+}
+
+static void circle_unlink(uint8_t i)
+{
+    circles[circles[i].prev].next = circles[i].next;
+    circles[circles[i].next].prev = circles[i].prev;
+}
+
+static void circle_push_front(uint8_t head, uint8_t i)
+{
+    circles[i].prev = head;
+    circles[i].next = circles[head].next;
+    circles[circles[head].next].prev = i;
+    circles[head].next = i;
+}
+
+// drawing a circle pins it, the pinned list is in the order drawn
+static void circle_touch(uint8_t i)
+{
+    circle_unlink(i);
+    circle_push_front(CIRCLE_PINNED, i);
+    circles[i].frame = frames_sent;
+}
 
-    int age() {
-        timeval tv2;
-        gettimeofday(&tv2, 0);
-        return 1000000*(tv2.tv_sec - tv.tv_sec) + (tv2.tv_usec - tv.tv_usec);
+static void circle_drop(uint8_t i)
+{
+    uint8_t *b = &circle_bucket(circles[i].key);
+    while(*b != i)
+        b = &circles[*b].chain;
+    *b = circles[i].chain;
+
+    circle_unlink(i);
+    free(circles[i].data);
+    circle_used -= circles[i].size;
+    circles[i].next = circle_free;
+    circle_free = i;
+}
+
+// store an encoded circle, freeing unpinned circles least recently used
+// first to stay within the budget, then pinned ones no longer drawn
+static uint8_t circle_store(uint32_t key, const uint8_t *data, int size)
+{
+    if(size > CIRCLE_CACHE_SIZE)
+        return CIRCLE_NONE;
+
+    while(circle_used + size > CIRCLE_CACHE_SIZE || circle_free == CIRCLE_NONE) {
+        uint8_t i = circles[CIRCLE_LRU].prev;
+        if(i == CIRCLE_LRU) {
+            i = circles[CIRCLE_PINNED].prev;
+            if(i == CIRCLE_PINNED || frames_sent - circles[i].frame < CIRCLE_PIN_FRAMES)
+                return CIRCLE_NONE; // the rest are in use
+        }
+        circle_drop(i);
+        circle_evictions++;
     }
-        
-    struct timeval tv;
-    int sz;
-    uint8_t *enc;
-};
 
-static std::map <std::pair <int, int>, circle_cache_t > circle_cache;
+    uint8_t *d = sp_malloc(size);
+    if(!d)
+        return CIRCLE_NONE;
+    memcpy(d, data, size);
+
+    uint8_t i = circle_free;
+    circle_free = circles[i].next;
+    circle_entry &e = circles[i];
+    e.key = key;
+    e.size = size;
+    e.data = d;
+    e.chain = circle_bucket(key);
+    circle_bucket(key) = i;
+    circle_used += size;
+    circle_push_front(CIRCLE_PINNED, i);
+    e.frame = frames_sent;
+    return i;
+}
+
+// circles of the page left are freed first from now on
+void draw_unpin_circles()
+{
+    circle_cache_setup();
+
+    // move the pinned list to the front of the lru list
+    circle_entry &p = circles[CIRCLE_PINNED], &l = circles[CIRCLE_LRU];
+    if(p.next == CIRCLE_PINNED)
+        return;
+    circles[p.prev].next = l.next;
+    circles[l.next].prev = p.prev;
+    l.next = p.next;
+    circles[p.next].prev = CIRCLE_LRU;
+    p.next = p.prev = CIRCLE_PINNED;
+}
+
 static void putpixelb(uint8_t *buf, int r, int x, int y, uint8_t c)
 {
     if(x<0 || y < 0 || x> 2*r || y > r)
@@ -322,6 +601,57 @@ static void putpixelb(uint8_t *buf, int r, int x, int y, uint8_t c)
     buf[(2*r+1)*y+x] = d;
 }
 
+static void circle_run(int x, int y1, int y2, uint8_t c, uint8_t value, int len)
+{
+    if(c == GRAYS-1) {
+        draw_scanline(x, y1, value, len);
+        draw_scanline(x, y2, value, len);
+    } else {
+        blend_scanline(x, y1, value, len);
+        blend_scanline(x, y2, value, len);
+    }
+}
+
+// draw the top half of an encoded circle and its mirror for the bottom
+static void circle_blit(int xm, int ym, int r, const uint8_t *buf, int sz)
+{
+    convert_coords(xm, ym);
+    int x = 0, y = 0;
+    for(int i=0; i<sz; i++) {
+        if(buf[i] & 0x80) {
+            uint8_t len = (buf[i] & ~0x80) + 1;
+            x+=len%(2*r+1);
+            y+=len/(2*r+1);
+            if(x > 2*r) {
+                x -= 2*r+1;
+                y++;
+            }
+        } else {
+            uint8_t c = buf[i]&0x7;
+            uint8_t len = (buf[i]>>3) + 1;
+
+            uint8_t value = palette[color][c];
+            int len1 = len, len2=0;
+            if(len1 + x > 2*r) {
+                len1 = 2*r+1 - x;
+                len2 = len - len1;
+            }
+
+            circle_run(xm - r + x, ym - r + y, ym + r - y, c, value, len1);
+            x+=len1;
+            if(x > 2*r) {
+                x -= 2*r+1;
+                y++;
+            }
+
+            if(len2) {
+                circle_run(xm - r + x, ym - r + y, ym + r - y, c, value, len2);
+                x+=len2;
+            }
+        }
+    }
+}
+
 void draw_circle(int xm, int ym, int r, int th)
 {
     //printf("draw circle %d %d %d %d\n", xm, ym, r, th);
@@ -338,109 +668,16 @@ void draw_circle(int xm, int ym, int r, int th)
         return;
     }
 
-    std::pair pair = std::make_pair(r, th);
-    // render circle from cache
-    if(circle_cache.find(pair) != circle_cache.end()) {
-        convert_coords(xm, ym);
-        circle_cache_t &c = circle_cache.at(pair);
-        uint8_t *buf = c.get_data();
-        int sz = c.sz;
-        int x = 0, y = 0;
-        for(int i=0; i<sz; i++) {
-            if(buf[i] & 0x80) {
-                uint8_t len = (buf[i] & ~0x80) + 1;
-                x+=len%(2*r+1);
-                y+=len/(2*r+1);
-                if(x > 2*r) {
-                    x -= 2*r+1;
-                    y++;
-                }
-            } else {
-                uint8_t c = buf[i]&0x7;
-                uint8_t len = (buf[i]>>3) + 1;
-
-                uint8_t value = palette[color][c];
-                int len1 = len, len2=0;
-                if(len1 + x > 2*r) {
-                    len1 = 2*r+1 - x;
-                    len2 = len - len1;
-                }
-
-                int idx1 = DRAW_LCD_H_RES*(ym-r+y);
-                int idx2 = DRAW_LCD_H_RES*(ym+r-y);
-                int lenr = len1;
-                int xp = xm - r + x;
-                if(xp < 0) {
-                    lenr += xp;
-                    xp = 0;
-                } else {
-                    idx1 += xp;
-                    idx2 += xp;
-                }
-                
-                if(xp + lenr >= DRAW_LCD_H_RES)
-                    lenr = DRAW_LCD_H_RES - 1 - xp;
-
-                if(lenr > 0) {
-                    if(c == GRAYS-1) {
-                        if(idx1 > 0 && idx1 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                            memset(framebuffer + idx1, value, lenr);
-                        if(idx2 > 0 && idx2 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                            memset(framebuffer + idx2, value, lenr);
-                    } else {
-                        if(idx1 > 0 && idx1 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                            for(int i=0; i<lenr; i++)
-                                framebuffer[idx1++] |= value;
-                        if(idx2 > 0 && idx2 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                            for(int i=0; i<lenr; i++)
-                                framebuffer[idx2++] |= value;
-                    }
-                }
-                x+=len1;
-                if(x > 2*r) {
-                    x -= 2*r+1;
-                    y++;
-                }
-                
-                // len2
-                if(len2) {
-                    idx1 = DRAW_LCD_H_RES*(ym-r+y);
-                    idx2 = DRAW_LCD_H_RES*(ym+r-y);
-
-                    int lenr = len2;
-                    xp = xm - r + x;
-                    if(xp < 0) {
-                        lenr += xp;
-                        xp = 0;
-                    } else {
-                        idx1 += xp;
-                        idx2 += xp;
-                    }
-                
-                    if(xp + lenr >= DRAW_LCD_H_RES)
-                        lenr = DRAW_LCD_H_RES - 1 - xp;
-
-                    if(lenr > 0) {
-                        if(c == GRAYS-1) {
-                            if(idx1 > 0 && idx1 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                                memset(framebuffer + idx1, value, lenr);
-                            if(idx2 > 0 && idx2 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                                memset(framebuffer + idx2, value, lenr);
-                        } else {
-                            if(idx1 > 0 && idx1 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                                for(int i=0; i<lenr; i++)
-                                    framebuffer[idx1++] |= value;
-                            if(idx2 > 0 && idx2 + lenr < DRAW_LCD_H_RES*DRAW_LCD_V_RES)
-                                for(int i=0; i<lenr; i++)
-                                    framebuffer[idx2++] |= value;
-                        }
-                    }
-                    x+=len2;
-                }
-            }
-        }
+    circle_cache_setup();
+    uint32_t key = r<<8 | th;
+    uint8_t entry = circle_find(key);
+    if(entry != CIRCLE_NONE) {
+        circle_hits++;
+        circle_touch(entry);
+        circle_blit(xm, ym, r, circles[entry].data, circles[entry].size);
         return;
     }
+    circle_misses++;
 
     // render to buffer 1/2 circle into cache
     uint8_t *buf = sp_malloc(2*(r+1)*(r+1));
@@ -453,7 +690,6 @@ void draw_circle(int xm, int ym, int r, int th)
     int dx = 4*(a-1)*b*b, dy = 4*(b1-1)*a*a;                /* error increment */
     float i = a+b2, err = b1*a*a, dx2, dy2, e2;
     float ed;
-    int oth = th;
                                                      /* thick line correction */
     if ((th-1)*(2*b-th) > a*a) b2 = sqrtf(a*(b-a)*i*a2)/(a-th);       
     if ((th-1)*(2*a-th) > b*b) { a2 = sqrtf(b*(a-b)*i*b2)/(b-th); th = (a-a2)/2; }
@@ -528,23 +764,16 @@ void draw_circle(int xm, int ym, int r, int th)
            cnt++;
    }
    free(buf);
-   circle_cache.emplace(pair, circle_cache_t(sz, rbuf));
-   free(rbuf);
-
-   // free obsolete circles from cache
-   std::list <std::map <std::pair <int, int>, circle_cache_t >::iterator> obsolete;
-   for(std::map <std::pair <int, int>, circle_cache_t >::iterator it = circle_cache.begin(); it!=circle_cache.end(); it++) {
-       if(it->second.age() > 1000000)
-           obsolete.push_back(it);
-   }
 
-   for(std::list <std::map <std::pair <int, int>, circle_cache_t >::iterator>::iterator it = obsolete.begin(); it != obsolete.end(); it++) {
-       free((*it)->second.enc);
-       circle_cache.erase(*it);
+   // draw it from the cache, or directly if it could not be kept
+   entry = circle_store(key, rbuf, sz);
+   if(entry != CIRCLE_NONE)
+       circle_blit(xm, ym, r, circles[entry].data, sz);
+   else {
+       circle_uncached++;
+       circle_blit(xm, ym, r, rbuf, sz);
    }
-
-   // now draw it using the cache we just made
-   draw_circle(xm, ym, r, oth);
+   free(rbuf);
 }
 
 // rasterize a flat triangle
@@ -700,16 +929,291 @@ bool draw_set_font(int &ht)
     return false;
 }
 
-struct rglyph_t {
-    rglyph_t(int size, uint8_t *buf) : sz(size) {
-        data = sp_malloc(size);
-        memcpy(data, buf, size);
-    }
+#define FONT_CHARS (FONT_MAX-FONT_MIN+1)
+
+// rotated glyphs are kept in a fixed arena split into slots of a few sizes,
+// each size with its own least recently used list, and found through a
+// table indexed by font, rotation and character
+#ifndef GLYPH_ARENA_SIZE
+#ifdef USE_JLX256160
+#define GLYPH_ARENA_SIZE (24*1024)
+#define GLYPH_CLASSES 4
+#else
+#define GLYPH_ARENA_SIZE (256*1024)
+#define GLYPH_CLASSES 5
+#endif
+#endif
+#ifndef GLYPH_CLASSES
+#define GLYPH_CLASSES 4
+#endif
+#define GLYPH_SLOT_MIN 64 // each class has slots 4 times larger than the last
+#define GLYPH_NONE 0xffff
+#define GLYPH_KEYS (FONT_COUNT*4*FONT_CHARS)
+
+struct glyph_slot {
+    uint16_t prev, next; // in the lru list of its class, most recent first
+    uint16_t key;        // GLYPH_NONE when free
+    uint16_t size;
+    uint8_t cls;
     uint8_t *data;
-    int sz;
 };
 
-static std::map<std::pair<int, char>, rglyph_t> r_glyphs;
+struct glyph_class {
+    int size, first, count;
+    uint16_t head;       // list sentinel, the slot after the last
+};
+
+static uint8_t *glyph_arena;
+static uint16_t *glyph_index; // GLYPH_KEYS slots, GLYPH_NONE if not cached
+static glyph_slot *glyph_slots;
+static glyph_class glyph_classes[GLYPH_CLASSES];
+static uint32_t glyph_hits, glyph_misses, glyph_evictions, glyph_uncached, glyph_warmed;
+static int glyph_used; // bytes of the arena holding glyphs
+
+static void glyph_unlink(uint16_t i)
+{
+    glyph_slots[glyph_slots[i].prev].next = glyph_slots[i].next;
+    glyph_slots[glyph_slots[i].next].prev = glyph_slots[i].prev;
+}
+
+static void glyph_push_front(glyph_class &gc, uint16_t i)
+{
+    glyph_slot &head = glyph_slots[gc.head];
+    glyph_slots[i].prev = gc.head;
+    glyph_slots[i].next = head.next;
+    glyph_slots[head.next].prev = i;
+    head.next = i;
+}
+
+static bool glyph_cache_setup()
+{
+    if(glyph_slots)
+        return true;
+
+    int total = 0;
+    for(int c=0, size=GLYPH_SLOT_MIN; c<GLYPH_CLASSES; c++, size*=4) {
+        glyph_classes[c].size = size;
+        glyph_classes[c].count = GLYPH_ARENA_SIZE / GLYPH_CLASSES / size;
+        total += glyph_classes[c].count;
+    }
+
+    // a sentinel for each class after the slots
+    glyph_arena = sp_malloc(GLYPH_ARENA_SIZE);
+    glyph_index = (uint16_t*)sp_malloc(GLYPH_KEYS*sizeof *glyph_index);
+    glyph_slots = (glyph_slot*)sp_malloc((total + GLYPH_CLASSES)*sizeof *glyph_slots);
+    if(!glyph_arena || !glyph_index || !glyph_slots) {
+        printf("draw: failed to allocate glyph cache\n");
+        free(glyph_arena);
+        free(glyph_index);
+        free(glyph_slots);
+        glyph_slots = NULL;
+        return false;
+    }
+
+    for(int i=0; i<GLYPH_KEYS; i++)
+        glyph_index[i] = GLYPH_NONE;
+
+    uint8_t *data = glyph_arena;
+    for(int c=0, first=0; c<GLYPH_CLASSES; c++) {
+        glyph_class &gc = glyph_classes[c];
+        gc.first = first;
+        gc.head = total + c;
+        glyph_slots[gc.head].prev = glyph_slots[gc.head].next = gc.head;
+        for(int i=first; i<first+gc.count; i++) {
+            glyph_slots[i].key = GLYPH_NONE;
+            glyph_slots[i].size = 0;
+            glyph_slots[i].cls = c;
+            glyph_slots[i].data = data;
+            data += gc.size;
+            glyph_push_front(gc, i);
+        }
+        first += gc.count;
+    }
+    return true;
+}
+
+static void glyph_touch(uint16_t i)
+{
+    glyph_unlink(i);
+    glyph_push_front(glyph_classes[glyph_slots[i].cls], i);
+}
+
+// store an encoded glyph in a free slot large enough, or else in the least
+// recently used slot of its size unless no cached glyph may be given up
+static bool glyph_store(uint16_t key, const uint8_t *data, int size, bool evict)
+{
+    int c = 0;
+    while(c < GLYPH_CLASSES && size > glyph_classes[c].size)
+        c++;
+    if(c == GLYPH_CLASSES)
+        return false;
+
+    uint16_t i = glyph_slots[glyph_classes[c].head].prev;
+    for(int d=c; d<GLYPH_CLASSES; d++) {
+        uint16_t j = glyph_slots[glyph_classes[d].head].prev;
+        if(j != glyph_classes[d].head && glyph_slots[j].key == GLYPH_NONE) {
+            i = j;
+            break;
+        }
+    }
+
+    if(i == glyph_classes[c].head)
+        return false; // no slots this size
+    glyph_slot &slot = glyph_slots[i];
+    if(slot.key != GLYPH_NONE) {
+        if(!evict)
+            return false;
+        glyph_index[slot.key] = GLYPH_NONE;
+        glyph_used -= slot.size;
+        glyph_evictions++;
+    }
+
+    memcpy(slot.data, data, size);
+    slot.key = key;
+    slot.size = size;
+    glyph_used += size;
+    glyph_index[key] = i;
+    glyph_touch(i);
+    return true;
+}
+
+static uint16_t glyph_key(int font, int c)
+{
+    return (font*4 + rotation)*FONT_CHARS + c - FONT_MIN;
+}
+
+// rotate a glyph from the font and run length encode it again into rbuf,
+// which holds w*h bytes, returning the encoded size
+static int encode_glyph(const character &ch, int w, int h, uint8_t *rbuf)
+{
+    uint8_t *buf = sp_malloc(w*h+1);
+	
+    int i=0;
+    int bx = 0, by = 0;
+    while(i<ch.size) {
+        int v = ch.data[i++];
+        int g = v&(GRAYS-1), cnt;
+	    if(h < 11) // flatten to monochrome for small font
+	      g = g>2 ? GRAYS-1 : 0;
+        if(v & 0x80) // extended
+            cnt = (ch.data[i++]+1)*16 + ((v&0x78)>>3);
+        else
+            cnt = (v>>3)+1;
+        int cx, cy;
+        for(int j=0; j<cnt; j++) {
+            switch(rotation) {
+            case 3: cx = by, cy = h-1-bx;     break;
+            case 2: cx = w-1-bx, cy = h-1-by; break;
+            case 1: cx = w-1-by, cy = bx;      break;
+            default: cx = bx, cy = by;         break;
+            }
+                
+            buf[w*cy+cx] = g;
+            if(++bx >= ch.w) {
+                bx = 0;
+                by++;
+            }
+        }
+    }
+
+    // now the character is in a buffer, we need to re-compress it again
+    int cnt = 1, last = buf[0];
+    int sz = 0;
+    buf[w*h] = 0xff; // force write on last byte
+    for(int i=1; i<=w*h; i++) {
+        if(buf[i] != last || cnt == 4096) {
+            if(cnt <= 16)
+                rbuf[sz++] = last | ((cnt-1)<<3);
+            else {
+                rbuf[sz++] = last | ((cnt&0xf)<<3) | 0x80;
+                rbuf[sz++] = (cnt >> 4) - 1;
+            }
+            last = buf[i];
+            cnt = 1;
+        } else
+            cnt++;
+    }
+
+    free(buf);
+    return sz;
+}
+
+// the fonts glyphs were drawn from at each rotation, their digits are
+// likely to be needed as values change
+static uint64_t glyph_fonts_used[4];
+static const char glyph_warm_chars[] = "0123456789.-: ";
+
+// encode up to count glyphs of the fonts in use ahead of time, into free
+// slots only, false once there is nothing left to do
+bool draw_glyph_warmup(int count)
+{
+    static int font, ci;
+    if(!glyph_cache_setup())
+        return false;
+
+    for(int n=0; n<FONT_COUNT*(sizeof glyph_warm_chars - 1) && count > 0; n++) {
+        if(++ci >= sizeof glyph_warm_chars - 1) {
+            ci = 0;
+            font = (font + 1) % FONT_COUNT;
+        }
+        if(!(glyph_fonts_used[rotation] & (1ULL << font)))
+            continue;
+
+        char c = glyph_warm_chars[ci];
+        uint16_t key = glyph_key(font, c);
+        if(glyph_index[key] != GLYPH_NONE)
+            continue;
+
+        const character &ch = fonts[font].font_data[c-FONT_MIN];
+        int w = ch.w, h = ch.h;
+        if(rotation == 1 || rotation == 3) {
+            w = ch.h;
+            h = ch.w;
+        }
+        uint8_t *rbuf = sp_malloc(w*h+1);
+        int sz = encode_glyph(ch, w, h, rbuf);
+        if(glyph_store(key, rbuf, sz, false))
+            glyph_warmed++;
+        free(rbuf);
+        count--;
+    }
+    return count == 0;
+}
+
+void draw_print_stats()
+{
+    uint32_t total = glyph_hits + glyph_misses;
+    printf("glyphs: %lu hits %lu misses (%.1f%% hit) %lu evicted %lu uncached %lu warmed\n",
+           (unsigned long)glyph_hits, (unsigned long)glyph_misses,
+           total ? 100.0 * glyph_hits / total : 0.0, (unsigned long)glyph_evictions,
+           (unsigned long)glyph_uncached, (unsigned long)glyph_warmed);
+    printf("glyph arena: %d of %d bytes used\n", glyph_used, GLYPH_ARENA_SIZE);
+
+    circle_cache_setup();
+    total = circle_hits + circle_misses;
+    int count = 0, pinned = 0;
+    for(uint8_t i = circles[CIRCLE_LRU].next; i < CIRCLE_ENTRIES; i = circles[i].next)
+        count++;
+    for(uint8_t i = circles[CIRCLE_PINNED].next; i < CIRCLE_ENTRIES; i = circles[i].next)
+        pinned++;
+    printf("circles: %lu hits %lu misses (%.1f%% hit) %lu evicted %lu uncached\n",
+           (unsigned long)circle_hits, (unsigned long)circle_misses,
+           total ? 100.0 * circle_hits / total : 0.0, (unsigned long)circle_evictions,
+           (unsigned long)circle_uncached);
+    printf("circle cache: %d of %d bytes used, %d pinned %d unpinned\n",
+           circle_used, CIRCLE_CACHE_SIZE, pinned, count);
+    if(!glyph_slots)
+        return;
+    for(int c=0; c<GLYPH_CLASSES; c++) {
+        glyph_class &gc = glyph_classes[c];
+        int used = 0;
+        for(int i=gc.first; i<gc.first+gc.count; i++)
+            if(glyph_slots[i].key != GLYPH_NONE)
+                used++;
+        printf("  %5d byte slots: %d of %d used\n", gc.size, used, gc.count);
+    }
+}
+
 static int render_glyph(char c, int x, int y)
 {
     if(c < FONT_MIN || c > FONT_MAX)
@@ -745,73 +1249,43 @@ static int render_glyph(char c, int x, int y)
         return ch.w;
     }
 
-    std::pair pair = std::make_pair(cur_font, c);
-    if(r_glyphs.find(pair) == r_glyphs.end()) {
+    if(!glyph_cache_setup())
+        return ch.w;
+    glyph_fonts_used[rotation] |= 1ULL << cur_font;
+
+    uint16_t key = glyph_key(cur_font, c);
+    uint16_t slot = glyph_index[key];
+    const uint8_t *data;
+    int size;
+    uint8_t *rbuf = NULL;
+    if(slot != GLYPH_NONE) {
+        glyph_hits++;
+        glyph_touch(slot);
+        data = glyph_slots[slot].data;
+        size = glyph_slots[slot].size;
+    } else {
         // data is in original rotation, re-encode with correct rotation
-        uint8_t *buf = sp_malloc(w*h+1);
-	
-        int i=0;
-        int bx = 0, by = 0;
-        while(i<ch.size) {
-            int v = ch.data[i++];
-            int g = v&(GRAYS-1), cnt;
-	    if(h < 11) // flatten to monochrome for small font
-	      g = g>2 ? GRAYS-1 : 0;
-            if(v & 0x80) // extended
-                cnt = (ch.data[i++]+1)*16 + ((v&0x78)>>3);
-            else
-                cnt = (v>>3)+1;
-            int cx, cy;
-            for(int j=0; j<cnt; j++) {
-                switch(rotation) {
-                case 3: cx = by, cy = h-1-bx;     break;
-                case 2: cx = w-1-bx, cy = h-1-by; break;
-                case 1: cx = w-1-by, cy = bx;      break;
-                default: cx = bx, cy = by;         break;
-                }
-                    
-                buf[w*cy+cx] = g;
-                if(++bx >= ch.w) {
-                    bx = 0;
-                    by++;
-                }
-            }
-        }
-
-        // now the character is in a buffer, we need to re-compress it again
-        uint8_t *rbuf = sp_malloc(w*h);
-        int cnt = 1, last = buf[0];
-        int sz = 0;
-        buf[w*h] = 0xff; // force write on last byte
-        for(int i=1; i<=w*h; i++) {
-            if(buf[i] != last || cnt == 4096) {
-                if(cnt <= 16)
-                    rbuf[sz++] = last | ((cnt-1)<<3);
-                else {
-                    rbuf[sz++] = last | ((cnt&0xf)<<3) | 0x80;
-                    rbuf[sz++] = (cnt >> 4) - 1;
-                }
-                last = buf[i];
-                cnt = 1;
-            } else
-                cnt++;
-        }
-
-        free(buf);
-        r_glyphs.emplace(pair, rglyph_t(sz, rbuf));
-        free(rbuf);
+        glyph_misses++;
+        rbuf = sp_malloc(w*h+1);
+        size = encode_glyph(ch, w, h, rbuf);
+        data = rbuf;
+        if(glyph_store(key, rbuf, size, true)) {
+            data = glyph_slots[glyph_index[key]].data;
+            free(rbuf);
+            rbuf = NULL;
+        } else
+            glyph_uncached++; // too large for any slot, draw it this once
     }
 
-    rglyph_t &rg = r_glyphs.at(pair);
     // we have rotated buffer data;
 //    y+=ch.yoff;
     int i=0;
     int xc = 0;
-    while(i<rg.sz) {
-        int v = rg.data[i++];
+    while(i<size) {
+        int v = data[i++];
         int g = v&(GRAYS-1), cnt;
         if(v & 0x80) // extended
-            cnt = (rg.data[i++]+1)*16 + ((v&0x78)>>3);
+            cnt = (data[i++]+1)*16 + ((v&0x78)>>3);
         else
             cnt = (v>>3)+1;
 
@@ -848,21 +1322,71 @@ static int render_glyph(char c, int x, int y)
         }
 #endif        
     }
+    free(rbuf);
     return ch.w;
 }
 
+// widths of each character in each font, and characters grouped by
+// having the same width in every font
+static uint8_t font_widths[FONT_COUNT][FONT_CHARS];
+static uint8_t font_classes[FONT_CHARS];
+static bool font_tables_built;
+
+static void build_font_tables()
+{
+    for(int i=0; i<FONT_COUNT; i++)
+        for(int c=0; c<FONT_CHARS; c++)
+            font_widths[i][c] = fonts[i].font_data[c].w;
+
+    for(int c=0; c<FONT_CHARS; c++) {
+        font_classes[c] = c;
+        for(int d=0; d<c; d++) {
+            int i;
+            for(i=0; i<FONT_COUNT; i++)
+                if(font_widths[i][c] != font_widths[i][d])
+                    break;
+            if(i == FONT_COUNT) {
+                font_classes[c] = font_classes[d];
+                break;
+            }
+        }
+    }
+    font_tables_built = true;
+}
+
 int draw_text_width(const std::string &str)
 {
+    if(!font_tables_built)
+        build_font_tables();
+
+    const uint8_t *widths = font_widths[cur_font];
     int w = 0;
     for(int i=0; i<str.length(); i++) {
         char c = str[i];
         if(c < FONT_MIN || c > FONT_MAX)
             return 0;
-        w += fonts[cur_font].font_data[c-FONT_MIN].w;
+        w += widths[c-FONT_MIN];
     }
     return w;
 }
 
+// strings with the same shape are the same width in every font,
+// so a font fitted for one fits the other.  the class of each character
+// goes in shape, returns the length or -1 if longer than size
+int draw_text_shape(const std::string &str, uint8_t *shape, int size)
+{
+    if(!font_tables_built)
+        build_font_tables();
+
+    if((int)str.length() > size)
+        return -1;
+    for(int i=0; i<str.length(); i++) {
+        char c = str[i];
+        shape[i] = (c < FONT_MIN || c > FONT_MAX) ? 0xff : font_classes[c-FONT_MIN];
+    }
+    return str.length();
+}
+
 void draw_text(int x, int y, const std::string &str)
 {
     //printf("draw text %d %d %s\n", x, y, str.c_str());
@@ -41,7 +41,19 @@ void draw_box(int x, int y, int w, int h, bool invert=false);
 void draw_triangle(int x1, int y1, int x2, int y2, int x3, int y3);
 bool draw_set_font(int &ht);
 int draw_text_width(const std::string &str);
+int draw_text_shape(const std::string &str, uint8_t *shape, int size);
 void draw_text(int x, int y, const std::string &str);
 void draw_color(color_e color);
 void draw_clear(bool display_on);
 void draw_send_buffer();
+bool draw_glyph_warmup(int count);
+void draw_unpin_circles();
+void draw_print_stats();
+
+// only the parts of the screen invalidated since the last frame are cleared,
+// redrawn and sent, or all of it when nothing was invalidated before draw_clear
+void draw_invalidate(int x, int y, int w, int h);
+void draw_invalidate_all();
+int draw_regions();
+bool draw_clip(int i, int &x, int &y, int &w, int &h);
+int draw_dirty_pixels();
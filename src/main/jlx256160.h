@@ -49,6 +49,17 @@ static void cmd(uint8_t d) { lcdcmd(LOW, d); }
 static void data(uint8_t d) { lcdcmd(HIGH, d); }
 #endif
 
+// rows in each byte sent to the panel
+#ifdef GRAYSCALE
+#define JLX_PAGE_ROWS 4
+#else
+#define JLX_PAGE_ROWS 8
+#endif
+
+// whole framebuffer bytes across, whole panel pages down
+#define DRAW_REGION_ALIGN_X 4
+#define DRAW_REGION_ALIGN_Y JLX_PAGE_ROWS
+
 static uint8_t compute_color(color_e c, uint8_t b)
 {
     return b;
@@ -203,7 +214,7 @@ void draw_setup(int r)
 
 static void putpixel(int x, int y, uint8_t c)
 {
-    if(x < 0 || y < 0 || x >= DRAW_LCD_H_RES || y >= DRAW_LCD_V_RES)
+    if(x < clip.x0 || y < clip.y0 || x >= clip.x1 || y >= clip.y1)
         return;
     if(c >= GRAYS) {
         printf("putpixel gradient out of range %d\n", c);
@@ -226,9 +237,26 @@ static uint8_t getpixel(int x, int y)
 }
 
 
+// limit a scanline to the clip, false if nothing is left
+static inline bool clip_scanline(int &x, int y, int &count)
+{
+    if(y < clip.y0 || y >= clip.y1)
+        return false;
+    if(x < clip.x0) {
+        count -= clip.x0 - x;
+        x = clip.x0;
+    }
+    if(x + count > clip.x1)
+        count = clip.x1 - x;
+    return count > 0;
+}
+
 // draw a scanline of 2bpp
 static inline void draw_scanline(int x, int y, int value, int count)
 {
+    if(!clip_scanline(x, y, count))
+        return;
+
     if(count < 3) {  // logic below assumes minimum of 3 pixels
         for(int xi=x; xi<x+count; xi++)
             putpixel(xi, y, value);
@@ -266,8 +294,16 @@ static inline void draw_scanline(int x, int y, int value, int count)
     }
 }
 
+// pixels are or'd in already
+static inline void blend_scanline(int x, int y, int value, int count)
+{
+    draw_scanline(x, y, value, count);
+}
+
 static inline void invert_scanline(int x, int y, int count)
 {
+    if(!clip_scanline(x, y, count))
+        return;
     if(count < 3)  // logic below assumes minimum of 3 pixel, dont invert narrower than that for now
         return;
 
@@ -302,22 +338,36 @@ void draw_clear(bool display_on)
 {
     uint8_t c = 0;
 #ifdef CONFIG_IDF_TARGET_ESP32
+    static bool last_invert;
+    if(settings.invert != last_invert) {
+        last_invert = settings.invert;
+        draw_invalidate_all();
+    }
     if(settings.invert)
         c = 0xff;
 #endif
-    memset(framebuffer, c, DRAW_LCD_H_RES*DRAW_LCD_V_RES/4);
+
+    // only what will be redrawn, all of it if nothing was invalidated
+    if(!region_count)
+        draw_invalidate_all();
+    for(int i=0; i<region_count; i++) {
+        draw_rect &r = regions[i];
+        for(int y=r.y0; y<r.y1; y++)
+            memset(framebuffer + ((DRAW_LCD_H_RES*y + r.x0)>>2), c, (r.x1 - r.x0)>>2);
+    }
 }
 
 #ifndef __linux__
 
 uint8_t pbuffer[256*160/4];
 
-void draw_send_buffer()
+// send a window of columns and pages of the panel
+static void send_region(draw_rect &r)
 {
     uint8_t *p = pbuffer;
 #ifdef GRAYSCALE
-    for(int x=0; x<256; x++)
-        for(int y=0; y<160; y+=4) {
+    for(int x=r.x0; x<r.x1; x++)
+        for(int y=r.y0; y<r.y1; y+=4) {
             uint8_t t = 0;
             for(int b=0; b<4; b++) {
                 uint8_t v = getpixel(x, y+b);
@@ -326,8 +376,8 @@ void draw_send_buffer()
             *(p++) = t;
         }
 #else
-    for(int x=0; x<256; x++)
-        for(int y=0; y<160; y+=8) {
+    for(int x=r.x0; x<r.x1; x++)
+        for(int y=r.y0; y<r.y1; y+=8) {
             uint8_t t = 0;
             for(int b=0; b<8; b++) {
                 uint8_t v = getpixel(x, y+b);
@@ -338,6 +388,30 @@ void draw_send_buffer()
         }
 #endif
 
+    digitalWrite(CS, LOW);
+    SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE0));
+    cmd(0x30);
+    cmd(0x75);
+    data(1 + r.y0/JLX_PAGE_ROWS);
+    data(r.y1/JLX_PAGE_ROWS);
+    cmd(0x15);
+    data(r.x0);
+    data(r.x1-1);
+    cmd(0x5c);
+    digitalWrite(RS, HIGH);
+
+    SPI.writeBytes(pbuffer, p - pbuffer);
+
+    SPI.endTransaction();
+    digitalWrite(CS, HIGH);
+    digitalWrite(RS, LOW);
+}
+
+void draw_send_buffer()
+{
+    if(!region_count)
+        return;
+
     digitalWrite(CS, LOW);
     SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE0));
     
@@ -351,30 +425,8 @@ void draw_send_buffer()
     SPI.endTransaction();
     digitalWrite(CS, HIGH);
 
-    digitalWrite(CS, LOW);
-    SPI.beginTransaction(SPISettings(4000000, MSBFIRST, SPI_MODE0));
-    cmd(0x75);
-    data(0x1);
-#ifdef GRAYSCALE
-    data(0x28);
-#else
-    data(0x14);
-#endif
-    cmd(0x15);
-    data(0x0);
-    data(0xff);
-    cmd(0x5c);
-    digitalWrite(RS, HIGH);
-
-#ifdef GRAYSCALE
-    SPI.writeBytes(pbuffer, 256*160/4);
-#else
-    SPI.writeBytes(pbuffer, 256*160/8);
-#endif
-
-    SPI.endTransaction();
-    digitalWrite(CS, HIGH);
-    digitalWrite(RS, LOW);
-    
+    for(int i=0; i<region_count; i++)
+        send_region(regions[i]);
+    regions_sent();
 }
 #endif
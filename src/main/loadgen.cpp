@@ -0,0 +1,637 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// generate instrument and ais traffic for many moving targets
+// and send it to the mfd over tcp, udp or a pty as fast as asked,
+// or to a host build of nmea.cpp and ais.cpp to measure their latency
+
+// g++ -std=c++20 -O2 -g -I. -o loadgen loadgen.cpp nmea.cpp nmea_output.cpp capture.cpp ais.cpp utils.cpp -lpthread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+#include "display.h"
+#include "nmea.h"
+#include "ais.h"
+
+// stubs for what the consumer needs from the rest of the firmware
+settings_t settings;
+bool force_wifi_ap_mode;
+bool wifi_connected;
+int signalk_discovered, pypilot_discovered;
+route_info_t route_info;
+const char *source_name[] = { "ESP", "USB", "RS422", "C", "W" };
+
+void display_data_update(display_item_e item, float value, data_source_e source) {}
+bool display_data_get(display_item_e item, float &value) { return false; }
+void history_set_time(uint32_t date, int hour, int minute, float second) {}
+void serial_write_nmea(const char *buf) {}
+
+static uint64_t clock_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
+
+uint64_t esp_timer_get_time() { return clock_us(); }
+uint32_t millis() { return clock_us() / 1000; }
+
+// instrument sentences and how many of each per cycle
+static const struct {
+    const char *name;
+    int weight;
+} instruments[] = {{"MWV", 10}, {"HDM", 10}, {"ROT", 5}, {"RSA", 5}, {"VHW", 2},
+                   {"DBT", 2}, {"MTW", 1}, {"MDA", 1}, {"RMC", 1}, {"XDR", 1}};
+
+struct target_t {
+    uint32_t mmsi;
+    double lat, lon; // degrees
+    float sog, cog;  // knots, degrees
+    int reports;
+};
+
+struct generator_t {
+    std::vector<int> schedule; // instrument index for each step of the cycle
+    int step;
+
+    std::vector<target_t> targets;
+    int next_target;
+    double ais_credit, ais_share; // ais sentences per instrument sentence
+
+    double time, dt; // simulated seconds
+    int fragment_id;
+    char pending[96]; // second fragment of a type 5 message
+
+    uint32_t instrument_count, ais_count;
+};
+
+// spread each instrument evenly through the cycle with smooth weighted round robin
+static void generator_init(generator_t &g, double instrument_rate, int targets, double period)
+{
+    int count = (sizeof instruments) / (sizeof *instruments), total = 0;
+    std::vector<int> current(count);
+    for(int i=0; i<count; i++)
+        total += instruments[i].weight;
+    for(int s=0; s<total; s++) {
+        int best = 0;
+        for(int i=0; i<count; i++) {
+            current[i] += instruments[i].weight;
+            if(current[i] > current[best])
+                best = i;
+        }
+        current[best] -= total;
+        g.schedule.push_back(best);
+    }
+
+    srand(1);
+    for(int i=0; i<targets; i++) {
+        target_t t;
+        t.mmsi = 200000000 + i;
+        t.lat = 49 + (rand() % 20000 - 10000) / 1e5;
+        t.lon = -123 + (rand() % 20000 - 10000) / 1e5;
+        t.sog = rand() % 250 / 10.0f;
+        t.cog = rand() % 3600 / 10.0f;
+        t.reports = rand() % 36;
+        g.targets.push_back(t);
+    }
+
+    double ais_rate = period > 0 ? targets / period : 0;
+    g.ais_share = instrument_rate > 0 ? ais_rate / instrument_rate : (targets ? 1e9 : 0);
+    g.dt = 1 / fmax(instrument_rate + ais_rate, 1);
+}
+
+static float wave(double t, float period, float amplitude)
+{
+    return amplitude * sin(2 * M_PI * t / period);
+}
+
+static int instrument_sentence(generator_t &g, char *out)
+{
+    double t = g.time;
+    int i = g.schedule[g.step];
+    g.step = (g.step + 1) % g.schedule.size();
+    nmea_builder b(instruments[i].name);
+    switch(i) {
+    case 0: // MWV
+        b.decimal(fmod(40 + wave(t, 17, 15) + 360, 360), 2);
+        b.text("R");
+        b.decimal(12 + wave(t, 23, 4), 2);
+        b.text("N");
+        b.text("A");
+        break;
+    case 1: // HDM
+        b.decimal(fmod(200 + wave(t, 60, 10) + 360, 360), 1);
+        b.text("M");
+        break;
+    case 2: // ROT
+        b.decimal(wave(t, 60, 2), 2);
+        b.text("A");
+        break;
+    case 3: // RSA
+        b.decimal(wave(t, 9, 12), 1);
+        b.text("A");
+        b.empty(2);
+        break;
+    case 4: // VHW
+        b.empty(4);
+        b.decimal(6 + wave(t, 31, 1), 2);
+        b.text("N");
+        b.empty(2);
+        break;
+    case 5: // DBT
+        b.empty(2);
+        b.decimal(12 + wave(t, 300, 3), 2);
+        b.text("M");
+        b.empty(2);
+        break;
+    case 6: // MTW
+        b.decimal(16.2, 1);
+        b.text("C");
+        break;
+    case 7: // MDA
+        b.empty(2);
+        b.decimal(1.0132 + wave(t, 3600, .002), 4);
+        b.text("B");
+        b.empty(4);
+        b.decimal(55, 1);
+        b.empty(11);
+        break;
+    case 8: { // RMC
+        int s = (int)t % 86400;
+        char hms[16];
+        snprintf(hms, sizeof hms, "%02d%02d%02d.00", s/3600, s/60%60, s%60);
+        b.text(hms);
+        b.text("A");
+        b.text("4907.038");
+        b.text("N");
+        b.text("12309.570");
+        b.text("W");
+        b.decimal(6.2, 1);
+        b.decimal(84.4, 1);
+        b.text("170326");
+        b.empty(2);
+        b.text("A");
+    } break;
+    case 9: // XDR
+        b.text("A");
+        b.decimal(wave(t, 7, 8), 1);
+        b.text("D");
+        b.text("ROLL");
+        break;
+    }
+    b.finish();
+    int len = b.len;
+    memcpy(out, b.buf, len + 1);
+    return len;
+}
+
+// ais payload bits, 6 to a character
+struct ais_bits {
+    uint8_t bits[64];
+    int len;
+
+    ais_bits() : len(0) { memset(bits, 0, sizeof bits); }
+
+    void put(uint32_t value, int n) {
+        for(int i=n-1; i>=0; i--, len++)
+            if(value >> i & 1)
+                bits[len/8] |= 0x80 >> len%8;
+    }
+
+    void text(const char *s, int chars) {
+        for(int i=0; i<chars; i++) {
+            int c = *s ? *s++ : '@';
+            put(c >= 64 ? c - 64 : c, 6);
+        }
+    }
+
+    int armor(char *out, int start, int count) {
+        int n = 0;
+        for(int b=start; b<start+count && b<len; b+=6) {
+            int v = 0;
+            for(int i=0; i<6; i++)
+                v = v << 1 | (b+i < len && bits[(b+i)/8] & 0x80 >> (b+i)%8);
+            out[n++] = v < 40 ? v + 48 : v + 56;
+        }
+        out[n] = '\0';
+        return n;
+    }
+};
+
+static int vdm_sentence(char *out, int count, int index, int id, const char *payload, int fill)
+{
+    char body[96];
+    char seq[4] = "";
+    if(count > 1)
+        snprintf(seq, sizeof seq, "%d", id);
+    snprintf(body, sizeof body, "AIVDM,%d,%d,%s,A,%s,%d", count, index, seq, payload, fill);
+    uint8_t cksum = 0;
+    for(const char *c = body; *c; c++)
+        cksum ^= *c;
+    return snprintf(out, 96, "!%s*%02X\r\n", body, cksum);
+}
+
+static int ais_sentence(generator_t &g, char *out)
+{
+    if(*g.pending) {
+        int len = strlen(g.pending);
+        memcpy(out, g.pending, len + 1);
+        *g.pending = '\0';
+        return len;
+    }
+
+    target_t &t = g.targets[g.next_target];
+    g.next_target = (g.next_target + 1) % g.targets.size();
+
+    // move along the course since the last report
+    double hours = g.dt * g.targets.size() / 3600;
+    t.lat += t.sog * hours * cos(t.cog * M_PI / 180) / 60;
+    t.lon += t.sog * hours * sin(t.cog * M_PI / 180) / 60 / cos(t.lat * M_PI / 180);
+    t.cog = fmod(t.cog + rand() % 11 - 5 + 360, 360);
+
+    ais_bits a;
+    char payload[80];
+    // static data in two fragments every 36 reports
+    if(t.reports++ % 36 == 0) {
+        char name[21];
+        snprintf(name, sizeof name, "TARGET %u", (unsigned)t.mmsi % 100000);
+        a.put(5, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(0, 2); a.put(0, 30);
+        a.text("CALL", 7); a.text(name, 20); a.put(36, 8);
+        a.put(10, 9); a.put(5, 9); a.put(2, 6); a.put(2, 6); a.put(1, 4);
+        a.put(0, 4); a.put(0, 5); a.put(24, 5); a.put(60, 6); a.put(20, 8);
+        a.text("VICTORIA", 20); a.put(0, 2);
+        // 60 characters in the first fragment, the rest in the second
+        int fill = (6 - a.len % 6) % 6;
+        g.fragment_id = (g.fragment_id + 1) % 10;
+        a.armor(payload, 360, a.len - 360);
+        vdm_sentence(g.pending, 2, 2, g.fragment_id, payload, fill);
+        a.armor(payload, 0, 360);
+        return vdm_sentence(out, 2, 1, g.fragment_id, payload, 0);
+    }
+
+    a.put(1, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(0, 4); a.put(0, 8);
+    a.put(t.sog * 10, 10); a.put(1, 1);
+    a.put((int32_t)lround(t.lon * 600000) & 0xfffffff, 28);
+    a.put((int32_t)lround(t.lat * 600000) & 0x7ffffff, 27);
+    a.put(t.cog * 10, 12); a.put(t.cog, 9); a.put((int)g.time % 60, 6);
+    a.put(0, 2); a.put(0, 3); a.put(0, 1); a.put(0, 19);
+    a.armor(payload, 0, a.len);
+    return vdm_sentence(out, 1, 1, 0, payload, 0);
+}
+
+static int generate(generator_t &g, char *out)
+{
+    g.time += g.dt;
+    if(!g.targets.empty() && (*g.pending || g.ais_credit >= 1)) {
+        if(!*g.pending)
+            g.ais_credit -= 1;
+        g.ais_count++;
+        return ais_sentence(g, out);
+    }
+    g.ais_credit += g.ais_share;
+    g.instrument_count++;
+    return instrument_sentence(g, out);
+}
+
+enum transport_e {TCP, UDP, PTY};
+
+struct sink_t {
+    transport_e transport;
+    int fd;
+    sockaddr_in addr;
+    std::string pty_name;
+};
+
+static bool parse_addr(const char *s, sockaddr_in &addr)
+{
+    char host[64];
+    int port;
+    if(sscanf(s, "%63[^:]:%d", host, &port) != 2)
+        return false;
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    return inet_aton(host, &addr.sin_addr);
+}
+
+static bool sink_open(sink_t &s)
+{
+    if(s.transport == TCP) {
+        s.fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(s.fd, (sockaddr*)&s.addr, sizeof s.addr)) {
+            perror("connect");
+            return false;
+        }
+        int opt = 1;
+        setsockopt(s.fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof opt);
+    } else if(s.transport == UDP) {
+        s.fd = socket(AF_INET, SOCK_DGRAM, 0);
+        int opt = 1;
+        setsockopt(s.fd, SOL_SOCKET, SO_BROADCAST, &opt, sizeof opt);
+    } else {
+        s.fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if(s.fd < 0 || grantpt(s.fd) || unlockpt(s.fd)) {
+            perror("pty");
+            return false;
+        }
+        termios tio;
+        tcgetattr(s.fd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(s.fd, TCSANOW, &tio);
+        s.pty_name = ptsname(s.fd);
+    }
+    return true;
+}
+
+static bool sink_write(sink_t &s, const char *buf, int len)
+{
+    if(s.transport == UDP)
+        return sendto(s.fd, buf, len, 0, (sockaddr*)&s.addr, sizeof s.addr) == len;
+    while(len > 0) {
+        int ret = write(s.fd, buf, len);
+        if(ret <= 0)
+            return false;
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+// when each sentence was written, by sequence, for the local consumer
+#define SENT_TIMES (1<<20)
+static uint64_t sent_time[SENT_TIMES];
+static std::atomic<uint32_t> sent_count;
+static std::atomic<bool> generator_done;
+
+struct run_t {
+    generator_t g;
+    sink_t sink;
+    double rate; // sentences/s, 0 as fast as possible
+    double duration;
+    uint64_t bytes;
+};
+
+static void *run_generator(void *arg)
+{
+    run_t &r = *(run_t*)arg;
+    char batch[1400];
+    int batch_len = 0, batch_start = 0;
+    uint32_t count = 0;
+    uint64_t start = clock_us(), report = start;
+    uint32_t report_count = 0;
+    uint64_t report_bytes = 0;
+
+    for(;;) {
+        uint64_t t = clock_us();
+        double elapsed = (t - start) * 1e-6;
+        if(r.duration > 0 && elapsed >= r.duration)
+            break;
+
+        // what is due now, or a batch at a time flat out
+        uint32_t due = r.rate > 0 ? elapsed * r.rate : count + 64;
+        while(count < due) {
+            char line[96];
+            int len = generate(r.g, line);
+            if(batch_len + len > (int)sizeof batch) {
+                for(uint32_t i=batch_start; i<count; i++)
+                    sent_time[i % SENT_TIMES] = clock_us();
+                if(!sink_write(r.sink, batch, batch_len))
+                    goto done;
+                r.bytes += batch_len;
+                sent_count = count;
+                batch_len = 0;
+                batch_start = count;
+            }
+            memcpy(batch + batch_len, line, len);
+            batch_len += len;
+            count++;
+        }
+        if(batch_len) {
+            for(uint32_t i=batch_start; i<count; i++)
+                sent_time[i % SENT_TIMES] = clock_us();
+            if(!sink_write(r.sink, batch, batch_len))
+                break;
+            r.bytes += batch_len;
+            sent_count = count;
+            batch_len = 0;
+            batch_start = count;
+        }
+
+        if(t - report >= 1000000) {
+            printf("%8.0f sentences/s %8.0f bytes/s\n", (count - report_count) / ((t - report) * 1e-6),
+                   (r.bytes - report_bytes) / ((t - report) * 1e-6));
+            report = t;
+            report_count = count;
+            report_bytes = r.bytes;
+        }
+
+        if(r.rate > 0)
+            usleep(1000);
+    }
+done:
+    double dt = (clock_us() - start) * 1e-6;
+    printf("sent %u sentences (%u instrument, %u ais) %llu bytes in %.2fs: %.0f sentences/s %.0f bytes/s\n",
+           count, r.g.instrument_count, r.g.ais_count, (unsigned long long)r.bytes, dt, count / dt, r.bytes / dt);
+    generator_done = true;
+    return NULL;
+}
+
+static double thread_cpu()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// read the pty the way serial.cpp reads usb
+static void read_pty(int fd)
+{
+    static char buf[4096];
+    static int len;
+    int ret = read(fd, buf + len, sizeof buf - len - 1);
+    if(ret <= 0)
+        return;
+    len += ret;
+    int start = 0;
+    for(int i=0; i<len; i++)
+        if(buf[i] == '\r' || buf[i] == '\n') {
+            buf[i] = '\0';
+            if(i > start)
+                nmea_parse_line(buf + start, i - start, USB_DATA);
+            start = i + 1;
+        }
+    memmove(buf, buf + start, len - start);
+    len -= start;
+}
+
+// run nmea.cpp here against the generator and time each sentence through it
+static int run_local(run_t &r)
+{
+    const int port = 17120;
+    data_source_e source = WIFI_DATA;
+    force_wifi_ap_mode = true;
+    r.sink.addr = {};
+    r.sink.addr.sin_family = AF_INET;
+    r.sink.addr.sin_port = htons(port);
+    r.sink.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(r.sink.transport == TCP) {
+        settings.input_nmea_tcp_server = true;
+        settings.nmea_tcp_server_port = port;
+    } else if(r.sink.transport == UDP) {
+        settings.input_nmea_udp = true;
+        settings.nmea_udp_addr = "127.0.0.1";
+        settings.nmea_udp_port = port;
+    } else
+        source = USB_DATA;
+    nmea_poll();
+
+    if(!sink_open(r.sink))
+        return 1;
+    int pty = -1;
+    if(r.sink.transport == PTY) {
+        pty = open(r.sink.pty_name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        termios tio;
+        tcgetattr(pty, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(pty, TCSANOW, &tio);
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_generator, &r);
+
+    std::vector<uint32_t> latency;
+    const nmea_stats_t &stats = nmea_source_stats[source];
+    uint32_t parsed = 0;
+    uint64_t idle = 0;
+    double cpu = 0; // only polls that parsed something, not waiting
+    for(;;) {
+        double cpu0 = thread_cpu();
+        if(pty >= 0)
+            read_pty(pty);
+        else
+            nmea_poll();
+        if(stats.sentences != parsed)
+            cpu += thread_cpu() - cpu0;
+
+        // sentences arrive in order, the nth parsed is the nth sent
+        uint64_t t = clock_us();
+        uint32_t n = std::min(stats.sentences, sent_count.load());
+        if(n != parsed)
+            idle = 0;
+        for(; parsed < n; parsed++)
+            latency.push_back(t - sent_time[parsed % SENT_TIMES]);
+
+        // stop once nothing more arrives, udp may have lost some
+        if(generator_done) {
+            if(!idle)
+                idle = t;
+            else if(t - idle > 200000)
+                break;
+        }
+    }
+    pthread_join(thread, NULL);
+
+    uint32_t sent = sent_count;
+    printf("consumer parsed %u of %u, %.0f ns cpu per sentence, %d ais targets\n",
+           stats.sentences, sent, cpu * 1e9 / std::max(stats.sentences, 1u), ships_count);
+    if(stats.sentences < sent)
+        printf("sentences were lost, so latency is only approximate\n");
+    if(!latency.empty()) {
+        std::sort(latency.begin(), latency.end());
+        auto pct = [&](double p) { return latency[std::min<size_t>(latency.size() - 1, latency.size() * p)]; };
+        printf("latency us: p50 %u p90 %u p99 %u max %u\n", pct(.5), pct(.9), pct(.99), latency.back());
+    }
+    printf("\n");
+    nmea_print_stats();
+    return 0;
+}
+
+static void usage()
+{
+    printf("usage: loadgen [options] (-t host:port | -u addr:port | -p | -L tcp|udp|pty)\n");
+    printf("  -t  connect to a tcp server, eg the mfd on 192.168.4.1:7114\n");
+    printf("  -u  send udp datagrams, eg to 255.255.255.255:10110\n");
+    printf("  -p  create a pty and print its name\n");
+    printf("  -L  feed a host build of nmea.cpp and ais.cpp and report its latency\n");
+    printf("  -i  instrument sentences/s (default 40)\n");
+    printf("  -a  ais targets (default 0)\n");
+    printf("  -P  seconds between reports from each target (default 10)\n");
+    printf("  -r  total sentences/s, 0 for as fast as possible (default -i plus ais)\n");
+    printf("  -d  seconds to run, 0 forever (default 10)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    static run_t r;
+    double instrument_rate = 40, period = 10, rate = -1;
+    int targets = 0;
+    const char *local = NULL;
+    bool have_sink = false;
+    r.duration = 10;
+
+    int c;
+    while((c = getopt(argc, argv, "t:u:pL:i:a:P:r:d:h")) != -1) {
+        switch(c) {
+        case 't': r.sink.transport = TCP; have_sink = parse_addr(optarg, r.sink.addr); break;
+        case 'u': r.sink.transport = UDP; have_sink = parse_addr(optarg, r.sink.addr); break;
+        case 'p': r.sink.transport = PTY; have_sink = true; break;
+        case 'L':
+            local = optarg;
+            have_sink = true;
+            if(!strcmp(optarg, "tcp")) r.sink.transport = TCP;
+            else if(!strcmp(optarg, "udp")) r.sink.transport = UDP;
+            else if(!strcmp(optarg, "pty")) r.sink.transport = PTY;
+            else have_sink = false;
+            break;
+        case 'i': instrument_rate = atof(optarg); break;
+        case 'a': targets = atoi(optarg); break;
+        case 'P': period = atof(optarg); break;
+        case 'r': rate = atof(optarg); break;
+        case 'd': r.duration = atof(optarg); break;
+        default: usage(); return 1;
+        }
+    }
+    if(!have_sink || optind != argc) {
+        usage();
+        return 1;
+    }
+
+    generator_init(r.g, instrument_rate, targets, period);
+    r.rate = rate >= 0 ? rate : instrument_rate + (period > 0 ? targets / period : 0);
+
+    if(local)
+        return run_local(r);
+
+    if(!sink_open(r.sink))
+        return 1;
+    if(r.sink.transport == PTY)
+        printf("writing to %s\n", r.sink.pty_name.c_str());
+    run_generator(&r);
+    return 0;
+}
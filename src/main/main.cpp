@@ -33,6 +33,7 @@
 #include "pypilot_client.h"
 #include "serial.h"
 #include "settings.h"
+#include "ais.h"
 #include "accel.h"
 #include "menu.h"
 #include "buzzer.h"
@@ -41,6 +42,7 @@
 #include "alarm.h"
 #include "history.h"
 #include "extio.h"
+#include "capture.h"
 
 extern "C" void app_main(void)
 {    
@@ -157,6 +159,8 @@ extern "C" void app_main(void)
         keys_poll();
         serial_poll();
         nmea_poll();
+        capture_poll();
+        ais_poll();
 
 //        signalk_poll();
         pypilot_client_poll();
@@ -12,16 +12,29 @@
 #include "draw.h"
 #include "settings.h"
 #include "display.h"
+#include "ais.h"
 #include "utils.h"
 #include "menu.h"
 #include "buzzer.h"
 
 bool in_menu;
 
-static bool selectFont(int &wt, int &ht, std::string str) {
+static bool selectFont(int &wt, int &ht, std::string str, font_fit &fit) {
     // based on width and height determine best font
     if(ht > 40) ht = 40;
 
+    // the same shape of text in the same box fits the same font
+    if(fit.same_shape(str) && wt == fit.w && ht == fit.from) {
+        wt = fit.wt;
+        ht = fit.ht;
+        if(fit.found)
+            draw_set_font(ht);
+        return fit.found;
+    }
+    fit.w = wt;
+    fit.from = ht;
+    fit.found = false;
+
     int height = ht;
     for(;;) {
         if(!draw_set_font(ht))
@@ -30,11 +43,14 @@ static bool selectFont(int &wt, int &ht, std::string str) {
         int width = draw_text_width(str);
         if(width < wt && ht < height) {
             wt = width;
-            return true;
+            fit.found = true;
+            break;
         }
         ht--;
     }
-    return false;
+    fit.ht = ht;
+    fit.wt = wt;
+    return fit.found;
 }
 
 struct menu_label : public display {
@@ -46,7 +62,7 @@ struct menu_label : public display {
     void render() {
         ht = h;  // it will never get bigger
         int wt = w;
-        if(!selectFont(wt, ht, label))
+        if(!selectFont(wt, ht, label, fitted))
             return;
 
         // center text
@@ -57,6 +73,7 @@ struct menu_label : public display {
 
     int ht;
     std::string label;
+    font_fit fitted;
 };
 
 struct menu_item : public menu_label
@@ -161,7 +178,7 @@ struct menu_item_setting : public menu_item
     void render() {
         // try to fit text along side label
         int wt = w - h, ht = h;
-        if(!selectFont(wt, ht, label.c_str()))
+        if(!selectFont(wt, ht, label.c_str(), fitted))
             return;
 
         // center text
@@ -238,7 +255,7 @@ struct menu_item_int : public menu_item
         std::string l = s + " " + label;
 
         int wt = w - h, ht = h;
-        if(!selectFont(wt, ht, l.c_str()))
+        if(!selectFont(wt, ht, l.c_str(), fitted))
             return;
 
         // align text
@@ -281,7 +298,7 @@ struct alarm_display : public grid_display
         case WATER_SPEED_ALARM: item = WATER_SPEED; break;
         case WEATHER_ALARM: item = BAROMETRIC_PRESSURE; break;
         case DEPTH_ALARM: item = DEPTH;             break;
-        case AIS_ALARM:   c = alarm_ship_tcpa;      break;
+        case AIS_ALARM:   c = ais_soonest_tcpa();   break;
         case PYPILOT_ALARM:    c = NAN;             break;
         default: c=0; break;
         }
@@ -6,23 +6,53 @@
  * version 3 of the License, or (at your option) any later version.
  */
 
-#include <esp_wifi_types_generic.h>
-
 #include <math.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#ifdef __linux__
+// allow building on the host for testnmea and replay
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+
+#define ESP_LOGI(tag, fmt, ...) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) printf("E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define inet_ntoa_r(addr, buf, len) strncpy(buf, inet_ntoa(addr), len)
+
+uint64_t esp_timer_get_time(); // supplied by the host program
+
+extern int signalk_discovered;
+extern int pypilot_discovered;
+#else
+#include <esp_wifi_types_generic.h>
 
 #include <esp_log.h>
 #include <esp_timer.h>
+#include <esp_netif.h>
 #include <lwip/sockets.h>
-#include <errno.h>
+
+#include "zeroconf.h"
+#endif
 
 #include "settings.h"
 #include "display.h"
 #include "nmea.h"
-#include "zeroconf.h"
 #include "ais.h"
 #include "history.h"
 #include "serial.h"
 #include "wireless.h"
+#include "capture.h"
+#include "nmea_output.h"
 
 #define TAG "nmea"
 
@@ -38,326 +68,579 @@ static uint8_t checksum(const char *buf, int len=-1)
     return cksum;
 }
 
-float convert_decimal_ll(float decll)
-{
-    float degrees;
-    float minutes = modff(decll/100, &degrees)*100;
-    return degrees + minutes / 60;
-}
+nmea_stats_t nmea_source_stats[DATA_SOURCE_COUNT];
 
-#ifdef CONFIG_IDF_TARGET_ESP32S3
-static bool prefix(const char *line, const char *prefix)
-{
-    return line[3] == prefix[0] && line[4] == prefix[1] && line[5] == prefix[2];
-}
+#if defined(CONFIG_IDF_TARGET_ESP32S3) || defined(__linux__)
+#define NMEA_MAX_LENGTH 180
+#define NMEA_MAX_FIELDS 40
+
+// offsets of each comma separated field in a sentence
+// field 0 is the address (eg: GPRMC), pos[count] is one past the '*'
+struct nmea_fields {
+    const char *line;
+    int count;
+    uint8_t pos[NMEA_MAX_FIELDS+1];
 
-static const char *comma(const char *start, int count)
+    const char *str(int i) const { return line + pos[i]; }
+    int len(int i) const { return i < count ? pos[i+1] - pos[i] - 1 : 0; }
+    char chr(int i) const { return len(i) ? line[pos[i]] : 0; }
+};
+
+static int hex_digit(char c)
 {
-    while(count) {
-        start++;
-        if(*start == ',')
-            count--;
-        if(!*start)
-            return 0;
-    }
-    return start;
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
 }
 
-bool nmea_parse_line(const char *line, data_source_e source)
+// split the sentence into fields and verify the checksum in one pass
+static bool nmea_tokenize(const char *line, int len, nmea_fields &f)
 {
-    //printf("nmea parse line %d %s\n", source, line);
-    // check checksum
-    int len=strlen(line);
-    if(len < 10 || len > 180)
-        return false;
-
     // ensure line starts with $ or !
     if(line[0] != '$' && line[0] != '!')
         return false;
 
-    // find the '*' that separates data from checksum
-    int indstar=len-1;
-    while(line[indstar]!='*')
-        if(--indstar == 0)
+    f.line = line;
+    f.count = 1;
+    f.pos[0] = 1;
+
+    uint8_t cksum = 0;
+    int i = 1;
+    for(;;) {
+        if(i >= len)
+            return false;
+        char c = line[i];
+        if(c == '*')
+            break;
+        if(c == '\r' || c == '\n' || i >= NMEA_MAX_LENGTH - 3)
             return false;
+        if(c == ',') {
+            if(f.count == NMEA_MAX_FIELDS)
+                return false;
+            f.pos[f.count++] = i + 1;
+        }
+        cksum ^= c;
+        i++;
+    }
+    f.pos[f.count] = i + 1;
 
-    int cksum = strtol(line+indstar+1, 0, 16);
-    if(cksum != checksum(line+1, indstar-1))
+    // need at least a 5 character address and one field
+    if(f.pos[1] != 7)
         return false;
 
-    if(line[0] == '!') // probably AIS
-        return ais_parse_line(line, source);
+    if(i + 2 >= len)
+        return false;
+    int hi = hex_digit(line[i+1]), lo = hex_digit(line[i+2]);
+    if(hi < 0 || lo < 0)
+        return false;
+    return cksum == ((hi << 4) | lo);
+}
 
-    const char *c1 = line+6;
-    if(prefix(line, "MWV")) {
-        float dir, spd;
-        char ref;
-        if(sscanf(c1, ",%f,%c,%f,N", &dir, &ref, &spd) != 3)
-            return false;
+// parse a decimal number without sscanf or locale
+// keeps up to 9 significant digits, further fractional digits are dropped
+static bool parse_fixed(const char *s, int len, int32_t &mantissa, int &decimals)
+{
+    bool negative = false;
+    if(len && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++, len--;
+    }
 
-        if(ref == 'R') {
-            display_data_update(WIND_ANGLE, dir, source);
-            display_data_update(WIND_SPEED, spd, source);
-            return true;
-        } if(ref != 'T') {
-            display_data_update(TRUE_WIND_ANGLE, dir, source);
-            display_data_update(TRUE_WIND_SPEED, spd, source);
-            return true;
+    uint32_t m = 0;
+    int digits = 0, d = -1;
+    for(; len; s++, len--) {
+        if(*s == '.') {
+            if(d >= 0)
+                return false;
+            d = 0;
+            continue;
         }
+        unsigned v = *s - '0';
+        if(v > 9)
+            return false;
+        if(digits == 9) {
+            if(d < 0)
+                return false; // integer part too large
+            continue;
+        }
+        m = m*10 + v;
+        digits++;
+        if(d >= 0)
+            d++;
+    }
+
+    if(!digits)
         return false;
+
+    mantissa = negative ? -(int32_t)m : m;
+    decimals = d < 0 ? 0 : d;
+    return true;
+}
+
+static const float pow10_table[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f};
+
+static bool nmea_float(const nmea_fields &f, int i, float &value)
+{
+    int32_t m;
+    int d;
+    if(!parse_fixed(f.str(i), f.len(i), m, d))
+        return false;
+    value = m / pow10_table[d];
+    return true;
+}
+
+static bool nmea_uint(const nmea_fields &f, int i, uint32_t &value)
+{
+    int32_t m;
+    int d;
+    if(!parse_fixed(f.str(i), f.len(i), m, d) || d || m < 0)
+        return false;
+    value = m;
+    return true;
+}
+
+// float value followed by a unit field which must match
+static bool nmea_float_unit(const nmea_fields &f, int i, char unit, float &value)
+{
+    return f.chr(i+1) == unit && nmea_float(f, i, value);
+}
+
+// convert [d]ddmm.mmmm and hemisphere (field i+1) to signed degrees
+// the minutes are split off in fixed point to avoid losing precision
+static bool nmea_latlon(const nmea_fields &f, int i, float &value)
+{
+    int32_t m;
+    int d;
+    if(!parse_fixed(f.str(i), f.len(i), m, d) || m < 0 || d > 7)
+        return false; // 100*scale would overflow
+
+    int32_t scale = pow10_table[d];
+    int32_t degrees = m / (100*scale);
+    int32_t minutes = m - degrees*100*scale;
+    value = degrees + minutes / (60.0f*scale);
+
+    switch(f.chr(i+1)) {
+    case 'N': case 'E': return true;
+    case 'S': case 'W': value = -value; return true;
     }
+    return false;
+}
 
-    if(prefix(line, "MWD")) {
-        float dir, spd;
-        char ref;
-        if(sscanf(c1, ",%f,%c,", &dir, &ref) != 3)
+// hhmmss[.ss]
+static bool nmea_time(const nmea_fields &f, int i, int &hour, int &minute, float &second)
+{
+    const char *s = f.str(i);
+    int len = f.len(i);
+    if(len < 6)
+        return false;
+    for(int j=0; j<4; j++)
+        if(s[j] < '0' || s[j] > '9')
             return false;
+    hour = (s[0]-'0')*10 + s[1]-'0';
+    minute = (s[2]-'0')*10 + s[3]-'0';
 
-        const char *c5 = comma(c1, 4);
-        if(!c5) return false;
-        if(sscanf(c5, ",%f,N", &spd) != 1)
-            return false;
-        
+    int32_t m;
+    int d;
+    if(!parse_fixed(s+4, len-4, m, d))
+        return false;
+    second = m / pow10_table[d];
+    return true;
+}
+
+// copy a text field into a std::string
+static void nmea_string(const nmea_fields &f, int i, std::string &str)
+{
+    str.assign(f.str(i), f.len(i));
+}
+
+static bool nmea_mwv(const nmea_fields &f, data_source_e source)
+{
+    // MWV,angle,R/T,speed,N,A
+    float dir, spd;
+    if(!nmea_float(f, 1, dir) || !nmea_float_unit(f, 3, 'N', spd))
+        return false;
+
+    char ref = f.chr(2);
+    if(ref == 'R') {
+        display_data_update(WIND_ANGLE, dir, source);
+        display_data_update(WIND_SPEED, spd, source);
+        return true;
+    } if(ref == 'T') {
         display_data_update(TRUE_WIND_ANGLE, dir, source);
         display_data_update(TRUE_WIND_SPEED, spd, source);
         return true;
     }
+    return false;
+}
 
-    if(prefix(line, "VWR") || prefix(line, "VWT")) {
-        float dir, spd;
-        char ref;
-        if(sscanf(c1, ",%f,%c,", &dir, &ref) != 3)
-            return false;
-
-        if(ref == 'L')
-            dir = -dir;
-        else if(ref != 'R')
-            return false;
+static bool nmea_mwd(const nmea_fields &f, data_source_e source)
+{
+    // MWD,dir,T,dir,M,knots,N,m/s,M
+    float dir, spd;
+    if(!nmea_float_unit(f, 1, 'T', dir) || !nmea_float_unit(f, 5, 'N', spd))
+        return false;
 
-        const char *c5 = comma(c1, 4);
-        if(!c5) return false;
-        if(sscanf(c5, ",%f,N", &spd) != 1)
-            return false;
+    display_data_update(TRUE_WIND_ANGLE, dir, source);
+    display_data_update(TRUE_WIND_SPEED, spd, source);
+    return true;
+}
 
-        if(line[5] == 'T') {
-            display_data_update(WIND_ANGLE, dir, source);
-            display_data_update(WIND_SPEED, spd, source);
-        } else {
-            display_data_update(TRUE_WIND_ANGLE, dir, source);
-            display_data_update(TRUE_WIND_SPEED, spd, source);
-        }
-        return true;
-    }
-    
-    if(prefix(line, "MDA")) {
-        float pressure, temperature;
-        const char *c3 = comma(c1, 2); // skip ahead 2 commas
-        if(!c3) return false;
+static bool nmea_vwr(const nmea_fields &f, data_source_e source)
+{
+    // VWR,angle,L/R,knots,N,m/s,M,km/h,K  (VWT is the same for true wind)
+    float dir, spd;
+    if(!nmea_float(f, 1, dir) || !nmea_float_unit(f, 3, 'N', spd))
+        return false;
 
-        char unit;
-        if(sscanf(c3, ",%f,%c", &pressure, &unit) != 2 || unit != 'B')
-            return false;
-        display_data_update(BAROMETRIC_PRESSURE, pressure, source);
+    char ref = f.chr(2);
+    if(ref == 'L')
+        dir = -dir;
+    else if(ref != 'R')
+        return false;
 
-        const char *c5 = comma(c3, 2);
-        if(!c5) return false;
-        if(sscanf(c5, ",%f,%c", &temperature, &unit) != 2 || unit != 'C')
-            return false;
-        display_data_update(AIR_TEMPERATURE, temperature, source);
+    if(f.line[5] == 'R') {
+        display_data_update(WIND_ANGLE, dir, source);
+        display_data_update(WIND_SPEED, spd, source);
+    } else {
+        display_data_update(TRUE_WIND_ANGLE, dir, source);
+        display_data_update(TRUE_WIND_SPEED, spd, source);
+    }
+    return true;
+}
 
-        const char *c7 = comma(c5, 2);
-        if(!c5) return false;
-        if(sscanf(c7, ",%f,%c", &temperature, &unit) != 2 || unit != 'C')
-            return false;
-        display_data_update(WATER_TEMPERATURE, temperature, source);
-    } else
+static bool nmea_mda(const nmea_fields &f, data_source_e source)
+{
+    // MDA,inHg,I,bar,B,air,C,water,C,...
+    float value;
+    bool any = false;
+    if(nmea_float_unit(f, 3, 'B', value)) {
+        display_data_update(BAROMETRIC_PRESSURE, value, source);
+        any = true;
+    }
+    if(nmea_float_unit(f, 5, 'C', value)) {
+        display_data_update(AIR_TEMPERATURE, value, source);
+        any = true;
+    }
+    if(nmea_float_unit(f, 7, 'C', value)) {
+        display_data_update(WATER_TEMPERATURE, value, source);
+        any = true;
+    }
+    return any;
+}
 
-    if(prefix(line, "MTA")) {
-        float air_temp;
-        char unit;
-        if(sscanf(c1, ",%f,%c", &air_temp, &unit) != 2)
-            return false;
-        if(unit == 'F')
-            air_temp = (air_temp-32)*.555f;
-        else if(unit != 'C')
-            return false;
-        display_data_update(AIR_TEMPERATURE, air_temp, source);
-    } else
+static bool nmea_mta(const nmea_fields &f, data_source_e source)
+{
+    float air_temp;
+    if(!nmea_float(f, 1, air_temp))
+        return false;
+    char unit = f.chr(2);
+    if(unit == 'F')
+        air_temp = (air_temp-32)*.555f;
+    else if(unit != 'C')
+        return false;
+    display_data_update(AIR_TEMPERATURE, air_temp, source);
+    return true;
+}
 
-    if(prefix(line, "RMB")) {
-        float xte;
-        char xte_dir;
-        char from_wpt[16], to_wpt[16];
-        float wpt_lat, wpt_lon;
-        char wpt_lat_sign, wpt_lon_sign;
-        float rng, brg, vel;
-        char status;
-        int ret = sscanf(c1, ",A,%f,%c,%s,%s,%f,%c,%f,%c,%f,%f,%f,%c,A,",
-                         &xte, &xte_dir, from_wpt, to_wpt,
-                         &wpt_lat, &wpt_lat_sign, &wpt_lon, &wpt_lon_sign, &rng, &brg, &vel, &status);
-        if(ret >= 2) {
-            if(xte_dir == 'L')
-                xte = -xte;
-            route_info.xte = xte;
-        }
-            
-        if(ret >= 4) {
-            route_info.from_wpt = from_wpt;
-            route_info.to_wpt = to_wpt;
-        }
+static bool nmea_rmb(const nmea_fields &f, data_source_e source)
+{
+    // RMB,A,xte,L/R,from,to,lat,N/S,lon,E/W,range,bearing,vel,arrived
+    float xte;
+    if(nmea_float(f, 2, xte)) {
+        if(f.chr(3) == 'L')
+            xte = -xte;
+        route_info.xte = xte;
+    }
 
-        if(ret >= 8) {
-            if(wpt_lat_sign == 'S')
-                wpt_lat = -wpt_lat;
-            if(wpt_lon_sign == 'W')
-                wpt_lon = -wpt_lon;
-            route_info.wpt_lat = wpt_lat;
-            route_info.wpt_lon = wpt_lon;
-        }
-        display_data_update(ROUTE_INFO, 0, source);
-    } else
+    if(f.count > 5) {
+        nmea_string(f, 4, route_info.from_wpt);
+        nmea_string(f, 5, route_info.to_wpt);
+    }
 
-    if(prefix(line, "RMC")) {
-        int hour, minute;
-        float second;
-        float latitude, longitude;
-        char status, lat_sign, lon_sign;
-        float speed, track;
-        uint32_t date;
-        int ret1 = sscanf(c1, ",%02d%02d%f,%c", &hour, &minute, &second, &status);
-
-        if(ret1 == 4)
-            display_data_update(TIME, (hour*60+minute)*60+second, source);
-        const char *c3 = comma(c1, 2);
-        int ret2 = sscanf(c3, ",%f,%c,%f,%c",
-                          &latitude, &lat_sign, &longitude, &lon_sign);
-        if(ret2 == 4) {
-            if(lat_sign == 'S')
-                latitude = -latitude;
-            else if(lat_sign != 'N')
-                return false;
-            display_data_update(LATITUDE, convert_decimal_ll(latitude), source);
+    float wpt_lat, wpt_lon;
+    if(nmea_latlon(f, 6, wpt_lat) && nmea_latlon(f, 8, wpt_lon)) {
+        route_info.wpt_lat = wpt_lat;
+        route_info.wpt_lon = wpt_lon;
+    }
+    display_data_update(ROUTE_INFO, 0, source);
+    return true;
+}
 
-            if(lon_sign == 'W')
-                longitude = -longitude;
-            else if(lon_sign != 'E')
-                return false;
-            display_data_update(LONGITUDE, convert_decimal_ll(longitude), source);
-        }
+static bool nmea_rmc(const nmea_fields &f, data_source_e source)
+{
+    // RMC,hhmmss.ss,A,lat,N/S,lon,E/W,sog,track,ddmmyy,...
+    int hour, minute;
+    float second;
+    bool have_time = nmea_time(f, 1, hour, minute, second);
+    if(have_time)
+        display_data_update(TIME, (hour*60+minute)*60+second, source);
+
+    float latitude, longitude;
+    if(nmea_latlon(f, 3, latitude) && nmea_latlon(f, 5, longitude)) {
+        display_data_update(LATITUDE, latitude, source);
+        display_data_update(LONGITUDE, longitude, source);
+    }
 
-        const char *c7 = comma(c3, 4);
-        if(sscanf(c7, ",%f", &speed) == 1)
-            display_data_update(GPS_SPEED, speed, source);
+    float speed, track;
+    if(nmea_float(f, 7, speed))
+        display_data_update(GPS_SPEED, speed, source);
 
-        const char *c8 = comma(c7, 1);
-        if(sscanf(c8, ",%f", &track) == 1)
-            display_data_update(GPS_HEADING, track, source);
+    if(nmea_float(f, 8, track))
+        display_data_update(GPS_HEADING, track, source);
 
-        const char *c9 = comma(c8, 1);
-        if(sscanf(c9, ",%lu", &date) == 1)
-            // we have a time fix
-            history_set_time(date, hour, minute, second);
-    } else
+    uint32_t date;
+    if(have_time && nmea_uint(f, 9, date))
+        // we have a time fix
+        history_set_time(date, hour, minute, second);
+    return true;
+}
 
-    if(prefix(line, "VHW")) {
-        const char *c5 = comma(c1, 4);
-        if(!c5) return false;
-        float speed;
-        char unit;
-        if(sscanf(c5, ",%f,%c", &speed, &unit) != 2 || unit != 'N')
-            return false;
-        display_data_update(WATER_SPEED, speed, source);
-    } else
+static bool nmea_vhw(const nmea_fields &f, data_source_e source)
+{
+    // VHW,true,T,mag,M,knots,N,kph,K
+    float speed;
+    if(!nmea_float_unit(f, 5, 'N', speed))
+        return false;
+    display_data_update(WATER_SPEED, speed, source);
+    return true;
+}
 
-    if(prefix(line, "HDM")) {
-        float heading;
-        char unit;
-        if(sscanf(c1, ",%f,%c", &heading, &unit) != 2 || unit != 'M')
-            return false;
+static bool nmea_hdm(const nmea_fields &f, data_source_e source)
+{
+    float heading;
+    if(!nmea_float_unit(f, 1, 'M', heading))
+        return false;
 
-        display_data_update(COMPASS_HEADING, heading, source);
-    } else
+    display_data_update(COMPASS_HEADING, heading, source);
+    return true;
+}
 
-    if(prefix(line, "XDR")) {
+static bool nmea_xdr(const nmea_fields &f, data_source_e source)
+{
+    // XDR,A,value,D,name repeated for each transducer
+    bool any = false;
+    for(int i=1; i+3 < f.count; i+=4) {
         float value;
-        const char *c4 = comma(c1, 3);
-        char unit;
-        if(!c4) return false;
-        if(sscanf(c1, ",A,%f,%c", &value, &unit) != 2)
-            return false;
-        if(strncmp(c4, ",ROLL", 5) == 0)
+        if(f.chr(i) != 'A' || !nmea_float(f, i+1, value))
+            continue;
+        const char *name = f.str(i+3);
+        if(f.len(i+3) == 4 && !strncmp(name, "ROLL", 4))
             display_data_update(HEEL, value, source);
-        else if(strncmp(c4, ",PTCH", 5) == 0)
+        else if(f.len(i+3) == 4 && !strncmp(name, "PTCH", 4))
             display_data_update(PITCH, value, source);
-    } else
+        else
+            continue;
+        any = true;
+    }
+    return any;
+}
 
-    if(prefix(line, "ROT")) {
-        float rate;
-        char unit;
-        if(sscanf(c1, ",%f,%c", &rate, &unit) != 2 || unit != 'A')
-            return false;
+static bool nmea_rot(const nmea_fields &f, data_source_e source)
+{
+    float rate;
+    if(!nmea_float_unit(f, 1, 'A', rate))
+        return false;
 
-        display_data_update(RATE_OF_TURN, rate, source);
-    } else
+    display_data_update(RATE_OF_TURN, rate, source);
+    return true;
+}
 
-    if(prefix(line, "RSA")) {
-        float angle;
-        char unit;
-        if(sscanf(c1, ",%f,%c", &angle, &unit) != 2 || unit != 'A')
-            return false;
+static bool nmea_rsa(const nmea_fields &f, data_source_e source)
+{
+    float angle;
+    if(!nmea_float_unit(f, 1, 'A', angle))
+        return false;
 
-        display_data_update(RUDDER_ANGLE, angle, source);
-    } else
+    display_data_update(RUDDER_ANGLE, angle, source);
+    return true;
+}
 
-    if(prefix(line, "APB")) {
-        const char *c3 = comma(c1, 2);
-        float xte;
-        char dir;
-        if(sscanf(c3, ",%f,%c,", &xte, &dir) != 2)
-            return false;
-        if(dir == 'L')
-            xte = -xte;
-        else if(dir != 'R')
-            return false;
+static bool nmea_apb(const nmea_fields &f, data_source_e source)
+{
+    // APB,A,A,xte,L/R,N,A,A,brg,M/T,wpt,brg,M/T,steer,M/T
+    float xte;
+    if(!nmea_float(f, 3, xte))
+        return false;
+    char dir = f.chr(4);
+    if(dir == 'L')
+        xte = -xte;
+    else if(dir != 'R')
+        return false;
 
-        route_info.xte = xte;
+    route_info.xte = xte;
 
-        const char *c8 = comma(c3, 5);
-        float bearing_origin_destination;
-        char unit;
-        if(sscanf(c8, ",%f,%c,", &bearing_origin_destination, &unit) != 2)
-            return false;
+    float bearing_origin_destination;
+    if(!nmea_float(f, 8, bearing_origin_destination))
+        return false;
 
-        const char *c10 = comma(c8, 9);
-        const char *c11 = comma(c10, 1);
-        char wptid[32];
-        int wptlen = c11-c10-2;
-        if(wptlen > sizeof wptid - 1)
-            wptlen = sizeof wptid - 1;
-        memcpy(wptid, c10+1, wptlen);
-        wptid[wptlen] = '\0';
-
-        float bearing_position_destination;
-        char unit_pres;
-        if(sscanf(c11, ",%f,%c,", &bearing_position_destination, &unit_pres) != 2 || unit_pres != 'T')
-            return false;
+    float bearing_position_destination;
+    if(!nmea_float_unit(f, 11, 'T', bearing_position_destination))
+        return false;
 
-        const char *c13 = comma(c10, 1);
-        float heading_to_steer_destination;
-        char unit_hdg;
-        if(sscanf(c13, ",%f,%c,", &heading_to_steer_destination, &unit_hdg) != 2 || unit_hdg != 'T')
-            return false;
+    float heading_to_steer_destination;
+    if(!nmea_float_unit(f, 13, 'T', heading_to_steer_destination))
+        return false;
+
+    route_info.target_bearing = heading_to_steer_destination;
+    return true;
+}
 
-        route_info.target_bearing = heading_to_steer_destination;
+static bool nmea_vdm(const nmea_fields &f, data_source_e source)
+{
+    return ais_parse_line(f.line, source);
+}
 
+typedef bool (*nmea_handler_t)(const nmea_fields &f, data_source_e source);
 
-    } else
+struct nmea_sentence_t {
+    const char *name;
+    nmea_handler_t handler;
+};
+
+// to decode another sentence add its handler here
+static constexpr nmea_sentence_t nmea_sentences[] = {
+    {"MWV", nmea_mwv},
+    {"MWD", nmea_mwd},
+    {"VWR", nmea_vwr},
+    {"VWT", nmea_vwr},
+    {"MDA", nmea_mda},
+    {"MTA", nmea_mta},
+    {"RMB", nmea_rmb},
+    {"RMC", nmea_rmc},
+    {"VHW", nmea_vhw},
+    {"HDM", nmea_hdm},
+    {"XDR", nmea_xdr},
+    {"ROT", nmea_rot},
+    {"RSA", nmea_rsa},
+    {"APB", nmea_apb},
+    {"VDM", nmea_vdm},
+};
+
+#define NMEA_SENTENCE_COUNT ((sizeof nmea_sentences) / (sizeof *nmea_sentences))
+#define NMEA_HASH_BITS 6
+#define NMEA_HASH_MULT 1785 // chosen so common sentences do not collide
+
+// hash the 3 letter formatter into a small table index
+static constexpr int nmea_hash(char a, char b, char c)
+{
+    uint32_t key = ((a&31)<<10) | ((b&31)<<5) | (c&31);
+    return ((key * NMEA_HASH_MULT) & 0xffff) >> (16 - NMEA_HASH_BITS);
+}
+
+struct nmea_dispatch_t {
+    int8_t index[1<<NMEA_HASH_BITS];
+};
+
+static constexpr nmea_dispatch_t nmea_build_dispatch()
+{
+    nmea_dispatch_t d{};
+    for(int i=0; i<(1<<NMEA_HASH_BITS); i++)
+        d.index[i] = -1;
+    for(unsigned i=0; i<NMEA_SENTENCE_COUNT; i++) {
+        const char *name = nmea_sentences[i].name;
+        int h = nmea_hash(name[0], name[1], name[2]);
+        if(d.index[h] >= 0)
+            throw "nmea sentence hash collision, change NMEA_HASH_MULT";
+        d.index[h] = i;
+    }
+    return d;
+}
+
+static constexpr nmea_dispatch_t nmea_dispatch = nmea_build_dispatch();
+
+static nmea_stats_t nmea_type_stats[NMEA_SENTENCE_COUNT];
+
+// find the handler for a line from its formatter, -1 if not decoded
+static int nmea_lookup(const char *line, int len)
+{
+    if(len < 6)
+        return -1;
+
+    int i = nmea_dispatch.index[nmea_hash(line[3], line[4], line[5])];
+    if(i < 0)
+        return -1;
+
+    const char *name = nmea_sentences[i].name;
+    if(line[3] != name[0] || line[4] != name[1] || line[5] != name[2])
+        return -1;
+    return i;
+}
+
+// line is len characters, and must also be null terminated for ais
+bool nmea_parse_line(const char *line, int len, data_source_e source)
+{
+    //printf("nmea parse line %d %s\n", source, line);
+    capture_nmea(line, len, source);
+
+    nmea_stats_t &stats = nmea_source_stats[source];
+    stats.bytes += len;
+    stats.sentences++;
+
+    // reject sentences we do not decode before looking at the fields
+    int i = nmea_lookup(line, len);
+    if(i < 0) {
+        stats.unknown++;
         return false;
+    }
+
+    // a failed checksum says nothing reliable about the type, so it only counts against the source
+    nmea_fields f;
+    if(!nmea_tokenize(line, len, f)) {
+        stats.bad++;
+        return false;
+    }
+
+    nmea_stats_t &type_stats = nmea_type_stats[i];
+    type_stats.bytes += len;
+    type_stats.sentences++;
 
+    if(!nmea_sentences[i].handler(f, source)) {
+        stats.parse_failed++;
+        type_stats.parse_failed++;
+        return false;
+    }
     return true;
 }
+
+bool nmea_parse_line(const char *line, data_source_e source)
+{
+    return nmea_parse_line(line, strnlen(line, NMEA_MAX_LENGTH), source);
+}
+
+const char *nmea_sentence_stats(int i, nmea_stats_t &stats)
+{
+    if(i < 0 || i >= (int)NMEA_SENTENCE_COUNT)
+        return NULL;
+    stats = nmea_type_stats[i];
+    return nmea_sentences[i].name;
+}
+
+static void print_sentence_stats()
+{
+    printf("%-8s %10s %9s %7s %7s %7s %9s %9s\n", "Source", "Bytes", "Sentences",
+           "Bad", "Unknown", "Failed", "Accepted", "Rejected");
+    for(int i=0; i<DATA_SOURCE_COUNT; i++) {
+        const nmea_stats_t &s = nmea_source_stats[i];
+        if(s.sentences || s.accepted || s.rejected)
+            printf("%-8s %10" PRIu32 " %9" PRIu32 " %7" PRIu32 " %7" PRIu32 " %7" PRIu32 " %9" PRIu32 " %9" PRIu32 "\n",
+                   source_name[i], s.bytes, s.sentences, s.bad, s.unknown, s.parse_failed, s.accepted, s.rejected);
+    }
+
+    printf("\n%-8s %10s %9s %7s\n", "Sentence", "Bytes", "Sentences", "Failed");
+    for(unsigned i=0; i<NMEA_SENTENCE_COUNT; i++) {
+        const nmea_stats_t &s = nmea_type_stats[i];
+        if(s.sentences)
+            printf("%-8s %10" PRIu32 " %9" PRIu32 " %7" PRIu32 "\n",
+                   nmea_sentences[i].name, s.bytes, s.sentences, s.parse_failed);
+    }
+}
 #endif
 
+#define NMEA_CLIENT_BUFFER 512
+#define NMEA_CLIENT_OUTPUT 1024
+#define NMEA_CLIENT_QUEUE 32
+
 struct ClientSock
 {
     ClientSock() : sock(0) {}
@@ -368,11 +651,32 @@ struct ClientSock
         ESP_LOGI(TAG, "nmea close client");
         ::close(sock);
         sock = 0;
-        data = "";
+        head = tail = 0;
+        discard = false;
+        out_len = sent = 0;
+        queued = fresh = 0;
+        connecting = false;
     }
     int sock;
-    uint32_t time;
-    std::string data;
+    uint64_t time;
+    bool connecting = false; // waiting for a non blocking connect to finish
+
+    // received data not yet framed into lines is buf[tail] to buf[head]
+    char buf[NMEA_CLIENT_BUFFER];
+    uint16_t head = 0, tail = 0;
+    bool discard = false; // skipping the rest of a sentence too long to buffer
+
+    uint32_t bytes_copied = 0, sentences_dropped = 0;
+
+    // sentences waiting to be sent, oldest first, sent together by flush_client
+    // the first sent bytes have already gone, and queue[] is each sentence length
+    char out[NMEA_CLIENT_OUTPUT];
+    uint16_t out_len = 0, sent = 0;
+    uint16_t queue[NMEA_CLIENT_QUEUE];
+    uint8_t queued = 0, fresh = 0; // sentences from fresh on were written this tick
+    uint8_t max_queued = 0;
+    uint64_t send_time = 0;
+    uint32_t sends = 0, send_dropped = 0;
 
     std::string addr;
     int port;
@@ -384,6 +688,20 @@ static ClientSock nmea_pypilot_client;
 static ClientSock nmea_signalk_client;
 static ClientSock clients[5];
 
+// each wifi sink schedules its own output to limit its rate
+static void write_server_output(const char *buf, int len);
+static void write_pypilot_output(const char *buf, int len);
+static void write_signalk_output(const char *buf, int len);
+static void write_client_output(const char *buf, int len);
+static void write_udp_output(const char *buf, int len);
+static nmea_output_t server_output("server", write_server_output);
+static nmea_output_t pypilot_output("pypilot", write_pypilot_output);
+static nmea_output_t signalk_output("signalk", write_signalk_output);
+static nmea_output_t client_output("client", write_client_output);
+static nmea_output_t udp_output("udp", write_udp_output);
+static nmea_output_t *wifi_outputs[] = {&server_output, &pypilot_output, &signalk_output,
+                                        &client_output, &udp_output};
+
 static void close_server() {
     if(!server_sock)
         return;
@@ -433,11 +751,13 @@ static void connect_client(ClientSock &client, std::string addr, int port)
         ESP_LOGE(TAG, "Socket unable to connect: errno %d\n", errno);
         client.close();
     }
+    // nmea_poll finishes the connection once the socket is writable
+    client.connecting = err != 0;
 
-    ESP_LOGI(TAG, "nmea client connected to %s:%d %d %d", addr.c_str(), port, err, errno);
+    ESP_LOGI(TAG, "nmea client connecting to %s:%d %d %d", addr.c_str(), port, err, errno);
     client.addr = addr;
     client.port = port;
-    client.time = t0;
+    client.time = client.send_time = t0;
 }
 
 static void connect_server()
@@ -490,13 +810,65 @@ static void connect_server()
     ESP_LOGI(TAG, "nmea server setup %d", server_sock);
 }
 
+#if defined(CONFIG_IDF_TARGET_ESP32S3) || defined(__linux__)
+// parse each complete line received since from in place
+static void frame_client(ClientSock &c, int from)
+{
+    for(int i=from; i<c.head; i++) {
+        char ch = c.buf[i];
+        if(ch == '\r' || ch == '\n') {
+            if(c.discard)
+                c.discard = false;
+            else if(i > c.tail) {
+                c.buf[i] = '\0';
+                nmea_parse_line(c.buf + c.tail, i - c.tail, WIFI_DATA);
+            }
+            c.tail = i + 1;
+        } else if((ch == '$' || ch == '!') && i > c.tail) {
+            // a new sentence started before the last one ended
+            if(!c.discard && (c.buf[c.tail] == '$' || c.buf[c.tail] == '!'))
+                c.sentences_dropped++;
+            c.discard = false;
+            c.tail = i;
+        }
+    }
+
+    if(c.discard)
+        c.tail = c.head;
+    if(c.tail == c.head)
+        c.head = c.tail = 0;
+}
+
+// make room at the end of the buffer for recv
+static void wrap_client(ClientSock &c)
+{
+    if(c.head < NMEA_CLIENT_BUFFER)
+        return;
+
+    if(c.tail == 0) {
+        // the whole buffer is one sentence, drop it
+        c.sentences_dropped++;
+        c.discard = true;
+        c.head = 0;
+        return;
+    }
+
+    // move the unfinished sentence to the start
+    int len = c.head - c.tail;
+    memmove(c.buf, c.buf + c.tail, len);
+    c.bytes_copied += len;
+    c.head = len;
+    c.tail = 0;
+}
+#endif
+
 static bool poll_client(ClientSock &c, bool input)
 {
-#ifdef CONFIG_IDF_TARGET_ESP32S3
+#if defined(CONFIG_IDF_TARGET_ESP32S3) || defined(__linux__)
     // read any data from client
     while(c.sock) {
-        char buf[128];
-        int ret = recv(c.sock, buf, sizeof buf - 1, 0);
+        wrap_client(c);
+        int ret = recv(c.sock, c.buf + c.head, NMEA_CLIENT_BUFFER - c.head, 0);
         if(ret < 0) {
             if(errno != EAGAIN) {
                 ESP_LOGE(TAG, "client recv error %d %d", c.sock, errno);
@@ -508,27 +880,15 @@ static bool poll_client(ClientSock &c, bool input)
                 return false;
             } break;
         } else if(ret > 0) {
-            buf[ret] = '\0';
             if(input) {
-                if(c.data.length() > 4096) {
-                    ESP_LOGE(TAG, "client socket overflow!!!!!!!!");
-                    c.data = "";
-                }
-                c.data += std::string(buf);
+                int from = c.head;
+                c.head += ret;
+                frame_client(c, from);
             }
-        } else
-            break;
-        for(;;) {
-            int ind = c.data.find('$', 1);
-            if(ind < 0) {
-                ind = c.data.find('\n');
-                if(ind < 0)
-                    break;
-            } else
-                ind --;
-            std::string line = c.data.substr(0, ind);
-            nmea_parse_line(line.c_str(), WIFI_DATA);
-            c.data = c.data.substr(ind+1);
+        } else {
+            // the other end closed, free the slot and its queue
+            c.close();
+            return false;
         }
     }
 #endif
@@ -582,101 +942,533 @@ static void accept_server()
     ESP_LOGI(TAG, "nmea socket accepted %d %d ip address: %s", i, sock, addr_str);
 
     clients[i].sock = sock;
-    clients[i].time = esp_timer_get_time();
+    clients[i].time = clients[i].send_time = esp_timer_get_time();
 }
 
-static void poll_server()
+// a non blocking connect has finished once the socket is writable
+static bool finish_connect(ClientSock &c)
 {
-    if(!server_sock)
+    int err = 0;
+    socklen_t len = sizeof err;
+    getsockopt(c.sock, SOL_SOCKET, SO_ERROR, &err, &len);
+    if(err) {
+        ESP_LOGW(TAG, "nmea client connect to %s:%d failed %d", c.addr.c_str(), c.port, err);
+        c.close();
+        return false;
+    }
+
+    ESP_LOGI(TAG, "nmea client connected to %s:%d", c.addr.c_str(), c.port);
+    c.connecting = false;
+    c.send_time = esp_timer_get_time();
+    return true;
+}
+
+static void flush_client(ClientSock &c);
+
+// add the client to what select waits on
+static void watch_client(ClientSock &c, fd_set &rd, fd_set &wr, int &maxfd)
+{
+    if(!c.sock)
+        return;
+    c.fresh = c.queued; // anything written from now is for the next tick
+    FD_SET(c.sock, &rd);
+    if(c.connecting || c.out_len)
+        FD_SET(c.sock, &wr);
+    if(c.sock > maxfd)
+        maxfd = c.sock;
+}
+
+// read, write or finish connecting the client as select found it ready
+static bool service_client(ClientSock &c, bool input, fd_set &rd, fd_set &wr)
+{
+    if(!c.sock)
+        return true;
+
+    if(c.connecting) {
+        if(!FD_ISSET(c.sock, &wr))
+            return true;
+        if(!finish_connect(c))
+            return false;
+    }
+
+    if(FD_ISSET(c.sock, &rd) && !poll_client(c, input))
+        return false;
+    if(c.sock && FD_ISSET(c.sock, &wr))
+        flush_client(c);
+    return true;
+}
+
+#define NMEA_UDP_DATAGRAM 1400
+#define NMEA_UDP_ADDRESSES 4
+
+// one socket both sends and receives broadcast or multicast datagrams,
+// every sentence for a tick goes in one datagram however many listen
+static int udp_sock;
+static sockaddr_in udp_dest;
+static char udp_out[NMEA_UDP_DATAGRAM];
+static int udp_out_len;
+static uint32_t udp_datagrams, udp_echoes;
+
+// addresses of our interfaces to recognize our own datagrams coming back,
+// looked up again each second as dhcp may change them
+static in_addr_t udp_own[NMEA_UDP_ADDRESSES];
+static int udp_own_count;
+
+static void udp_own_addresses()
+{
+    static uint32_t lookup_time;
+    uint32_t t = esp_timer_get_time() / 1000;
+    if(lookup_time && t - lookup_time < 1000)
         return;
+    lookup_time = t;
 
-    accept_server();
-    for(int i=0; i<(sizeof clients) / (sizeof *clients); i++)
-        poll_client(clients[i], settings.input_nmea_tcp_server);
+    udp_own_count = 0;
+#ifdef __linux__
+    ifaddrs *addrs;
+    if(getifaddrs(&addrs))
+        return;
+    for(ifaddrs *a = addrs; a && udp_own_count < NMEA_UDP_ADDRESSES; a = a->ifa_next)
+        if(a->ifa_addr && a->ifa_addr->sa_family == AF_INET)
+            udp_own[udp_own_count++] = ((sockaddr_in *)a->ifa_addr)->sin_addr.s_addr;
+    freeifaddrs(addrs);
+#else
+    for(const char *key : {"WIFI_STA_DEF", "WIFI_AP_DEF"}) {
+        esp_netif_t *netif = esp_netif_get_handle_from_ifkey(key);
+        esp_netif_ip_info_t info;
+        if(netif && esp_netif_get_ip_info(netif, &info) == ESP_OK && info.ip.addr)
+            udp_own[udp_own_count++] = info.ip.addr;
+    }
+#endif
+}
+
+static void close_udp()
+{
+    if(!udp_sock)
+        return;
+    ESP_LOGI(TAG, "close nmea udp %d", udp_sock);
+    close(udp_sock);
+    udp_sock = 0;
+    udp_out_len = 0;
+}
+
+static void connect_udp()
+{
+    static std::string udp_addr;
+    static int udp_port;
+    if(settings.nmea_udp_addr != udp_addr || settings.nmea_udp_port != udp_port)
+        close_udp();
+
+    if(udp_sock)
+        return;
+
+    udp_addr = settings.nmea_udp_addr;
+    udp_port = settings.nmea_udp_port;
+
+    udp_dest = {};
+    udp_dest.sin_family = AF_INET;
+    udp_dest.sin_port = htons(udp_port);
+    if(!inet_aton(udp_addr.c_str(), &udp_dest.sin_addr)) {
+        ESP_LOGW(TAG, "invalid nmea udp address %s", udp_addr.c_str());
+        return;
+    }
+
+    udp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if(udp_sock < 0) {
+        ESP_LOGE(TAG, "unable to create udp socket");
+        udp_sock = 0;
+        return;
+    }
+
+    int opt = 1;
+    setsockopt(udp_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt);
+    setsockopt(udp_sock, SOL_SOCKET, SO_BROADCAST, &opt, sizeof opt);
+
+    sockaddr_in bind_addr = {};
+    bind_addr.sin_family = AF_INET;
+    bind_addr.sin_port = htons(udp_port);
+    bind_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(udp_sock, (sockaddr *)&bind_addr, sizeof bind_addr)) {
+        ESP_LOGE(TAG, "udp socket unable to bind: errno %d", errno);
+        close_udp();
+        return;
+    }
+
+    if(IN_MULTICAST(ntohl(udp_dest.sin_addr.s_addr))) {
+        ip_mreq mreq = {};
+        mreq.imr_multiaddr = udp_dest.sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if(setsockopt(udp_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof mreq))
+            ESP_LOGW(TAG, "failed to join multicast %s errno %d", udp_addr.c_str(), errno);
+        uint8_t loop = 0; // our own datagrams are not delivered back to us
+        setsockopt(udp_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof loop);
+    }
+
+    fcntl(udp_sock, F_SETFL, fcntl(udp_sock, F_GETFL, 0) | O_NONBLOCK);
+    ESP_LOGI(TAG, "nmea udp %s:%d", udp_addr.c_str(), udp_port);
+}
+
+static void flush_udp()
+{
+    if(!udp_out_len)
+        return;
+    if(sendto(udp_sock, udp_out, udp_out_len, 0, (sockaddr *)&udp_dest, sizeof udp_dest) < 0)
+        ESP_LOGW(TAG, "nmea udp send errno %d", errno);
+    udp_datagrams++;
+    udp_out_len = 0;
+}
+
+static void write_nmea_udp(const char *buf, int len)
+{
+    if(!udp_sock)
+        return;
+
+    if(udp_out_len + len > NMEA_UDP_DATAGRAM)
+        flush_udp();
+    if(len > NMEA_UDP_DATAGRAM)
+        return;
+    memcpy(udp_out + udp_out_len, buf, len);
+    udp_out_len += len;
+}
+
+// sent from our socket, which is bound to the port it sends to
+static bool udp_echo(const sockaddr_in &from)
+{
+    if(from.sin_port != udp_dest.sin_port)
+        return false;
+    for(int i=0; i<udp_own_count; i++)
+        if(from.sin_addr.s_addr == udp_own[i])
+            return true;
+    return false;
+}
+
+static void read_udp()
+{
+    udp_own_addresses();
+
+    char buf[NMEA_UDP_DATAGRAM + 1];
+    for(;;) {
+        sockaddr_in from;
+        socklen_t from_len = sizeof from;
+        int len = recvfrom(udp_sock, buf, NMEA_UDP_DATAGRAM, 0, (sockaddr *)&from, &from_len);
+        if(len <= 0)
+            return;
+        buf[len] = '\0';
+
+        if(!settings.input_nmea_udp)
+            continue;
+
+        if(udp_echo(from)) {
+            udp_echoes++;
+            continue;
+        }
+
+        // each datagram holds whole lines
+        for(char *line = buf; line < buf + len;) {
+            int n = strcspn(line, "\r\n");
+            line[n] = '\0';
+            if(n)
+                nmea_parse_line(line, n, WIFI_DATA);
+            line += n + 1;
+        }
+    }
 }
 
 void nmea_poll()
 {
+    for(nmea_output_t *o : wifi_outputs) {
+        o->bytes_per_second = settings.nmea_wifi_rate;
+        nmea_output_poll(*o);
+    }
+
     if(!force_wifi_ap_mode && // wifi changed, disconnect everything
        settings.wifi_mode != "ap" &&
        !wifi_connected) {
         //ESP_LOGI(TAG, "not conn %d", server_sock);
         close_server();
+        close_udp();
         nmea_tcp_client.close();
         nmea_pypilot_client.close();
         nmea_signalk_client.close();
         return;
     }
 
-    uint64_t t0 = esp_timer_get_time();
-    static uint64_t last_poll_time;
-
-    if(t0-last_poll_time < 1000)
-        return;
-    last_poll_time = t0;
+    bool pypilot = settings.input_nmea_pypilot || settings.output_nmea_pypilot;
+    bool signalk = settings.input_nmea_signalk || settings.output_nmea_signalk;
+    bool tcp_client = settings.input_nmea_tcp_client || settings.output_nmea_tcp_client;
+    bool tcp_server = settings.input_nmea_tcp_server || settings.output_nmea_tcp_server;
 
-    if(settings.input_nmea_pypilot || settings.output_nmea_pypilot) {
+    if(pypilot)
         connect_client(nmea_pypilot_client, settings.pypilot_addr, 20220);
-        if(!poll_client(nmea_pypilot_client, settings.input_nmea_pypilot))
-            // find pypilot address again with mdns                
-            pypilot_discovered=0;
-    }
-
-    if(settings.input_nmea_signalk || settings.output_nmea_signalk) {
+    if(signalk)
         connect_client(nmea_signalk_client, settings.signalk_addr, 10110);
-        if(!poll_client(nmea_signalk_client, settings.input_nmea_signalk))
-            // find address again with mdns                
-            signalk_discovered=0;
+    if(tcp_client)
+        connect_client(nmea_tcp_client, settings.nmea_tcp_client_addr, settings.nmea_tcp_client_port);
+    if(tcp_server)
+        connect_server();
+
+    bool udp = settings.input_nmea_udp || settings.output_nmea_udp;
+    if(udp) {
+        connect_udp();
+        flush_udp(); // what was written since the last poll
+    } else
+        close_udp();
+
+    // find which sockets are ready in one call rather than trying each
+    fd_set rd, wr;
+    FD_ZERO(&rd);
+    FD_ZERO(&wr);
+    int maxfd = -1;
+    if(pypilot)
+        watch_client(nmea_pypilot_client, rd, wr, maxfd);
+    if(signalk)
+        watch_client(nmea_signalk_client, rd, wr, maxfd);
+    if(tcp_client)
+        watch_client(nmea_tcp_client, rd, wr, maxfd);
+    if(udp_sock) {
+        FD_SET(udp_sock, &rd);
+        if(udp_sock > maxfd)
+            maxfd = udp_sock;
+    }
+    if(tcp_server && server_sock) {
+        FD_SET(server_sock, &rd);
+        if(server_sock > maxfd)
+            maxfd = server_sock;
+        for(unsigned i=0; i<(sizeof clients) / (sizeof *clients); i++)
+            watch_client(clients[i], rd, wr, maxfd);
     }
 
-    if(settings.input_nmea_tcp_client || settings.output_nmea_tcp_client) {
-        connect_client(nmea_tcp_client, settings.nmea_tcp_client_addr, settings.nmea_tcp_client_port);
-        poll_client(nmea_tcp_client, settings.input_nmea_tcp_client);
+    if(maxfd < 0)
+        return;
+
+    timeval timeout = {0, 0};
+    int ready = select(maxfd + 1, &rd, &wr, NULL, &timeout);
+    if(ready <= 0) {
+        if(ready < 0)
+            ESP_LOGW(TAG, "select errno %d", errno);
+        return;
     }
-    
-    if(settings.input_nmea_tcp_server || settings.output_nmea_tcp_server) {
-        connect_server();
-        poll_server();
+
+    if(pypilot && !service_client(nmea_pypilot_client, settings.input_nmea_pypilot, rd, wr))
+        // find pypilot address again with mdns
+        pypilot_discovered=0;
+
+    if(signalk && !service_client(nmea_signalk_client, settings.input_nmea_signalk, rd, wr))
+        // find address again with mdns
+        signalk_discovered=0;
+
+    if(tcp_client)
+        service_client(nmea_tcp_client, settings.input_nmea_tcp_client, rd, wr);
+
+    if(udp_sock && FD_ISSET(udp_sock, &rd))
+        read_udp();
+
+    if(tcp_server && server_sock) {
+        for(unsigned i=0; i<(sizeof clients) / (sizeof *clients); i++)
+            service_client(clients[i], settings.input_nmea_tcp_server, rd, wr);
+        // after the clients so a new socket is not mistaken for a ready one
+        if(FD_ISSET(server_sock, &rd))
+            accept_server();
     }
 }
 
-static void write_nmea_client(ClientSock &c, const char *buf)
+// send everything queued for the client with one call, keeping what did not fit
+static void flush_client(ClientSock &c)
 {
-    if(!c.sock)
+    c.fresh = c.queued;
+    if(!c.sock || c.connecting || !c.out_len)
         return;
 
-    int ret = send(c.sock, buf, strlen(buf), 0);
+    uint64_t t0 = esp_timer_get_time();
+    int ret = send(c.sock, c.out + c.sent, c.out_len - c.sent, 0);
+    c.sends++;
     if(ret < 0) {
+        // a slow reader keeps its queue, unless nothing got through for a long time
+        if(errno == EAGAIN && t0 - c.send_time < 60e6)
+            return;
         ESP_LOGE(TAG, "write_nmea_client errno %d", errno);
+    } else if(ret > 0) {
+        c.send_time = t0;
+        c.sent += ret;
+        int n = 0, bytes = 0;
+        while(n < c.queued && c.sent - bytes >= c.queue[n])
+            bytes += c.queue[n++];
+        c.out_len -= bytes;
+        c.sent -= bytes;
+        memmove(c.out, c.out + bytes, c.out_len);
+        c.queued -= n;
+        memmove(c.queue, c.queue + n, c.queued * sizeof *c.queue);
+        c.fresh = c.queued;
+        return;
+    }
+
+    ESP_LOGI(TAG, "nmea socket closed %d", ret);
+    c.close();
+}
 
-        if(errno == EAGAIN) {
-            // timeout
-            if(esp_timer_get_time() - c.time < 10e6) 
-                return;
+static int queue_offset(const ClientSock &c, int i)
+{
+    int offset = 0;
+    for(int j=0; j<i; j++)
+        offset += c.queue[j];
+    return offset;
+}
+
+// compare talker and formatter, eg: WIMWV
+static bool same_sentence(const char *a, const char *b)
+{
+    return !strncmp(a+1, b+1, 5);
+}
+
+// fields of a type that tell its sentences apart, from field, then every step
+static const struct {
+    char formatter[4];
+    uint8_t field, step;
+} nmea_variants[] = {
+    {"MWV", 2, 0}, // relative or true
+    {"XDR", 4, 4}, // transducer names
+    {"GSV", 2, 0}, // part of a multi-part sentence
+    {"RTE", 2, 0},
+    {"TXT", 2, 0},
+};
+
+void nmea_sentence_id(const char *line, char *id)
+{
+    id[0] = '\0';
+    for(int i=1; i<6; i++)
+        if(!line[i] || line[i] == ',' || line[i] == '*')
+            return;
+    if(line[6] != ',' || !strncmp(line+3, "VDM", 3) || !strncmp(line+3, "VDO", 3))
+        return;
+
+    memcpy(id, line+1, 5);
+    int len = 5;
+    for(const auto &v : nmea_variants) {
+        if(strncmp(v.formatter, line+3, 3))
+            continue;
+        bool keep = false;
+        int field = 0;
+        for(const char *p = line+6; *p && *p != '*' && *p != '\r' && *p != '\n'; p++) {
+            if(*p == ',') {
+                field++;
+                keep = field == v.field || (v.step && field > v.field && (field - v.field) % v.step == 0);
+            }
+            if(keep && len < NMEA_ID_LENGTH-1)
+                id[len++] = *p;
+        }
+        break;
+    }
+    id[len] = '\0';
+}
+
+// the same talker, formatter and identifying fields, eg: WIMWV,R
+static bool same_variant(const char *a, const char *id)
+{
+    char ida[NMEA_ID_LENGTH];
+    nmea_sentence_id(a, ida);
+    return id[0] && !strcmp(ida, id);
+}
+
+static void queue_remove(ClientSock &c, int i)
+{
+    int offset = queue_offset(c, i), len = c.queue[i];
+    memmove(c.out + offset, c.out + offset + len, c.out_len - offset - len);
+    c.out_len -= len;
+    c.queued--;
+    memmove(c.queue + i, c.queue + i + 1, (c.queued - i) * sizeof *c.queue);
+    if(i < c.fresh)
+        c.fresh--;
+    c.send_dropped++;
+}
+
+// pick a queued sentence to drop to make room, -1 if none can be
+static int queue_victim(const ClientSock &c)
+{
+    int first = c.sent ? 1 : 0; // partly sent sentence must finish
+    if(first >= c.queued)
+        return -1;
+    if(settings.nmea_tcp_drop_policy.policy() != DROP_TYPE)
+        return first;
+
+    // oldest sentence of the type using the most of the queue
+    int victim = first, most = 0;
+    for(int i=first, offset=queue_offset(c, first); i<c.queued; offset += c.queue[i++]) {
+        int bytes = 0;
+        for(int j=i, offset_j=offset; j<c.queued; offset_j += c.queue[j++])
+            if(same_sentence(c.out + offset, c.out + offset_j))
+                bytes += c.queue[j];
+        if(bytes > most) {
+            most = bytes;
+            victim = i;
         }
-    } if(ret > 0) // for now dont worry about "short" writes
+    }
+    return victim;
+}
+
+static void write_nmea_client(ClientSock &c, const char *buf, int len)
+{
+    if(!c.sock)
         return;
-        
-    ESP_LOGI(TAG, "nmea socket closed %dn", ret);
-    c.close();
+
+    if(len > NMEA_CLIENT_OUTPUT) {
+        c.send_dropped++;
+        return;
+    }
+
+    drop_policy_e policy = settings.nmea_tcp_drop_policy.policy();
+    char id[NMEA_ID_LENGTH] = "";
+    if(policy == DROP_LATEST)
+        nmea_sentence_id(buf, id);
+
+    // replace a sentence still waiting from an earlier tick with this one
+    // ais fragments are all kept as each is a different part of a message
+    if(policy == DROP_LATEST && id[0]) {
+        int first = c.sent ? 1 : 0;
+        for(int i=first, offset=queue_offset(c, first); i<c.fresh; offset += c.queue[i++])
+            if(same_variant(c.out + offset, id)) {
+                queue_remove(c, i);
+                break;
+            }
+    }
+
+    while(c.out_len + len > NMEA_CLIENT_OUTPUT || c.queued == NMEA_CLIENT_QUEUE) {
+        int i = queue_victim(c);
+        if(i < 0) {
+            c.send_dropped++;
+            return;
+        }
+        queue_remove(c, i);
+    }
+
+    memcpy(c.out + c.out_len, buf, len);
+    c.out_len += len;
+    c.queue[c.queued++] = len;
+    if(c.queued > c.max_queued)
+        c.max_queued = c.queued;
 }
 
-static void write_nmea_tcp_server(const char *buf)
+static void write_server_output(const char *buf, int len)
 {
-    for(int i=0; i<(sizeof clients) / (sizeof *clients); i++)
-        write_nmea_client(clients[i], buf);
+    for(unsigned i=0; i<(sizeof clients) / (sizeof *clients); i++)
+        write_nmea_client(clients[i], buf, len);
 }
 
+static void write_pypilot_output(const char *buf, int len) { write_nmea_client(nmea_pypilot_client, buf, len); }
+static void write_signalk_output(const char *buf, int len) { write_nmea_client(nmea_signalk_client, buf, len); }
+static void write_client_output(const char *buf, int len) { write_nmea_client(nmea_tcp_client, buf, len); }
+static void write_udp_output(const char *buf, int len) { write_nmea_udp(buf, len); }
+
 void nmea_write_wifi(const char *buf)
 {
     if(settings.output_nmea_pypilot)
-        write_nmea_client(nmea_pypilot_client, buf);
+        nmea_output_write(pypilot_output, buf);
     if(settings.output_nmea_signalk)
-        write_nmea_client(nmea_signalk_client, buf);
+        nmea_output_write(signalk_output, buf);
     if(settings.output_nmea_tcp_client)
-        write_nmea_client(nmea_tcp_client, buf);
+        nmea_output_write(client_output, buf);
     if(settings.output_nmea_tcp_server)
-        write_nmea_tcp_server(buf);
+        nmea_output_write(server_output, buf);
+    if(settings.output_nmea_udp)
+        nmea_output_write(udp_output, buf);
 }
 
 void nmea_send(const char *buf)
@@ -687,3 +1479,146 @@ void nmea_send(const char *buf)
     serial_write_nmea(buf2);
     nmea_write_wifi(buf2);
 }
+
+nmea_builder::nmea_builder(const char *formatter)
+{
+    buf[0] = '$';
+    buf[1] = 'Q';
+    buf[2] = 'Y';
+    len = 3;
+    cksum = 'Q' ^ 'Y';
+    while(*formatter && len < 6) {
+        cksum ^= *formatter;
+        buf[len++] = *formatter++;
+    }
+}
+
+// room is kept for the checksum and line ending
+#define NMEA_BUILDER_END (NMEA_BUILDER_LENGTH - 6)
+
+void nmea_builder::empty(int count)
+{
+    while(count-- > 0 && len < NMEA_BUILDER_END) {
+        buf[len++] = ',';
+        cksum ^= ',';
+    }
+}
+
+void nmea_builder::text(const char *s)
+{
+    empty();
+    while(*s && len < NMEA_BUILDER_END) {
+        cksum ^= *s;
+        buf[len++] = *s++;
+    }
+}
+
+// digits of value, at least min_digits with leading zeros
+static int format_digits(char *out, uint32_t value, int min_digits)
+{
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while(value || n < min_digits);
+    for(int i=0; i<n; i++)
+        out[i] = digits[n-1-i];
+    return n;
+}
+
+void nmea_builder::fixed(int32_t value, int decimals)
+{
+    empty();
+    // sign, 10 digits and a decimal point
+    if(len + 12 > NMEA_BUILDER_END || decimals < 0 || decimals > 7)
+        return;
+
+    char *start = buf + len;
+    uint32_t u = value;
+    if(value < 0) {
+        buf[len++] = '-';
+        u = -(uint32_t)value;
+    }
+
+    static const uint32_t scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
+    if(decimals == 0)
+        len += format_digits(buf + len, u, 1);
+    else {
+        uint32_t scale = scales[decimals];
+        len += format_digits(buf + len, u / scale, 1);
+        buf[len++] = '.';
+        len += format_digits(buf + len, u % scale, decimals);
+    }
+
+    for(char *c = start; c < buf + len; c++)
+        cksum ^= *c;
+}
+
+void nmea_builder::integer(int32_t value)
+{
+    fixed(value, 0);
+}
+
+void nmea_builder::decimal(float value, int decimals)
+{
+    static const float scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000};
+    decimals = decimals < 0 ? 0 : decimals > 7 ? 7 : decimals;
+    float scaled = value * scales[decimals];
+    if(!(fabsf(scaled) < 2e9f)) { // also nan
+        empty();
+        return;
+    }
+    fixed(scaled < 0 ? scaled - .5f : scaled + .5f, decimals);
+}
+
+const char *nmea_builder::finish()
+{
+    static const char hex[] = "0123456789abcdef";
+    buf[len++] = '*';
+    buf[len++] = hex[cksum >> 4];
+    buf[len++] = hex[cksum & 0xf];
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    buf[len] = '\0';
+    return buf;
+}
+
+void nmea_builder::send()
+{
+    finish();
+    serial_write_nmea(buf);
+    nmea_write_wifi(buf);
+}
+
+#if defined(CONFIG_IDF_TARGET_ESP32S3) || defined(__linux__)
+static void print_client_stats(const char *name, const ClientSock &c)
+{
+    if(!c.sock && !c.bytes_copied && !c.sentences_dropped && !c.sends)
+        return;
+    printf("%-10s %5s %12" PRIu32 " %8" PRIu32 " %8" PRIu32 " %3d/%-3d %5d %8" PRIu32 "\n",
+           name, c.sock ? "yes" : "no", c.bytes_copied, c.sentences_dropped,
+           c.sends, c.queued, c.max_queued, c.out_len, c.send_dropped);
+}
+
+void nmea_print_stats()
+{
+    print_sentence_stats();
+
+    printf("\n%-10s %5s %12s %8s %8s %7s %5s %8s\n", "Client", "Conn", "Bytes Copied", "Dropped",
+           "Sends", "Queue", "Bytes", "Out Drop");
+    print_client_stats("tcp", nmea_tcp_client);
+    print_client_stats("pypilot", nmea_pypilot_client);
+    print_client_stats("signalk", nmea_signalk_client);
+    for(unsigned i=0; i<(sizeof clients) / (sizeof *clients); i++) {
+        char name[16];
+        snprintf(name, sizeof name, "server%u", i);
+        print_client_stats(name, clients[i]);
+    }
+    if(udp_datagrams || udp_echoes)
+        printf("\nudp %" PRIu32 " datagrams sent, %" PRIu32 " own datagrams ignored\n", udp_datagrams, udp_echoes);
+
+    printf("\n");
+    ais_print_stats();
+}
+#endif
@@ -7,6 +7,48 @@
  */
 
 bool nmea_parse_line(const char*, data_source_e);
+bool nmea_parse_line(const char *line, int len, data_source_e source);
 void nmea_write_wifi(const char *buf);
 void nmea_send(const char *buf);
 void nmea_poll();
+void nmea_print_stats();
+
+// counted as lines are parsed, accepted and rejected by display_data_update
+struct nmea_stats_t {
+    uint32_t bytes, sentences;
+    uint32_t bad;          // malformed or failed checksum
+    uint32_t unknown;      // sentence type not decoded
+    uint32_t parse_failed; // decoded but the fields were not valid
+    uint32_t accepted, rejected;
+};
+
+extern nmea_stats_t nmea_source_stats[DATA_SOURCE_COUNT];
+// per type counts start once the checksum passes, so bad is always zero here
+const char *nmea_sentence_stats(int i, nmea_stats_t &stats); // NULL past the last type
+
+#define NMEA_ID_LENGTH 24
+
+// talker, formatter and the fields telling apart sentences of one type,
+// eg: "WIMWV,R", empty for ais fragments which are each different
+void nmea_sentence_id(const char *line, char *id);
+
+#define NMEA_BUILDER_LENGTH 96
+
+// build a $QY sentence in place, the checksum is kept as fields are added
+// eg: nmea_builder b("MTW"); b.decimal(temp, 2); b.text("C"); b.send();
+struct nmea_builder {
+    nmea_builder(const char *formatter);
+
+    void empty(int count=1);                // count empty fields
+    void text(const char *s);
+    void integer(int32_t value);
+    void fixed(int32_t value, int decimals); // value is scaled by 10^decimals, empty unless 0-7
+    void decimal(float value, int decimals); // rounded to at most 7, empty if nan or too large
+
+    const char *finish(); // append checksum and line ending
+    void send();          // finish and write to serial and wifi
+
+    char buf[NMEA_BUILDER_LENGTH];
+    int len;
+    uint8_t cksum;
+};
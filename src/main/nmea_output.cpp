@@ -0,0 +1,258 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// schedule nmea output to each sink within its bandwidth,
+// rate limiting each sentence type and keeping only the latest when behind
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __linux__
+uint64_t esp_timer_get_time();
+#else
+#include <esp_timer.h>
+#endif
+
+#include "settings.h"
+#include "nmea.h"
+#include "nmea_output.h"
+
+static nmea_output_t *sinks[NMEA_OUTPUT_SINKS];
+
+nmea_output_t::nmea_output_t(const char *_name, void (*_write)(const char *buf, int len))
+    : name(_name), write(_write), bytes_per_second(0), budget(0), budget_time(0), queued_seq(0),
+      sent(0), bytes(0), replaced(0), dropped(0), window_bytes(0), window_time(0), rate(0), utilisation(0)
+{
+    memset(slots, 0, sizeof slots);
+    for(int i=0; i<NMEA_OUTPUT_SINKS; i++)
+        if(!sinks[i]) {
+            sinks[i] = this;
+            break;
+        }
+}
+
+// minimum interval for sentence types from settings, eg: "MWV:100,MDA:1000"
+static struct {
+    char formatter[3];
+    uint16_t ms;
+} intervals[16];
+static int interval_count;
+static std::string intervals_setting;
+
+static void parse_intervals()
+{
+    if(intervals_setting == settings.nmea_output_intervals)
+        return;
+    intervals_setting = settings.nmea_output_intervals;
+
+    interval_count = 0;
+    const char *s = intervals_setting.c_str();
+    while(*s && interval_count < (int)((sizeof intervals) / (sizeof *intervals))) {
+        const char *colon = strchr(s, ':');
+        if(!colon || colon - s != 3)
+            break;
+        memcpy(intervals[interval_count].formatter, s, 3);
+        intervals[interval_count].ms = strtol(colon+1, (char**)&s, 10);
+        interval_count++;
+        if(*s == ',')
+            s++;
+    }
+}
+
+// for a sentence key, eg: WIMWV,R
+static uint64_t min_interval(const char *key)
+{
+    if(!key[0])
+        return 0;
+    for(int i=0; i<interval_count; i++)
+        if(!memcmp(intervals[i].formatter, key+2, 3))
+            return intervals[i].ms * 1000ULL;
+    return 0;
+}
+
+static void refill(nmea_output_t &o, uint64_t t)
+{
+    if(!o.bytes_per_second)
+        return;
+    // allow a burst of a tenth of a second, and at least one sentence
+    float max = o.bytes_per_second / 10.0f;
+    if(max < NMEA_OUTPUT_LINE)
+        max = NMEA_OUTPUT_LINE;
+    o.budget += (t - o.budget_time) * 1e-6f * o.bytes_per_second;
+    if(o.budget > max)
+        o.budget = max;
+    o.budget_time = t;
+}
+
+// a line may overdraw the budget, the uart buffers it and later lines wait,
+// so a long ais sentence is not starved by shorter sentences
+static bool fits(nmea_output_t &o)
+{
+    return !o.bytes_per_second || o.budget > 0;
+}
+
+static void send(nmea_output_t &o, const char *line, int len)
+{
+    o.write(line, len);
+    if(o.bytes_per_second)
+        o.budget -= len;
+    o.sent++;
+    o.bytes += len;
+    o.window_bytes += len;
+}
+
+// the idle slot unused the longest whose interval is over, so a slot
+// taken for another sentence never lets its last one go early
+static nmea_output_slot_t *free_slot(nmea_output_t &o, uint64_t t)
+{
+    nmea_output_slot_t *free = NULL;
+    for(int i=0; i<NMEA_OUTPUT_SLOTS; i++) {
+        nmea_output_slot_t &s = o.slots[i];
+        if(!s.pending && t - s.sent_time >= min_interval(s.key) &&
+           (!free || s.sent_time < free->sent_time))
+            free = &s;
+    }
+    if(free)
+        free->sent_time = 0;
+    return free;
+}
+
+static nmea_output_slot_t *find_slot(nmea_output_t &o, const char *key)
+{
+    for(int i=0; i<NMEA_OUTPUT_SLOTS; i++)
+        if(!strcmp(o.slots[i].key, key))
+            return &o.slots[i];
+    return NULL;
+}
+
+static void queue(nmea_output_t &o, nmea_output_slot_t &s, const char *line, int len)
+{
+    if(s.pending)
+        o.replaced++;
+    else
+        s.queued_seq = o.queued_seq++;
+    memcpy(s.line, line, len + 1);
+    s.len = len;
+    s.pending = true;
+}
+
+void nmea_output_write(nmea_output_t &o, const char *line)
+{
+    uint64_t t = esp_timer_get_time();
+    refill(o, t);
+    int len = strlen(line);
+
+    if(len < 7 || len >= NMEA_OUTPUT_LINE) {
+        if(fits(o))
+            send(o, line, len);
+        else
+            o.dropped++;
+        return;
+    }
+
+    // ais fragments are never combined, they wait in order in up to half the slots
+    char key[NMEA_ID_LENGTH];
+    nmea_sentence_id(line, key);
+    if(!key[0]) {
+        int waiting = 0;
+        for(int i=0; i<NMEA_OUTPUT_SLOTS; i++)
+            waiting += o.slots[i].pending && !o.slots[i].key[0];
+        if(!waiting && fits(o)) {
+            send(o, line, len);
+            return;
+        }
+        nmea_output_slot_t *s = waiting < NMEA_OUTPUT_SLOTS/2 ? free_slot(o, t) : NULL;
+        if(!s) {
+            o.dropped++;
+            return;
+        }
+        s->key[0] = '\0';
+        queue(o, *s, line, len);
+        return;
+    }
+
+    // a sentence without an interval only needs a slot to wait for bandwidth
+    uint64_t interval = min_interval(key);
+    nmea_output_slot_t *s = find_slot(o, key);
+    if(!s && !interval && fits(o)) {
+        send(o, line, len);
+        return;
+    }
+
+    if(!s) {
+        s = free_slot(o, t);
+        if(!s) {
+            o.dropped++;
+            return;
+        }
+        strcpy(s->key, key);
+    }
+
+    if(!s->pending && t - s->sent_time >= interval && fits(o)) {
+        send(o, line, len);
+        s->sent_time = t;
+        return;
+    }
+
+    // too soon or no bandwidth, keep the latest until it can go
+    queue(o, *s, line, len);
+}
+
+void nmea_output_poll(nmea_output_t &o)
+{
+    parse_intervals();
+
+    uint64_t t = esp_timer_get_time();
+    refill(o, t);
+
+    // send waiting sentences oldest first as their interval and the budget allow
+    for(;;) {
+        nmea_output_slot_t *next = NULL;
+        for(int i=0; i<NMEA_OUTPUT_SLOTS; i++) {
+            nmea_output_slot_t &s = o.slots[i];
+            if(s.pending && t - s.sent_time >= min_interval(s.key) &&
+               (!next || (int32_t)(s.queued_seq - next->queued_seq) < 0))
+                next = &s;
+        }
+        if(!next || !fits(o))
+            break;
+        send(o, next->line, next->len);
+        next->sent_time = t;
+        next->pending = false;
+    }
+
+    if(t - o.window_time >= 1000000) {
+        if(o.window_time)
+            o.rate = o.window_bytes / ((t - o.window_time) * 1e-6f);
+        if(o.bytes_per_second)
+            o.utilisation = o.rate / o.bytes_per_second;
+        o.window_bytes = 0;
+        o.window_time = t;
+    }
+}
+
+void nmea_output_print_stats()
+{
+    printf("%-8s %8s %8s %6s %10s %10s %8s %8s %7s\n", "Output", "Limit", "Rate", "Util",
+           "Sentences", "Bytes", "Replaced", "Dropped", "Pending");
+    for(int i=0; i<NMEA_OUTPUT_SINKS; i++) {
+        nmea_output_t *o = sinks[i];
+        if(!o)
+            continue;
+        int pending = 0;
+        for(int j=0; j<NMEA_OUTPUT_SLOTS; j++)
+            pending += o->slots[j].pending;
+        char util[16] = "-";
+        if(o->bytes_per_second)
+            snprintf(util, sizeof util, "%.0f%%", o->utilisation*100);
+        printf("%-8s %8u %8.0f %6s %10u %10u %8u %8u %7d\n", o->name, (unsigned)o->bytes_per_second,
+               o->rate, util, (unsigned)o->sent, (unsigned)o->bytes, (unsigned)o->replaced, (unsigned)o->dropped, pending);
+    }
+}
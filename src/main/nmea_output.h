@@ -0,0 +1,48 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+#include <stdint.h>
+
+#define NMEA_OUTPUT_SLOTS 16
+#define NMEA_OUTPUT_LINE 96
+#define NMEA_OUTPUT_SINKS 8
+
+// the latest sentence of one type waiting for its interval or for bandwidth,
+// or an ais fragment with an empty key
+struct nmea_output_slot_t {
+    char key[NMEA_ID_LENGTH]; // from nmea_sentence_id, eg: WIMWV,R
+    bool pending;
+    uint8_t len;
+    uint64_t sent_time;   // when this type was last sent
+    uint32_t queued_seq;  // order the pending line was first queued
+    char line[NMEA_OUTPUT_LINE];
+};
+
+// an output such as a serial port with a byte budget,
+// write is given a null terminated line and its length
+struct nmea_output_t {
+    nmea_output_t(const char *_name, void (*_write)(const char *buf, int len));
+
+    const char *name;
+    void (*write)(const char *buf, int len);
+    uint32_t bytes_per_second; // 0 for no limit
+
+    float budget;
+    uint64_t budget_time;
+    uint32_t queued_seq;
+    nmea_output_slot_t slots[NMEA_OUTPUT_SLOTS];
+
+    uint32_t sent, bytes, replaced, dropped;
+    uint32_t window_bytes;
+    uint64_t window_time;
+    float rate, utilisation; // bytes per second sent, and that over the budget
+};
+
+void nmea_output_write(nmea_output_t &o, const char *line);
+void nmea_output_poll(nmea_output_t &o);
+void nmea_output_print_stats();
@@ -14,6 +14,7 @@
 #include "pypilot_client.h"
 #include "serial.h"
 #include "settings.h"
+#include "ais.h"
 #include "wireless.h"
 #include "accel.h"
 #include "menu.h"
@@ -22,6 +23,7 @@
 #include "keys.h"
 #include "alarm.h"
 #include "history.h"
+#include "capture.h"
 
 void setup()
 {
@@ -58,6 +60,8 @@ void loop()
     keys_poll();
     serial_poll();
     nmea_poll();
+    capture_poll();
+    ais_poll();
     signalk_poll();
     pypilot_client_poll();
     alarm_poll();
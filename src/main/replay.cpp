@@ -0,0 +1,223 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// replay a capture file made with the serial "capture" command
+// through the same parsing and sensor code as the mfd runs
+
+// g++ -std=c++20 -O2 -g -I. -o replay replay.cpp nmea.cpp nmea_output.cpp capture.cpp wireless.cpp sensors.cpp ais.cpp utils.cpp display_data.cpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include <rapidjson/document.h>
+
+#include "settings.h"
+#include "display.h"
+#include "nmea.h"
+#include "wireless.h"
+#include "capture.h"
+
+// stubs for what the replayed code needs from the rest of the firmware
+settings_t settings;
+bool force_wifi_ap_mode;
+int signalk_discovered, pypilot_discovered;
+route_info_t route_info;
+
+void history_set_time(uint32_t date, int hour, int minute, float second) {}
+void serial_write_nmea(const char *buf) {}
+void signalk_send(std::string key, float value) {}
+bool read_field(float &x, const rapidjson::Value& v) { return false; }
+
+// time as seen by the replayed code is the capture time
+static uint64_t replay_time;
+uint64_t esp_timer_get_time() { return replay_time; }
+uint32_t millis() { return replay_time / 1000; }
+
+// accepted display updates per item, counted as they reach the history
+static int updates[DISPLAY_COUNT];
+void history_put(display_item_e item, float value) { updates[item]++; }
+
+struct handler_stats {
+    int count;
+    uint64_t cpu_ns;
+};
+static std::map<std::string, handler_stats> handlers;
+
+static uint64_t clock_ns(clockid_t id)
+{
+    timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static std::string handler_name(const capture_record_t &r, const uint8_t *data)
+{
+    if(r.type == CAPTURE_NMEA)
+        return r.len >= 6 ? std::string((const char*)data + 3, 3) : "short";
+
+    if(r.len < 8)
+        return "esp short";
+    uint16_t id = data[6] | data[7] << 8;
+    switch(id) {
+    case 0xB179: return "esp wind";
+    case 0xa41b: return "esp air";
+    case 0xc946: return "esp water";
+    case 0xd255: return "esp lightning";
+    case 0xC9D2: return "esp info";
+    }
+    return "esp unknown";
+}
+
+static void replay_record(const capture_record_t &r, uint8_t *data)
+{
+    uint64_t t0 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    if(r.type == CAPTURE_NMEA) {
+        char line[CAPTURE_MAX_DATA + 1];
+        memcpy(line, data, r.len);
+        line[r.len] = '\0';
+        nmea_parse_line(line, r.len, (data_source_e)r.source);
+    } else if(r.type == CAPTURE_ESP_NOW && r.len > 6)
+        wireless_receive_packet(data, data + 6, r.len - 6);
+    uint64_t t1 = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+
+    handler_stats &stats = handlers[handler_name(r, data)];
+    stats.count++;
+    stats.cpu_ns += t1 - t0;
+}
+
+static int replay(const char *filename, double speed)
+{
+    FILE *f = fopen(filename, "rb");
+    if(!f) {
+        fprintf(stderr, "failed to open %s\n", filename);
+        return 1;
+    }
+    if(!capture_read_header(f)) {
+        fprintf(stderr, "%s is not a capture file\n", filename);
+        return 1;
+    }
+
+    capture_record_t r;
+    uint8_t buf[CAPTURE_MAX_DATA];
+    int records = 0;
+    uint64_t start = clock_ns(CLOCK_MONOTONIC), capture_start = 0;
+    while(capture_read(f, r, buf)) {
+        replay_time += r.dt;
+        if(!records)
+            capture_start = replay_time;
+
+        if(speed > 0) {
+            // wait until this record is due
+            uint64_t due = start + (replay_time - capture_start) * 1000 / speed;
+            uint64_t now = clock_ns(CLOCK_MONOTONIC);
+            if(due > now)
+                usleep((due - now) / 1000);
+        }
+
+        replay_record(r, buf);
+        records++;
+    }
+    fclose(f);
+
+    double wall = (clock_ns(CLOCK_MONOTONIC) - start) * 1e-9;
+    double captured = (replay_time - capture_start) * 1e-6;
+    uint64_t cpu_ns = 0;
+    for(auto &h : handlers)
+        cpu_ns += h.second.cpu_ns;
+
+    printf("%d records covering %.1fs replayed in %.3fs\n", records, captured, wall);
+    printf("%.0f records/s, %.0f records/s of handler cpu time\n\n",
+           records / wall, cpu_ns ? records / (cpu_ns * 1e-9) : 0);
+
+    printf("%-14s %8s %10s %8s\n", "Handler", "Count", "CPU ms", "ns each");
+    for(auto &h : handlers)
+        printf("%-14s %8d %10.3f %8.0f\n", h.first.c_str(), h.second.count,
+               h.second.cpu_ns * 1e-6, (double)h.second.cpu_ns / h.second.count);
+
+    printf("\n%-16s %12s %6s %8s\n", "Item", "Value", "Source", "Updates");
+    for(int i=0; i<DISPLAY_COUNT; i++)
+        if(updates[i])
+            printf("%-16s %12.4f %6s %8d\n", display_get_item_label((display_item_e)i).c_str(),
+                   display_data[i].value, source_name[display_data[i].source], updates[i]);
+
+    printf("\n");
+    nmea_print_stats();
+    return 0;
+}
+
+// make a capture file from a text log of nmea sentences at a fixed rate
+static int convert(const char *text, const char *filename, double rate)
+{
+    FILE *f = fopen(text, "r");
+    if(!f) {
+        fprintf(stderr, "failed to open %s\n", text);
+        return 1;
+    }
+    if(!capture_start(filename))
+        return 1;
+
+    char line[CAPTURE_MAX_DATA + 2];
+    int count = 0;
+    while(fgets(line, sizeof line, f)) {
+        int len = strcspn(line, "\r\n");
+        if(!len)
+            continue;
+        replay_time += 1e6 / rate;
+        capture_nmea(line, len, USB_DATA);
+        count++;
+    }
+    capture_stop();
+    fclose(f);
+    printf("wrote %d sentences to %s\n", count, filename);
+    return 0;
+}
+
+static void usage()
+{
+    printf("usage: replay [-x speed | -m] capture.bin\n");
+    printf("       replay -c nmea.txt capture.bin [-r sentences/s]\n");
+    printf("  -x  replay at speed times real time (default 1)\n");
+    printf("  -m  replay as fast as possible\n");
+    printf("  -c  convert a text nmea log to a capture file\n");
+    printf("  -r  sentence rate for -c (default 10)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    double speed = 1, rate = 10;
+    const char *text = NULL;
+    int c;
+    while((c = getopt(argc, argv, "x:mc:r:h")) != -1) {
+        switch(c) {
+        case 'x': speed = atof(optarg); break;
+        case 'm': speed = 0; break;
+        case 'c': text = optarg; break;
+        case 'r': rate = atof(optarg); break;
+        default: usage(); return 1;
+        }
+    }
+    if(optind != argc - 1) {
+        usage();
+        return 1;
+    }
+
+    for(int i=0; i<DISPLAY_COUNT; i++)
+        display_data[i].value = NAN;
+
+    if(text)
+        return convert(text, argv[optind], rate);
+    return replay(argv[optind], speed);
+}
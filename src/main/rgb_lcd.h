@@ -8,7 +8,7 @@
 
 #if !defined(__linux__)
 static uint8_t *framebuffers[3];
-static int vsynccount;
+static volatile int vsynccount; // since the last frame was sent
 
 #define DRAW_LCD_PIXEL_CLOCK_HZ     (18 * 1000 * 1000)
 #define DRAW_PIN_NUM_HSYNC          -1//47
@@ -49,8 +49,16 @@ static bool IRAM_ATTR example_on_vsync_event(esp_lcd_panel_handle_t panel, const
     return pdTRUE;
 }
 static esp_lcd_panel_handle_t panel_handle = NULL;
+
+// regions of the frames sent since the next framebuffer was drawn, newest first
+static draw_rect missed_regions[DRAW_LCD_NUM_FB-1][DRAW_REGIONS];
+static int missed_count[DRAW_LCD_NUM_FB-1];
 #endif
 
+// each byte is a pixel
+#define DRAW_REGION_ALIGN_X 1
+#define DRAW_REGION_ALIGN_Y 1
+
 static std::string last_color_scheme = "none";
 void draw_setup(int r)
 {
@@ -152,7 +160,7 @@ void draw_setup(int r)
 
 static void putpixel(int x, int y, uint8_t c)
 {    
-    if(x < 0 || y < 0 || x >= DRAW_LCD_H_RES || y >= DRAW_LCD_V_RES)
+    if(x < clip.x0 || y < clip.y0 || x >= clip.x1 || y >= clip.y1)
         return;
     if(c >= GRAYS) {
         printf("putpixel gradient out of range %d\n", c);
@@ -240,13 +248,41 @@ static uint8_t compute_color(color_e c, uint8_t b)
     return v;
 }
 
+// limit a scanline to the clip, false if nothing is left
+static inline bool clip_scanline(int &x, int y, int &count)
+{
+    if(y < clip.y0 || y >= clip.y1)
+        return false;
+    if(x < clip.x0) {
+        count -= clip.x0 - x;
+        x = clip.x0;
+    }
+    if(x + count > clip.x1)
+        count = clip.x1 - x;
+    return count > 0;
+}
+
 static inline void draw_scanline(int x, int y, int value, int count) {
+    if(!clip_scanline(x, y, count))
+        return;
     // easy with 8bpp each byte is a pixel
     memset(framebuffer + DRAW_LCD_H_RES*y+x, value, count);
 }
 
+// antialiased edges are combined with what is already drawn
+static inline void blend_scanline(int x, int y, int value, int count)
+{
+    if(!clip_scanline(x, y, count))
+        return;
+    uint8_t *fb = framebuffer + DRAW_LCD_H_RES*y+x;
+    for(int i=0; i<count; i++)
+        fb[i] |= value;
+}
+
 static inline void invert_scanline(int x, int y, int count)
 {
+    if(!clip_scanline(x, y, count))
+        return;
     for(int x0 = x; x0<x+count; x0++)
         framebuffer[DRAW_LCD_H_RES*y+x0] = ~framebuffer[DRAW_LCD_H_RES*y+x0];
 }
@@ -264,6 +300,7 @@ void draw_clear(bool display_on)
                 palette[i][j] = compute_color((color_e)i, j);
 #ifdef CONFIG_IDF_TARGET_ESP32S3
         last_color_scheme = settings.color_scheme;
+        draw_invalidate_all();
     }        
     
     extio_set(EXTIO_DISP, display_on);
@@ -275,28 +312,50 @@ void draw_clear(bool display_on)
         c = 0x40;
 #endif
 
-    memset(framebuffer, c, DRAW_LCD_H_RES*DRAW_LCD_V_RES);
+    // only what will be redrawn, all of it if nothing was invalidated
+    if(!region_count)
+        draw_invalidate_all();
+    for(int i=0; i<region_count; i++) {
+        draw_rect &r = regions[i];
+        for(int y=r.y0; y<r.y1; y++)
+            memset(framebuffer + DRAW_LCD_H_RES*y + r.x0, c, r.x1 - r.x0);
+    }
 }
 
-static uint32_t t0start;
-
 #ifndef __linux__
 void draw_send_buffer()
 {
-    uint32_t t1 = esp_timer_get_time();
+    // the framebuffer written into below was shown two frames ago, until the
+    // panel has switched away from it at a vsync since the last frame
+    while(!vsynccount)
+        vTaskDelay(1);
+
+    // a framebuffer of the panel, so it is shown from the next vsync without a copy
     esp_lcd_panel_draw_bitmap(panel_handle, 0, 0, DRAW_LCD_H_RES, DRAW_LCD_V_RES, framebuffer);
-        
-    uint32_t t2 = esp_timer_get_time();
 
-    if(framebuffer == framebuffers[0])
-        framebuffer = framebuffers[1];
-    else if(framebuffer == framebuffers[1])
-        framebuffer = framebuffers[2];
-    else
-        framebuffer = framebuffers[0];
-        
-    //printf("frame %d %lu %lu\n", vsynccount, t1-t0start, t2-t1);
+    for(int k=DRAW_LCD_NUM_FB-2; k>0; k--) {
+        memcpy(missed_regions[k], missed_regions[k-1], sizeof missed_regions[k]);
+        missed_count[k] = missed_count[k-1];
+    }
+    memcpy(missed_regions[0], regions, sizeof regions);
+    missed_count[0] = region_count;
+
+    // the next framebuffer still holds the frame from before those two, bring
+    // it up to date so only what changes in the coming frame is redrawn in it
+    int next = 0;
+    while(framebuffers[next] != framebuffer)
+        next++;
+    next = (next + 1) % DRAW_LCD_NUM_FB;
+    for(int k=0; k<DRAW_LCD_NUM_FB-1; k++)
+        for(int i=0; i<missed_count[k]; i++) {
+            draw_rect &r = missed_regions[k][i];
+            for(int y=r.y0; y<r.y1; y++)
+                memcpy(framebuffers[next] + DRAW_LCD_H_RES*y + r.x0,
+                       framebuffer + DRAW_LCD_H_RES*y + r.x0, r.x1 - r.x0);
+        }
+    framebuffer = framebuffers[next];
+
     vsynccount=0;
-    t0start = esp_timer_get_time();
+    regions_sent();
 }
 #endif
@@ -9,7 +9,12 @@
 #include <math.h>
 #include <map>
 
+#ifdef __linux__
+#include <stdint.h>
+uint64_t esp_timer_get_time();
+#else
 #include <esp_timer.h>
+#endif
 
 #include <rapidjson/document.h>
 #include <rapidjson/prettywriter.h>
@@ -372,13 +377,14 @@ void sensors_wind_update(uint8_t mac[6], float dir, float knots, float paccel_x,
     accel_y = lowpass(accel_y, paccel_y);
     accel_z = lowpass(accel_z, paccel_z);
 
-    char buf[128];
-    if (!isnan(lpwind_dir))
-        snprintf(buf, sizeof buf, "MWV,%d.%02d,R,%d.%02d,N,A", (int)lpwind_dir, (uint16_t)(lpwind_dir * 100.0f) % 100U, (int)wind_knots, (int)(wind_knots * 100) % 100);
-    else  // invalid wind direction (no magnet?)
-        snprintf(buf, sizeof buf, "MWV,,R,%d.%02d,N,A", (int)wind_knots, (int)(wind_knots * 100) % 100);
-
-    nmea_send(buf);
+    // invalid wind direction (no magnet?) leaves the angle empty
+    nmea_builder mwv("MWV");
+    mwv.decimal(lpwind_dir, 2);
+    mwv.text("R");
+    mwv.decimal(wind_knots, 2);
+    mwv.text("N");
+    mwv.text("A");
+    mwv.send();
 
 //    printf("lpwind_dir %f\n", lpwind_dir);
 //    uint32_t t3 = millis();
@@ -409,15 +415,24 @@ void sensors_water_update(uint8_t mac[6], float speed, float depth, float temper
     if (!primary)
         return;
 
-    char buf[128];
-    snprintf(buf, sizeof buf, "VHW,,,,,%.2f,N,,", wt.speed);
-    nmea_send(buf);
-
-    snprintf(buf, sizeof buf, "DBT,,,%.5f,M,,", wt.depth);
-    nmea_send(buf);
-
-    snprintf(buf, sizeof buf, "MTW,%.2f,C", wt.temperature);
-    nmea_send(buf);
+    nmea_builder vhw("VHW");
+    vhw.empty(4);
+    vhw.decimal(wt.speed, 2);
+    vhw.text("N");
+    vhw.empty(2);
+    vhw.send();
+
+    nmea_builder dbt("DBT");
+    dbt.empty(2);
+    dbt.decimal(wt.depth, 5);
+    dbt.text("M");
+    dbt.empty(2);
+    dbt.send();
+
+    nmea_builder mtw("MTW");
+    mtw.decimal(wt.temperature, 2);
+    mtw.text("C");
+    mtw.send();
 
     if (settings.output_signalk) {
         signalk_send("navigation.speedThroughWater", wt.speed);
@@ -442,12 +457,19 @@ void sensors_air_update(uint8_t mac[6], float pressure, float rel_humidity, floa
     if(!primary)
         return;
 
-    char buf[128];
-    snprintf(buf, sizeof buf, "MDA,,,%.5f,B,,,,,%.2f,,,,,,,,,,,", wt.pressure, wt.rel_humidity);
-    nmea_send(buf);
-
-    snprintf(buf, sizeof buf, "MTA,%.2f,C", wt.temperature);
-    nmea_send(buf);
+    nmea_builder mda("MDA");
+    mda.empty(2);
+    mda.decimal(wt.pressure, 5);
+    mda.text("B");
+    mda.empty(4);
+    mda.decimal(wt.rel_humidity, 2);
+    mda.empty(11);
+    mda.send();
+
+    nmea_builder mta("MTA");
+    mta.decimal(wt.temperature, 2);
+    mta.text("C");
+    mta.send();
 
     if (settings.output_signalk) {
         signalk_send("environment.outside.pressure", wt.pressure * 100000);
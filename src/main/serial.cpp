@@ -24,6 +24,9 @@
 #include "serial.h"
 #include "nmea.h"
 #include "web.h"
+#include "capture.h"
+#include "nmea_output.h"
+#include "draw.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -382,18 +385,36 @@ struct command {
     void (*completion)(const arg_list& args, linenoiseCompletions* lc);
 };
 
+static bool capture_exec(arg_list &args) {
+    if(args.size() == 2 && args[1] == "start")
+        return capture_start(CAPTURE_FILE);
+    if(args.size() == 2 && args[1] == "stop") {
+        capture_stop();
+        return true;
+    }
+    printf("Usage: capture start|stop\n");
+    printf("record nmea and esp-now input to %s, download from /capture.bin\n", CAPTURE_FILE);
+    return false;
+}
+
 static void help();
 static const command commands[] = {
+    {"capture", "capture input for replay",    NULL, capture_exec, NULL},
     {"cpu",    "print cpu info",               cpu_usage,         NULL, NULL},
 #ifdef CONFIG_IDF_TARGET_ESP32S3
     {"display_auto", "automatically enable relevant display pages",
      [](const arg_list&) { display_auto(); return true; }, NULL},
 #endif
+    {"draw",   "print glyph and circle cache stats", draw_print_stats,  NULL, NULL},
     {"get", "show value of setting",           NULL, get_exec, get_completion},
     {"help",   "print this help message",      help,              NULL, NULL},
     {"list", "list settings",                  settings_list,     NULL, NULL},
     {"mem",    "print memory info",            mem,               NULL, NULL},
     {"net",    "print network info",           net,               NULL, NULL},
+#ifdef CONFIG_IDF_TARGET_ESP32S3
+    {"nmea",   "print nmea input and client stats", nmea_print_stats, NULL, NULL},
+#endif
+    {"output", "print nmea output utilisation", nmea_output_print_stats, NULL, NULL},
     {"reboot", "reboot device",                abort,             NULL, NULL},
     {"scan_wifi", "scan wireless networks",    wireless_scan,     NULL, NULL},
     {"set", "set a setting",                   NULL, set_exec, get_completion},
@@ -549,14 +570,14 @@ struct SerialLinebuffer {
         }
     }
 
-    void write(const char *buf) {
+    void write(const char *buf, int len) {
         if(lastcli_t0 != 0) {
             // prevent serial output within 20 seconds of commandline interface command
             uint64_t t0 = esp_timer_get_time();
             if(t0 - lastcli_t0 < 20e6)
                 return;
         }
-        uart_write_bytes(uart, buf, strlen(buf));
+        uart_write_bytes(uart, buf, len);
     }
 
     std::string buf;
@@ -570,6 +591,9 @@ struct SerialLinebuffer {
 };
 
 SerialLinebuffer Serial0Buffer(UART_NUM_0, USB_DATA);
+static void usb_output_write(const char *buf, int len) { Serial0Buffer.write(buf, len); }
+static nmea_output_t usb_output("usb", usb_output_write);
+
 #ifdef CONFIG_IDF_TARGET_ESP32S3
 SerialLinebuffer Serial1Buffer(Serial1, RS422_DATA);
 SerialLinebuffer Serial2Buffer(Serial2, RS422_DATA);
@@ -603,7 +627,8 @@ void serial_setup()
     // usb host serial here
     Serial0.end();
     if(settings.input_usb || settings.output_usb) {
-        Serial0.begin(settings.usb_baud_rate);
+        baud = settings.usb_baud_rate;
+        Serial0.begin(baud);
         Serial0.setTimeout(0);
         any = true;
         extio_set(EXTIO_ENA_NMEA0);
@@ -634,12 +659,18 @@ void serial_setup()
 
     extio_set(EXTIO_ENA_NMEA, any);
 #endif
+
+    // 10 bits per byte with start and stop bits
+    usb_output.bytes_per_second = baud / 10;
 }
 
 void serial_poll() {
 
     // read usb host serial
     Serial0Buffer.read(settings.input_usb, true);
+
+    // send what was held back for the serial bandwidth
+    nmea_output_poll(usb_output);
     //Serial1Buffer.read(settings.rs422_1_baud_rate);
     //    Serial2Buffer.read(settings.rs422_2_baud_rate);
 }
@@ -648,7 +679,7 @@ static void nmea_write_serial_internal(const char *buf, int uart)
 {
     // handle writing to usb host serial
     if(settings.output_usb && UART_NUM_0 != uart)
-        Serial0Buffer.write(buf);
+        nmea_output_write(usb_output, buf);
 
 //    if(settings.rs422_1_baud_rate && &Serial1 != source)
 //        Serial1.printf(buf);
@@ -50,6 +50,10 @@ struct ChoicePowerButton : SettingsChoice { ChoicePowerButton(const char *s) :
     SettingsChoice({"screenoff", "powersave", "powerdown"}, s) {} };
 struct ChoiceLogLevel : SettingsChoice { ChoiceLogLevel(const char *s) :
     SettingsChoice({"none", "error", "warn", "info", "debug"}, s) {} };
+enum drop_policy_e {DROP_OLDEST, DROP_TYPE, DROP_LATEST};
+struct ChoiceDropPolicy : SettingsChoice { ChoiceDropPolicy(const char *s) :
+    SettingsChoice({"oldest", "type", "latest"}, s) {}
+    drop_policy_e policy() const { return (drop_policy_e)choice; } };
 
 #ifdef CONFIG_IDF_TARGET_ESP32S3
 #define DEF_SSID "pypilot_mfd"
@@ -68,6 +72,8 @@ struct ChoiceLogLevel : SettingsChoice { ChoiceLogLevel(const char *s) :
     X(bool, input_usb, false)                   \
     X(bool, output_usb, true)                   \
     X(int, usb_baud_rate, 115200)               \
+    X(std::string, nmea_output_intervals, "")   \
+    X(int, nmea_wifi_rate, 0)                   \
     \
     X(bool, input_nmea_pypilot, false)                  \
     X(bool, output_nmea_pypilot, false)                 \
@@ -80,6 +86,11 @@ struct ChoiceLogLevel : SettingsChoice { ChoiceLogLevel(const char *s) :
     X(std::string, nmea_tcp_client_addr, "")            \
     X(int, nmea_tcp_client_port, 3000)                  \
     X(int, nmea_tcp_server_port, 7114)                  \
+    X(ChoiceDropPolicy, nmea_tcp_drop_policy, "oldest") \
+    X(bool, input_nmea_udp, false)                      \
+    X(bool, output_nmea_udp, false)                     \
+    X(std::string, nmea_udp_addr, "255.255.255.255")    \
+    X(int, nmea_udp_port, 10110)                        \
     X(bool, output_signalk, false)                      \
     X(bool, input_signalk, false)                       \
     \
@@ -87,6 +98,9 @@ struct ChoiceLogLevel : SettingsChoice { ChoiceLogLevel(const char *s) :
     \
     X(bool, compensate_wind_with_accelerometer, false)  \
     \
+    X(int, ais_max_targets, 100, 8, 128)                \
+    X(int, ais_target_timeout, 10, 1, 60)               \
+    \
     X(ChoiceLogLevel, loglevel, "warn")              \
     \
     X(std::string, pypilot_addr, "192.168.14.1")    \
@@ -0,0 +1,1073 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "settings.h"
+#include "display.h"
+#include "ais.h"
+#include "utils.h"
+
+// g++ -std=c++20 -O2 -g -DAIS_SHIPS_MAX=5000 -o testais testais.cpp ais.cpp utils.cpp && ./testais
+
+// stubs for what ais.cpp needs from the rest of the firmware
+settings_t settings;
+static int updates;
+void display_data_update(display_item_e item, float value, data_source_e source) { updates++; }
+static uint32_t virtual_millis = 1000;
+uint32_t millis() { return virtual_millis; }
+uint64_t esp_timer_get_time() { return 1000000; }
+static float own_lat = NAN, own_lon = NAN, own_sog = NAN, own_cog = NAN;
+bool display_data_get(display_item_e item, float &value)
+{
+    switch(item) {
+    case LATITUDE:    value = own_lat; break;
+    case LONGITUDE:   value = own_lon; break;
+    case GPS_SPEED:   value = own_sog; break;
+    case GPS_HEADING: value = own_cog; break;
+    default:          value = NAN;
+    }
+    return !isnan(value);
+}
+
+// count heap allocations made while decoding
+static int allocations;
+void *operator new(size_t size)
+{
+    allocations++;
+    return malloc(size);
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+// field conversions from ais.cpp
+float ais_rot(int rot);
+float ais_sog(int sog);
+float ais_cog(int cog);
+float ais_hdg(int hdg);
+float ais_ll(int n);
+
+// build payloads the way a transponder does
+struct ais_encoder {
+    uint8_t bits[256];
+    int len;
+
+    ais_encoder() : len(0) { memset(bits, 0, sizeof bits); }
+
+    void put(int32_t value, int n) {
+        for(int i=n-1; i>=0; i--, len++)
+            if(value >> i & 1)
+                bits[len/8] |= 0x80 >> len%8;
+    }
+
+    void text(const char *s, int chars) {
+        for(int i=0; i<chars; i++) {
+            int c = *s ? *s++ : '@';
+            put(c >= 64 ? c - 64 : c, 6);
+        }
+    }
+
+    // the sentences for this payload, at most 60 characters per fragment
+    void sentences(std::vector<std::string> &out, int id) {
+        char armor[256];
+        int n = 0;
+        for(int b=0; b<len; b+=6) {
+            int v = 0;
+            for(int i=0; i<6; i++)
+                v = v << 1 | (b+i < len && bits[(b+i)/8] & 0x80 >> (b+i)%8);
+            armor[n++] = v < 40 ? v + 48 : v + 56;
+        }
+        int count = (n + 59) / 60;
+        for(int f=0; f<count; f++) {
+            char line[128], seq[4] = "";
+            if(count > 1)
+                snprintf(seq, sizeof seq, "%d", id);
+            int chars = n - f*60 < 60 ? n - f*60 : 60;
+            snprintf(line, sizeof line, "!AIVDM,%d,%d,%s,A,%.*s,%d*00", count, f+1, seq,
+                     chars, armor + f*60, f == count-1 ? (6 - len%6) % 6 : 0);
+            out.push_back(line);
+        }
+    }
+};
+
+struct target {
+    int mmsi;
+    double lat, lon;
+    int sog, cog, hdg, rot, status, shiptype;
+    const char *name, *callsign, *destination;
+};
+
+static void position_report(ais_encoder &a, int type, const target &t)
+{
+    a.put(type, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(t.status, 4); a.put(t.rot, 8);
+    a.put(t.sog, 10); a.put(1, 1); a.put(lround(t.lon*600000), 28); a.put(lround(t.lat*600000), 27);
+    a.put(t.cog, 12); a.put(t.hdg, 9); a.put(30, 6); a.put(0, 2); a.put(0, 3); a.put(0, 1); a.put(0, 19);
+}
+
+static void static_report(ais_encoder &a, const target &t)
+{
+    a.put(5, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(0, 2); a.put(9074729, 30);
+    a.text(t.callsign, 7); a.text(t.name, 20); a.put(t.shiptype, 8);
+    a.put(120, 9); a.put(30, 9); a.put(10, 6); a.put(12, 6); a.put(1, 4);
+    a.put(5, 4); a.put(17, 5); a.put(6, 5); a.put(30, 6); a.put(85, 8);
+    a.text(t.destination, 20); a.put(0, 1); a.put(0, 1);
+}
+
+static void class_b_report(ais_encoder &a, const target &t)
+{
+    a.put(18, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(0, 8);
+    a.put(t.sog, 10); a.put(1, 1); a.put(lround(t.lon*600000), 28); a.put(lround(t.lat*600000), 27);
+    a.put(t.cog, 12); a.put(t.hdg, 9); a.put(30, 6); a.put(0, 2);
+    a.put(1, 1); a.put(0, 1); a.put(1, 1); a.put(1, 1); a.put(1, 1); a.put(0, 1); a.put(0, 20);
+}
+
+static void class_b_extended(ais_encoder &a, const target &t)
+{
+    a.put(19, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(0, 8);
+    a.put(t.sog, 10); a.put(1, 1); a.put(lround(t.lon*600000), 28); a.put(lround(t.lat*600000), 27);
+    a.put(t.cog, 12); a.put(t.hdg, 9); a.put(30, 6); a.put(0, 4);
+    a.text(t.name, 20); a.put(t.shiptype, 8);
+    a.put(12, 9); a.put(3, 9); a.put(2, 6); a.put(2, 6); a.put(1, 4); a.put(0, 1); a.put(0, 1); a.put(0, 4);
+}
+
+static void static_b(ais_encoder &a, const target &t, int part)
+{
+    a.put(24, 6); a.put(0, 2); a.put(t.mmsi, 30); a.put(part, 2);
+    if(part == 0)
+        a.text(t.name, 20);
+    else {
+        a.put(t.shiptype, 8); a.text("ABC", 3); a.put(0, 4); a.put(0, 20);
+        a.text(t.callsign, 7); a.put(9, 9); a.put(3, 9); a.put(2, 6); a.put(2, 6); a.put(0, 6);
+    }
+}
+
+static const target targets[] = {
+    {366123456, 37.80801, -122.41234, 123, 2711, 270, -45, 0, 70, "EVER GIVEN", "HPEX", "SAN FRANCISCO"},
+    {211234560, -33.85678, 151.21501, 0, 3600, 511, -128, 5, 36, "SEA BREEZE", "DA1234", "SYDNEY"},
+    {503999001, 0.00001, -0.00001, 1022, 1, 359, 127, 8, 37, "", "", ""},
+};
+
+// the decoded target, or an empty one with mmsi 0 when it is not in the table
+static ship &target_ship(int mmsi)
+{
+    static ship none;
+    ship *s = ais_find_ship(mmsi);
+    return s ? *s : none = ship();
+}
+
+#define CHECK(x) if(!(x)) { printf("FAILED %s:%d %s\n", __FILE__, __LINE__, #x); failures++; }
+
+static bool near(float a, float b, float eps=1e-4) { return fabsf(a - b) < eps; }
+
+static bool parse_all(const std::vector<std::string> &lines)
+{
+    bool result = true;
+    for(const std::string &line : lines)
+        result = ais_parse_line(line.c_str(), USB_DATA);
+    return result;
+}
+
+static int check_position(const target &t)
+{
+    int failures = 0;
+    ship &s = target_ship(t.mmsi);
+    CHECK(s.mmsi == t.mmsi);
+    CHECK(near(s.lat, t.lat));
+    CHECK(near(s.lon, t.lon));
+    CHECK(t.sog == 1023 ? isnan(s.sog) : near(s.sog, t.sog / 10.0f));
+    CHECK(t.cog == 3600 ? isnan(s.cog) : near(s.cog, t.cog / 10.0f));
+    return failures;
+}
+
+// every field of each message type comes out as it went in
+static int test_decode()
+{
+    int failures = 0;
+    for(const target &t : targets) {
+        for(int type=1; type<=3; type++) {
+            ships_count = 0;
+            ais_encoder a;
+            position_report(a, type, t);
+            std::vector<std::string> lines;
+            a.sentences(lines, 0);
+            CHECK(parse_all(lines));
+            failures += check_position(t);
+            ship &s = target_ship(t.mmsi);
+            CHECK(s.status == t.status);
+            CHECK(t.rot == -128 ? isnan(s.rot) : near(s.rot, ais_rot(t.rot)));
+        }
+
+        ais_encoder a5;
+        static_report(a5, t);
+        std::vector<std::string> lines;
+        a5.sentences(lines, 3);
+        CHECK(lines.size() == 2);
+        CHECK(parse_all(lines));
+        ship &s = target_ship(t.mmsi);
+        CHECK(ais_text(s.callsign, 7) == t.callsign);
+        CHECK(ais_text(s.name, 20) == t.name);
+        CHECK(ais_text(s.destination, 20) == t.destination);
+        CHECK(s.shiptype == t.shiptype);
+        CHECK(s.to_bow == 120 && s.to_stern == 30 && s.to_port == 10 && s.to_starboard == 12);
+        CHECK(s.draught == 85);
+
+        ships_count = 0;
+        ais_encoder a18;
+        class_b_report(a18, t);
+        lines.clear();
+        a18.sentences(lines, 0);
+        CHECK(parse_all(lines));
+        failures += check_position(t);
+        CHECK(t.hdg == 511 ? isnan(target_ship(t.mmsi).hdg) : near(target_ship(t.mmsi).hdg, t.hdg));
+
+        ships_count = 0;
+        ais_encoder a19;
+        class_b_extended(a19, t);
+        lines.clear();
+        a19.sentences(lines, 4);
+        CHECK(parse_all(lines));
+        failures += check_position(t);
+        ship &s19 = target_ship(t.mmsi);
+        CHECK(ais_text(s19.name, 20) == t.name);
+        CHECK(s19.shiptype == t.shiptype);
+        CHECK(s19.to_bow == 12 && s19.to_stern == 3 && s19.to_port == 2 && s19.to_starboard == 2);
+
+        for(int part=0; part<2; part++) {
+            ais_encoder a24;
+            static_b(a24, t, part);
+            lines.clear();
+            a24.sentences(lines, 0);
+            CHECK(parse_all(lines));
+        }
+        ship &s24 = target_ship(t.mmsi);
+        CHECK(ais_text(s24.name, 20) == t.name);
+        CHECK(ais_text(s24.callsign, 7) == t.callsign);
+        CHECK(s24.shiptype == t.shiptype);
+        CHECK(s24.to_bow == 9 && s24.to_stern == 3);
+    }
+
+    // a message whose last fragment was lost does not corrupt the next one
+    ships_count = 0;
+    ais_encoder a5;
+    static_report(a5, targets[0]);
+    std::vector<std::string> lines;
+    a5.sentences(lines, 5);
+    ais_parse_line(lines[0].c_str(), USB_DATA);
+    CHECK(parse_all(lines));
+    CHECK(ships_count == 1 && ais_text(target_ship(targets[0].mmsi).name, 20) == targets[0].name);
+
+    CHECK(!ais_parse_line("!AIVDM,1,1,,A,1~~~~,0*00", USB_DATA));
+    return failures;
+}
+
+static void static_lines(std::vector<std::string> &lines, const target &t, int id, char channel='A')
+{
+    ais_encoder a;
+    static_report(a, t);
+    a.sentences(lines, id);
+    if(channel != 'A')
+        for(std::string &line : lines)
+            line[line.find(",A,")+1] = channel;
+}
+
+// multi-part messages interleaved on one channel, out of order and lost
+static int test_reassembly()
+{
+    int failures = 0;
+    ships_count = 0;
+
+    // three type 5 messages interleaved on channel A and one on B
+    std::vector<std::string> a, b, c, d;
+    static_lines(a, targets[0], 1);
+    static_lines(b, targets[1], 2);
+    static_lines(c, targets[2], 3);
+    target other = targets[0];
+    other.mmsi++;
+    other.name = "OTHER";
+    static_lines(d, other, 1, 'B');
+    const std::string *order[] = {&a[0], &b[0], &d[0], &c[0], &b[1], &a[1], &d[1], &c[1]};
+    for(const std::string *line : order)
+        CHECK(ais_parse_line(line->c_str(), USB_DATA));
+    CHECK(ships_count == 4);
+    CHECK(ais_text(target_ship(targets[0].mmsi).name, 20) == targets[0].name);
+    CHECK(ais_text(target_ship(targets[1].mmsi).name, 20) == targets[1].name);
+    CHECK(ais_text(target_ship(targets[2].mmsi).callsign, 7) == targets[2].callsign);
+    CHECK(ais_text(target_ship(other.mmsi).name, 20) == "OTHER");
+
+    // a second part without its first, or repeated, is orphaned
+    ships_count = 0;
+    CHECK(!ais_parse_line(a[1].c_str(), USB_DATA));
+    CHECK(ais_parse_line(a[0].c_str(), USB_DATA));
+    CHECK(ais_parse_line(a[1].c_str(), USB_DATA));
+    CHECK(!ais_parse_line(a[1].c_str(), USB_DATA));
+    CHECK(ships_count == 1);
+
+    // a partial message times out rather than joining a late fragment
+    ships_count = 0;
+    CHECK(ais_parse_line(b[0].c_str(), USB_DATA));
+    virtual_millis += 5000;
+    CHECK(!ais_parse_line(b[1].c_str(), USB_DATA));
+    CHECK(!ships_count);
+
+    // more partial messages than slots loses only the oldest
+    std::vector<std::string> many[6];
+    for(int i=0; i<6; i++) {
+        target t = targets[0];
+        t.mmsi += 10 + i;
+        static_lines(many[i], t, i);
+        ais_parse_line(many[i][0].c_str(), USB_DATA);
+        virtual_millis++;
+    }
+    for(int i=0; i<6; i++)
+        CHECK(ais_parse_line(many[i][1].c_str(), USB_DATA) == (i >= 2));
+    CHECK(ships_count == 4);
+    return failures;
+}
+
+static void report(int mmsi, double lat, double lon, int sog=123, int cog=2711)
+{
+    target t = targets[0];
+    t.mmsi = mmsi;
+    t.lat = lat;
+    t.lon = lon;
+    t.sog = sog;
+    t.cog = cog;
+    ais_encoder a;
+    position_report(a, 1, t);
+    std::vector<std::string> lines;
+    a.sentences(lines, 0);
+    parse_all(lines);
+}
+
+// the table stays sorted, bounded and drops stale then far targets
+static int test_table()
+{
+    int failures = 0;
+    ships_count = 0;
+    settings.ais_max_targets = 8;
+    settings.ais_target_timeout = 1;
+    own_lat = own_lon = NAN;
+
+    int mmsis[] = {5, 3, 9, 1, 7, 2, 8, 4};
+    for(int i=0; i<8; i++) {
+        report(mmsis[i], 10, 10 + i*0.01);
+        virtual_millis += 1000;
+    }
+    CHECK(ships_count == 8);
+    for(int i=1; i<ships_count; i++)
+        CHECK(ships[i-1].mmsi < ships[i].mmsi);
+
+    // full, the one not heard from the longest goes
+    report(6, 10, 10);
+    CHECK(ships_count == 8);
+    CHECK(!ais_find_ship(5) && ais_find_ship(6) && ais_find_ship(3));
+    for(int i=1; i<ships_count; i++)
+        CHECK(ships[i-1].mmsi < ships[i].mmsi);
+
+    // with our position known the farthest goes
+    own_lat = 10, own_lon = 10;
+    report(2, 11, 10); // 60 miles away
+    report(10, 10, 10);
+    CHECK(!ais_find_ship(2) && ais_find_ship(10) && ais_find_ship(3));
+
+    // targets not heard within the timeout expire
+    virtual_millis += 50000;
+    report(1, 10, 10);
+    virtual_millis += 20000;
+    ais_expire();
+    CHECK(ships_count == 1 && ships[0].mmsi == 1);
+
+    // lowering the capacity trims the table
+    for(int i=0; i<8; i++)
+        report(100 + i, 10, 10 + i*0.1);
+    settings.ais_max_targets = 4;
+    virtual_millis += 1000;
+    ais_expire();
+    CHECK(ships_count == 4 && ais_find_ship(1) && ais_find_ship(100) && !ais_find_ship(107));
+
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+    settings.ais_target_timeout = 60;
+    own_lat = own_lon = NAN;
+    return failures;
+}
+
+// a target record is small and decoding touches the heap only for new lines
+static int test_record()
+{
+    int failures = 0;
+    CHECK(sizeof(ship) <= 96);
+
+    std::vector<std::string> lines;
+    for(int type : {1, 5, 18, 19, 24}) {
+        ais_encoder a;
+        if(type == 1) position_report(a, 1, targets[0]);
+        if(type == 5) static_report(a, targets[0]);
+        if(type == 18) class_b_report(a, targets[0]);
+        if(type == 19) class_b_extended(a, targets[0]);
+        if(type == 24) static_b(a, targets[0], 1);
+        a.sentences(lines, 7);
+    }
+    parse_all(lines);
+    int before = allocations;
+    CHECK(parse_all(lines));
+    CHECK(allocations == before);
+    return failures;
+}
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// closest approach of simple encounters, recomputed only when something moved
+static int test_cpa()
+{
+    int failures = 0;
+    ships_count = 0;
+    own_lat = 10, own_lon = 10, own_sog = 0, own_cog = 0;
+    double mile = 1 / 60.0;
+
+    report(1, 10 + mile, 10, 100, 1800);  // a mile north heading south at 10 knots
+    report(2, 10, 10 + mile/cos(deg2rad(10)), 100, 0); // a mile east heading north
+    report(3, 10 - mile, 10, 100, 1800);  // a mile south going away
+    report(4, 10 + 2*mile, 10);           // static data only below
+    ais_encoder a;
+    target t = targets[0];
+    t.mmsi = 5;
+    static_report(a, t);
+    std::vector<std::string> lines;
+    a.sentences(lines, 1);
+    parse_all(lines);
+
+    CHECK(ais_compute_cpa() == 4);
+    ship &s1 = target_ship(1), &s2 = target_ship(2), &s3 = target_ship(3);
+    CHECK(near(s1.cpa, 0, 1e-3) && near(s1.tcpa(), 360, 1) && near(s1.dist, 1, 1e-3));
+    CHECK(near(s2.cpa, 1, 1e-3) && near(s2.tcpa(), 0, 1));
+    CHECK(near(s3.cpa, 0, 1e-3) && near(s3.tcpa(), -360, 1));
+    CHECK(isnan(target_ship(5).cpa) && isnan(target_ship(5).tcpa()));
+
+    // nothing changed
+    CHECK(ais_compute_cpa() == 0);
+
+    // a target's new position 18 seconds later
+    virtual_millis += 18000;
+    report(1, 10 + mile/2, 10, 100, 1800);
+    CHECK(ais_compute_cpa() == 1);
+    CHECK(near(target_ship(1).tcpa(), 180, 1));
+
+    // our own movement changes every target
+    own_sog = 10;
+    CHECK(ais_compute_cpa() == 4);
+    CHECK(near(target_ship(1).tcpa(), 90, 1));
+
+    // and counts down between them
+    virtual_millis += 30000;
+    CHECK(ais_compute_cpa() == 0);
+    CHECK(near(target_ship(1).tcpa(), 60, 1));
+
+    // our position lost
+    own_lat = NAN;
+    CHECK(ais_compute_cpa() == 0);
+    CHECK(isnan(target_ship(1).cpa));
+
+    own_lat = own_lon = own_sog = own_cog = NAN;
+    return failures;
+}
+
+// brute force answer for the grid queries
+static std::vector<int> scan_within(float lat, float lon, float range)
+{
+    std::vector<int> result;
+    for(int i=0; i<ships_count; i++)
+        if(ships[i].timestamp && hypotf(ships[i].simple_x(lon), ships[i].simple_y(lat)) <= range)
+            result.push_back(i);
+    return result;
+}
+
+static int check_queries(float lat, float lon)
+{
+    int failures = 0;
+    static int found[AIS_SHIPS_MAX];
+    for(float range : {0.5f, 2.0f, 10.0f, 100.0f, 5000.0f}) {
+        int n = ais_within(lat, lon, range, found);
+        std::vector<int> got(found, found + n);
+        std::sort(got.begin(), got.end());
+        CHECK(got == scan_within(lat, lon, range));
+    }
+
+    for(float range : {0.5f, 3.0f, 10800.0f})
+        for(bool moving : {false, true}) {
+            int n = ais_closest(lat, lon, range, 5, found, moving);
+            std::vector<std::pair<float, int>> all;
+            for(int i=0; i<ships_count; i++) {
+                float d = hypotf(ships[i].simple_x(lon), ships[i].simple_y(lat));
+                if(ships[i].timestamp && d <= range && (!moving || ships[i].sog > 0))
+                    all.push_back({d, i});
+            }
+            std::sort(all.begin(), all.end());
+            CHECK(n == (int)std::min<size_t>(5, all.size()));
+            for(int j=0; j<n && j<(int)all.size(); j++)
+                CHECK(near(hypotf(ships[found[j]].simple_x(lon), ships[found[j]].simple_y(lat)), all[j].first));
+        }
+    return failures;
+}
+
+// range and nearest queries agree with a scan of the table as targets move
+static int test_grid()
+{
+    int failures = 0;
+    ships_count = 0;
+    settings.ais_max_targets = 100;
+
+    srand(1);
+    struct { float lat, lon; } places[] = {{37.8, -122.4}, {0, 179.99}, {0, -179.99}, {78, 15}};
+    for(int i=0; i<100; i++) {
+        float lat = places[i % 4].lat + (rand() % 2000 - 1000) * 1e-4f;
+        float lon = places[i % 4].lon + (rand() % 2000 - 1000) * 1e-4f;
+        report(1000 + i, lat, lon);
+    }
+    for(auto &p : places)
+        failures += check_queries(p.lat, p.lon);
+
+    // move some without adding any, then add and remove
+    for(int i=0; i<100; i+=3)
+        report(1000 + i, places[i % 4].lat + 0.05f, places[i % 4].lon);
+    for(auto &p : places)
+        failures += check_queries(p.lat, p.lon);
+
+    report(5000, 37.8, -122.4);
+    virtual_millis += 2000;
+    ais_expire();
+    report(5001, 37.81, -122.41);
+    for(auto &p : places)
+        failures += check_queries(p.lat, p.lon);
+
+    static int found[AIS_SHIPS_MAX];
+    CHECK(ais_closest(37.8, -122.4, 10800, 1, found, false) == 1 && ships[found[0]].mmsi == 5000);
+
+    // the nearest moving target skips one that has stopped
+    report(5000, 37.8, -122.4, 0);
+    CHECK(ais_closest(37.8, -122.4, 10800, 1, found, true) == 1 && ships[found[0]].mmsi != 5000);
+    for(auto &p : places)
+        failures += check_queries(p.lat, p.lon);
+    CHECK(ais_within(NAN, 0, 10, found) == 0);
+
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+    return failures;
+}
+
+// the targets shown on the ais page at each range with all of them
+// within 12 miles, from the grid or a scan
+static void bench_grid()
+{
+    for(int count : {1000, 5000}) {
+        ships_count = 0;
+        settings.ais_max_targets = count;
+        srand(2);
+        for(int i=0; i<count; i++)
+            report(i + 1, 37.8 + (rand() % 4000 - 2000) * 1e-4f, -122.4 + (rand() % 4000 - 2000) * 1e-4f);
+        static int found[AIS_SHIPS_MAX];
+        for(float range : {0.5f, 2.0f, 10.0f}) {
+            const int passes = 2000;
+            int n = 0;
+            double t0 = now();
+            for(int p=0; p<passes; p++)
+                n = ais_within(37.8, -122.4, range, found);
+            double grid = (now() - t0) / passes;
+            t0 = now();
+            for(int p=0; p<passes; p++)
+                scan_within(37.8, -122.4, range);
+            double scan = (now() - t0) / passes;
+            printf("grid %5d targets %4.1f miles: %4d found, grid %6.1f us, scan %6.1f us\n",
+                   count, range, n, grid*1e6, scan*1e6);
+        }
+    }
+    ships_count = 0;
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+}
+
+static int trail_length(const ship &s)
+{
+    float lat, lon;
+    int k = 0;
+    while(ais_trail_point(s, k, lat, lon))
+        k++;
+    return k;
+}
+
+// trails are thinned, wrap, and go to the nearest targets when short
+static int test_trails()
+{
+    int failures = 0;
+    ships_count = 0;
+    settings.ais_max_targets = 128;
+    settings.ais_target_timeout = 60;
+    own_lat = 10, own_lon = 10;
+
+    // north at 10 knots reporting every 10 seconds for 10 minutes
+    double lat = 10;
+    for(int i=0; i<60; i++) {
+        report(1, lat, 10, 100, 0);
+        report(2, 10.1, 10, 0, 0); // at anchor
+        virtual_millis += 10000;
+        lat += 10 / 360.0 / 60;
+    }
+    ship &s = target_ship(1);
+    CHECK(trail_length(s) == 16);
+    float plat, plon, qlat, qlon;
+    CHECK(ais_trail_point(s, 0, plat, plon) && (s.lat - plat) * 60 < .1f && near(plon, 10, 1e-5f));
+    for(int k=1; k<16; k++) {
+        CHECK(ais_trail_point(s, k, qlat, qlon));
+        CHECK(qlat < plat && (plat - qlat) * 60 >= .05f); // older points further south
+        plat = qlat;
+    }
+    CHECK(trail_length(target_ship(2)) == 1);
+
+    // more targets than trails, the nearest keep theirs, a trail
+    // changes hands at most once a second
+    for(int i=0; i<100; i++, virtual_millis += 1000)
+        report(100 + i, 10 + (i + 1) * 1e-3, 10, 100, 0);
+    virtual_millis += 60000;
+    for(int i=0; i<100; i++, virtual_millis += 1000)
+        report(100 + i, 10 + (i + 1) * 1e-3 + 1e-3, 10, 100, 0);
+    int with = 0;
+    for(int i=0; i<100; i++)
+        with += trail_length(target_ship(100 + i)) > 0;
+    CHECK(with <= 64 && with >= 60);
+    CHECK(trail_length(target_ship(100)) == 2);
+    CHECK(trail_length(target_ship(199)) == 0);
+
+    // drawing a trail does not allocate
+    int before = allocations;
+    for(int i=0; i<ships_count; i++)
+        trail_length(ships[i]);
+    CHECK(allocations == before);
+
+    // points older than an hour are not shown
+    virtual_millis += 3601 * 1000;
+    CHECK(trail_length(target_ship(100)) == 0);
+
+    own_lat = own_lon = NAN;
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+    return failures;
+}
+
+// brute force answer for the threat queries
+static std::vector<int> scan_threats(float cpa)
+{
+    std::vector<std::pair<float, int>> all;
+    for(int i=0; i<ships_count; i++)
+        if(ships[i].tcpa() >= 0 && ships[i].cpa < cpa && virtual_millis - ships[i].timestamp <= 5*60*1000)
+            all.push_back({ships[i].tcpa(), i});
+    std::sort(all.begin(), all.end());
+    std::vector<int> result;
+    for(auto &a : all)
+        result.push_back(a.second);
+    return result;
+}
+
+static int check_threats(float cpa)
+{
+    int failures = 0;
+    ais_compute_cpa();
+    std::vector<int> expected = scan_threats(cpa);
+    ship *s = ais_threat(cpa);
+    CHECK(expected.empty() ? !s : s && s->cpa_time == ships[expected[0]].cpa_time);
+
+    static int found[AIS_SHIPS_MAX];
+    int n = ais_threats_top(cpa, found, 10);
+    CHECK(n == (int)std::min<size_t>(10, expected.size()));
+    for(int j=0; j<n; j++)
+        CHECK(ships[found[j]].cpa_time == ships[expected[j]].cpa_time);
+
+    std::vector<int> any = scan_threats(INFINITY);
+    CHECK(ais_soonest_tcpa() == (any.empty() ? INFINITY : ships[any[0]].tcpa()));
+    return failures;
+}
+
+// the threat heap follows targets as they move, appear and go quiet
+static int test_threats()
+{
+    int failures = 0;
+    ships_count = 0;
+    settings.ais_max_targets = 200;
+    settings.ais_target_timeout = 60;
+    own_lat = 10, own_lon = 10, own_sog = 5, own_cog = 90;
+
+    srand(3);
+    auto random_report = [](int mmsi) {
+        report(mmsi, 10 + (rand() % 2000 - 1000) * 1e-4f, 10 + (rand() % 2000 - 1000) * 1e-4f,
+               rand() % 200, rand() % 3600);
+    };
+    for(int i=0; i<150; i++)
+        random_report(100 + i);
+    failures += check_threats(2);
+
+    for(int round=0; round<20; round++) {
+        virtual_millis += 1000;
+        for(int i=0; i<10; i++)
+            random_report(100 + rand() % 150);
+        failures += check_threats(2);
+    }
+    failures += check_threats(0.5);  // a new limit
+
+    // the soonest passes its closest approach and drops off the top
+    ship *first = ais_threat(0.5);
+    CHECK(first && first->tcpa() < 60);
+    if(first) {
+        int mmsi = first->mmsi;
+        virtual_millis += first->tcpa() * 1000 + 1000;
+        failures += check_threats(0.5);
+        ship *next = ais_threat(0.5);
+        CHECK(!next || next->mmsi != mmsi);
+    }
+    own_cog = 180;                     // our own course changes every result
+    failures += check_threats(0.5);
+
+    // targets without a position for five minutes are left out
+    for(int i=0; i<50; i++) {
+        virtual_millis += 10000;
+        random_report(100 + i);
+    }
+    failures += check_threats(2);
+    virtual_millis += 270000;
+    failures += check_threats(2);
+    own_cog = 90;                      // recomputed, the quiet ones stay out
+    failures += check_threats(2);
+    random_report(99);                 // added
+    failures += check_threats(2);
+
+    CHECK(ais_threat(2));
+    own_lat = own_lon = own_sog = own_cog = NAN;
+    ais_compute_cpa();
+    CHECK(!ais_threat(2));
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+    return failures;
+}
+
+// the alarm check from the heap or scanning every target, as targets report
+static void bench_threats()
+{
+    for(int count : {1000, 5000}) {
+        ships_count = 0;
+        settings.ais_max_targets = count;
+        own_lat = 10, own_lon = 10, own_sog = 5, own_cog = 90;
+        srand(4);
+        for(int i=0; i<count; i++)
+            report(i + 1, 10 + (rand() % 4000 - 2000) * 1e-4f, 10 + (rand() % 4000 - 2000) * 1e-4f,
+                   rand() % 200, rand() % 3600);
+        ais_compute_cpa();
+
+        const int passes = 2000;
+        double t0 = now();
+        ship *threat = NULL;
+        for(int p=0; p<passes; p++) {
+            ships[p * 7919 % count].timestamp++; // a target reports
+            ais_compute_cpa();
+            threat = ais_threat(1);
+        }
+        double heap = (now() - t0) / passes;
+
+        t0 = now();
+        float soonest = INFINITY;
+        for(int p=0; p<passes; p++) {
+            ships[p * 7919 % count].timestamp++;
+            ais_compute_cpa();
+            soonest = INFINITY;
+            for(int i=0; i<ships_count; i++)
+                if(ships[i].tcpa() >= 0 && ships[i].cpa < 1 && ships[i].tcpa() < soonest &&
+                   virtual_millis - ships[i].timestamp <= 5*60*1000)
+                    soonest = ships[i].tcpa();
+        }
+        double scan = (now() - t0) / passes;
+        printf("threats %5d targets: heap %6.2f us, scan %6.2f us, soonest %.0f s %s\n", count,
+               heap*1e6, scan*1e6, soonest, (threat ? threat->tcpa() : INFINITY) == soonest ? "agree" : "DISAGREE");
+    }
+    ships_count = 0;
+    own_lat = own_lon = own_sog = own_cog = NAN;
+    settings.ais_max_targets = AIS_SHIPS_MAX;
+}
+
+// ship::compute as it was, one target at a time from its record
+static void legacy_compute(ship &s, float slat, float slon, float ssog, float scog, uint32_t t0)
+{
+    float dt = (t0 - s.timestamp) / 1000.0f;
+    float x = s.simple_x(slon);
+    float y = s.simple_y(slat);
+    s.dist = hypot(x, y);
+    float rcog = deg2rad(s.cog), rscog = deg2rad(scog);
+    float bvx = ssog*sinf(rscog), bvy = ssog*cosf(rscog);
+    float avx = s.sog*sinf(rcog), avy = s.sog*cosf(rcog);
+    x += avx*dt;
+    y += avy*dt;
+    float vx = avx - bvx, vy = avy - bvy;
+    float v2 = (vx*vx + vy*vy), t;
+    if(v2 < 1e-4)
+        t = 0;
+    else
+        t = (vx*x + vy*y)/v2;
+    s.cpa = hypotf(t*vx - x, t*vy - y);
+    s.cpa_time = t0 + int32_t(t * 3600000);
+}
+
+// the cpa pass over many targets, all of them or only those that moved
+static void bench_cpa()
+{
+    for(int count : {100, 1000, 5000}) {
+        ships_count = count;
+        for(int i=0; i<count; i++) {
+            ship &s = ships[i];
+            s = ship();
+            s.mmsi = i + 1;
+            s.lat = 10 + (i % 100 - 50) * 1e-3;
+            s.lon = 10 + (i / 100 - 25) * 1e-3;
+            s.sog = i % 20;
+            s.cog = i * 37 % 360;
+            s.timestamp = virtual_millis - i % 1000;
+        }
+        own_lat = 10, own_lon = 10, own_sog = 6, own_cog = 45;
+
+        const int passes = 1000;
+        double t0 = now();
+        for(int p=0; p<passes; p++)
+            for(int i=0; i<count; i++)
+                legacy_compute(ships[i], 10 + p * 1e-6, 10, 6, 45, virtual_millis);
+        double legacy = (now() - t0) / passes;
+
+        t0 = now();
+        for(int p=0; p<passes; p++) {
+            own_lat = 10 + p * 1e-6; // a new fix every pass
+            ais_compute_cpa();
+        }
+        double full = (now() - t0) / passes;
+
+        // one target in a hundred reports between passes
+        int computed = 0;
+        t0 = now();
+        for(int p=0; p<passes; p++) {
+            for(int i=p % 100; i<count; i+=100)
+                ships[i].timestamp++;
+            computed += ais_compute_cpa();
+        }
+        double moved = (now() - t0) / passes;
+        printf("cpa %5d targets: per ship %7.1f us, batch %7.1f us, 1%% moved %6.1f us (%d computed)\n",
+               count, legacy*1e6, full*1e6, moved*1e6, computed / passes);
+    }
+    ships_count = 0;
+    own_lat = own_lon = own_sog = own_cog = NAN;
+}
+
+// the std::vector<bool> decoder ais.cpp used before, kept to compare speed
+static std::vector<bool> legacy_data;
+struct legacy_ship {
+    int mmsi;
+    uint32_t timestamp;
+    std::string status;
+    float lat, lon, sog, cog, hdg, rot;
+    std::string name, callsign, shiptype;
+    int to_bow, to_stern, to_port, to_starboard;
+    int draught;
+    std::string destination;
+    float cpa, tcpa, dist;
+};
+static std::map<int, legacy_ship> legacy_ships;
+
+static int legacy_n(std::vector<bool> &data, int start, int len, bool sign=false)
+{
+    if(data.size() < (size_t)(start+len))
+        return 0;
+    bool negative = false;
+    if (sign) {
+        if (data[start])
+            negative = true;
+        start++;
+        len--;
+    }
+
+    int result = 0;
+    for(int i=0; i<len; i++)
+        if(data[start+i] != negative)
+            result |= (1<<(len-i-1));
+
+    if(negative) // 2's compliment
+        result = -(result + 1);
+
+    return result;
+}
+
+static std::string legacy_t(std::vector<bool> &data, int start, int len) {
+    std::string result = "";
+    for(int i=0; i<len; i+=6) {
+        char d = legacy_n(data, start+i, 6);
+        if( d == 0 )
+            break;
+        if( d <= 31)
+            d += 64;
+        result += d;
+    }
+    return result;
+}
+
+static bool legacy_decode(std::vector<bool> &data)
+{
+    int message_type = legacy_n(data, 0, 6);
+    int mmsi = legacy_n(data, 8, 30);
+    legacy_ship &s = legacy_ships[mmsi];
+    s.mmsi = mmsi;
+    if(message_type >=1 && message_type <=3) {
+        s.status = ais_status(legacy_n(data, 38, 4));
+        s.rot = ais_rot(legacy_n(data, 42, 8, true));
+        s.sog = ais_sog(legacy_n(data, 50, 10));
+        s.lon = ais_ll(legacy_n(data, 61, 28, true));
+        s.lat = ais_ll(legacy_n(data, 89, 27, true));
+        s.cog = ais_cog(legacy_n(data, 116, 12));
+        s.timestamp = millis();
+    } else if(message_type == 5) {
+        s.callsign = legacy_t(data, 70, 42);
+        s.name = legacy_t(data, 112, 120);
+        s.shiptype = ais_e(legacy_n(data, 232, 8));
+        s.to_bow = legacy_n(data, 240, 9);
+        s.to_stern = legacy_n(data, 249, 9);
+        s.to_port = legacy_n(data, 258, 6);
+        s.to_starboard = legacy_n(data, 264, 6);
+        s.draught = legacy_n(data, 294, 8);
+        s.destination = legacy_t(data, 302, 120);
+    } else if(message_type == 18) {
+        s.sog = ais_sog(legacy_n(data, 46, 10));
+        s.lon = ais_ll(legacy_n(data, 57, 28, true));
+        s.lat = ais_ll(legacy_n(data, 85, 27, true));
+        s.cog = ais_cog(legacy_n(data, 112, 12));
+        s.hdg = ais_hdg(legacy_n(data, 124, 9));
+        s.timestamp = millis();
+    } else if(message_type == 19) {
+        s.sog = ais_sog(legacy_n(data, 46, 10));
+        s.lon = ais_ll(legacy_n(data, 57, 28, true));
+        s.lat = ais_ll(legacy_n(data, 85, 27, true));
+        s.cog = ais_cog(legacy_n(data, 112, 12));
+        s.hdg = ais_hdg(legacy_n(data, 124, 9));
+        s.name = legacy_t(data, 143, 120);
+        s.shiptype = ais_e(legacy_n(data, 263, 8));
+        s.to_bow = legacy_n(data, 271, 9);
+        s.to_stern = legacy_n(data, 280, 9);
+        s.to_port = legacy_n(data, 289, 6);
+        s.to_starboard = legacy_n(data, 295, 6);
+        s.timestamp = millis();
+    } else if(message_type == 24) {
+        int part_num = legacy_n(data, 38, 2);
+        if(part_num == 0)
+            s.name = legacy_t(data, 40, 120);
+        else if(part_num == 1) {
+            s.shiptype = ais_e(legacy_n(data, 40, 8));
+            s.callsign = legacy_t(data, 90, 42);
+            s.to_bow = legacy_n(data, 132, 9);
+            s.to_stern = legacy_n(data, 141, 9);
+            s.to_port = legacy_n(data, 150, 6);
+            s.to_starboard = legacy_n(data, 156, 6);
+        }
+    } else
+        return false;
+    return true;
+}
+
+static bool legacy_parse_line(const char *line, data_source_e source)
+{
+    int fragcount, fragindex;
+    if(sscanf(line+6, ",%d,%d,", &fragcount, &fragindex) != 2)
+        return false;
+    const char *l = line+6;
+    for(int commas = 0; commas < 5; l++)
+        commas += *l == ',';
+    const char *e = strchr(l, ',');
+    int len = e - l;
+
+    std::vector<bool> &data = legacy_data;
+    for(int i=0; i < len; i++) {
+        int d = l[i] - 48;
+        if(d > 40)
+            d -= 8;
+        for(int b=5; b>=0; b--)
+            if((1<<b) & d)
+                data.push_back(1);
+            else
+                data.push_back(0);
+    }
+
+    if(fragindex == fragcount) {
+        bool result = legacy_decode(data);
+        data.clear();
+        return result;
+    }
+    return true;
+}
+
+// a mix of every message type from many targets, as seen in a busy harbour
+static std::vector<std::string> corpus;
+static int corpus_messages;
+
+static void build_corpus()
+{
+    for(int i=0; i<1000; i++) {
+        target t = targets[i % 3];
+        t.mmsi += i % 96; // 96 targets
+        t.lat += i * 1e-3;
+        t.sog = i % 1000;
+        t.cog = i * 7 % 3600;
+        ais_encoder a;
+        switch(i % 8) {
+        case 0: case 1: case 2: position_report(a, i % 8 + 1, t); break;
+        case 3: static_report(a, t); break;
+        case 4: class_b_report(a, t); break;
+        case 5: class_b_extended(a, t); break;
+        default: static_b(a, t, i % 8 - 6); break;
+        }
+        a.sentences(corpus, i % 10);
+        corpus_messages++;
+    }
+}
+
+static void bench(const char *name, bool (*parse)(const char*, data_source_e))
+{
+    const int iterations = 200;
+    ships_count = 0;
+    legacy_ships.clear();
+    double t0 = now();
+    for(int i=0; i<iterations; i++)
+        for(const std::string &line : corpus)
+            parse(line.c_str(), USB_DATA);
+    double dt = now() - t0;
+    printf("%-8s %10.0f messages/s %6.0f ns per message\n", name,
+           iterations*corpus_messages/dt, dt*1e9/(iterations*corpus_messages));
+}
+
+int main()
+{
+    int failures = test_decode();
+    failures += test_reassembly();
+    failures += test_table();
+    failures += test_record();
+    failures += test_cpa();
+    failures += test_grid();
+    failures += test_threats();
+    failures += test_trails();
+    ais_print_stats();
+
+    build_corpus();
+    printf("corpus %d messages in %d sentences\n", corpus_messages, (int)corpus.size());
+    bench("vector", legacy_parse_line);
+    bench("packed", ais_parse_line);
+    bench_cpa();
+    bench_grid();
+    bench_threats();
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
@@ -0,0 +1,465 @@
+/* Copyright (C) 2026 Sean D'Epagnier <seandepagnier@gmail.com>
+ *
+ * This Program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ */
+
+// render typical pages at 10 frames a second from simulated sensors the way
+// display_poll does, redrawing only what changed, and report the pixels
+// cleared, drawn and sent each frame against redrawing the whole screen.
+// every so often the partial frame is checked against a full render.
+
+// display.cpp needs the firmware to build, so the pages are modelled here
+// with the same draw calls its text displays, gauges and history use
+
+// draw.cpp uses the fonts.h generated here for the firmware if there is one,
+// otherwise stub fonts generated into hostfonts, which need neither PIL nor
+// a font.ttf and are the same width tables on every host
+
+// mkdir -p hostfonts && python3 ../generate_font.py stub > hostfonts/fonts.h
+// g++ -std=c++20 -O2 -g -Ihostfonts -o testdirty testdirty.cpp draw.cpp && ./testdirty
+// g++ -std=c++20 -O2 -g -Ihostfonts -DUSE_JLX256160 -o testdirty testdirty.cpp draw.cpp && ./testdirty
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <list>
+#include <vector>
+
+#include "draw.h"
+
+extern uint8_t *framebuffer;
+
+#ifdef USE_JLX256160
+#define FRAMEBUFFER_SIZE (DRAW_LCD_H_RES*DRAW_LCD_V_RES/4)
+#else
+#define FRAMEBUFFER_SIZE (DRAW_LCD_H_RES*DRAW_LCD_V_RES)
+#endif
+
+// the simulation clock
+static uint64_t sim_ms;
+
+static uint64_t now_us()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static float noise()
+{
+    return (float)rand() / RAND_MAX * 2 - 1;
+}
+
+// sensors at the rates and with the jitter they are usually received
+enum sensor_e {AWA, AWS, HDG, SOG, COG, DEPTH, WTEMP, BARO, SENSOR_COUNT};
+
+struct sensor_t {
+    const char *label;
+    int digits, period_ms;
+    float mean, jitter, drift;
+    float value;
+    uint64_t next;
+};
+
+static sensor_t sensors[SENSOR_COUNT] = {
+    {"AWA",   0, 100,   40,   5,    .2},
+    {"AWS",   1, 100,   12,   .8,   .05},
+    {"HDG",   0, 100,   180,  1.5,  .1},
+    {"SOG",   1, 1000,  6.2,  .1,   .01},
+    {"COG",   0, 1000,  182,  1,    .05},
+    {"DEPTH", 1, 1000,  12.3, .05,  .01},
+    {"WTEMP", 1, 10000, 14.2, .05,  .001},
+    {"BARO",  1, 10000, 1013, .05,  .01},
+};
+
+// a second of history for each sensor, newest first like history.cpp
+struct history_point {
+    float value;
+    uint64_t time;
+};
+static std::list<history_point> history[SENSOR_COUNT];
+
+static void update_sensors()
+{
+    for(int i=0; i<SENSOR_COUNT; i++) {
+        sensor_t &s = sensors[i];
+        if(sim_ms < s.next)
+            continue;
+        s.next = sim_ms + s.period_ms;
+        s.mean += s.drift * noise();
+        s.value = s.mean + s.jitter * noise();
+
+        std::list<history_point> &h = history[i];
+        if(h.empty() || sim_ms - h.front().time >= 1000) {
+            h.push_front({s.value, sim_ms});
+            if(h.size() > 300)
+                h.pop_back();
+        }
+    }
+}
+
+static std::string sensor_text(int i)
+{
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.*f", sensors[i].digits, sensors[i].value);
+    return buf;
+}
+
+// fnv-1a as display.cpp hashes what each display shows
+static uint32_t shown_hash(const void *data, int len, uint32_t h = 2166136261u)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for(int i=0; i<len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t shown_hash(const std::string &str, uint32_t h = 2166136261u)
+{
+    return shown_hash(str.data(), str.size(), h);
+}
+
+// largest font at most ht tall the text fits w across
+static int fit_font(const std::string &str, int w, int ht)
+{
+    for(; ht > 0; ht--) {
+        int t = ht;
+        if(!draw_set_font(t))
+            return 0;
+        if(draw_text_width(str) < w)
+            return t;
+        ht = t;
+    }
+    return 0;
+}
+
+enum widget_e {TEXT, GAUGE, CLOCK, HISTORY, RINGS};
+
+struct widget {
+    widget_e type;
+    int sensor;
+    int x, y, w, h;
+    uint32_t shown;
+
+    uint32_t state() {
+        switch(type) {
+        case TEXT:
+        case GAUGE:
+            return shown_hash(sensor_text(sensor));
+        case CLOCK:
+        case RINGS: {
+            uint64_t s = sim_ms / 1000;
+            return shown_hash(&s, sizeof s);
+        }
+        case HISTORY: {
+            // the plot moves a pixel at a time
+            uint64_t scroll = sim_ms * w / 300000;
+            uint32_t h = shown_hash(sensor_text(sensor), shown_hash(&scroll, sizeof scroll));
+            if(!history[sensor].empty())
+                h = shown_hash(&history[sensor].front(), sizeof(history_point), h);
+            return h;
+        }
+        }
+        return 0;
+    }
+
+    void invalidate() {
+        uint32_t s = state();
+        if(s != shown)
+            draw_invalidate(x, y, w, h);
+        shown = s;
+    }
+
+    void render_text(const std::string &label, const std::string &str) {
+        int lh = h/5;
+        draw_color(GREY);
+        if(fit_font(label, w-2, lh))
+            draw_text(x+1, y+1, label);
+        int ht = fit_font(str, w-4, h-lh-4);
+        if(!ht)
+            return;
+        draw_color(WHITE);
+        draw_text(x + (w - draw_text_width(str))/2, y + lh + (h - lh - ht)/2, str);
+    }
+
+    void render_gauge() {
+        int r = (w < h ? w : h)/2 - 3, xc = x + w/2, yc = y + h/2;
+        draw_color(GREEN);
+        draw_circle(xc, yc, r, r/30+1);
+
+        draw_color(GREY);
+        for(int a=0; a<360; a+=45) {
+            float s = sinf(a*M_PI/180), c = cosf(a*M_PI/180);
+            int x0 = xc + (r-r/8)*s, y0 = yc - (r-r/8)*c;
+            int x1 = xc + (r-2)*s, y1 = yc - (r-2)*c;
+            int t = 2 + r/60;
+            draw_triangle(x1 - t*c, y1 - t*s, x0, y0, x1 + t*c, y1 + t*s);
+        }
+
+        std::string str = sensor_text(sensor);
+        float v = atof(str.c_str());
+        if(sensor == AWS || sensor == SOG)
+            v = v * 270 / 20 - 135; // speed scale
+        float s = sinf(v*M_PI/180), c = cosf(v*M_PI/180);
+        int u = 1 + w/30;
+        draw_color(RED);
+        draw_triangle(xc - u*c, yc - u*s, xc + (r-3)*s, yc - (r-3)*c, xc + u*c, yc + u*s);
+
+        int ht = fit_font(str, r, r/3);
+        if(ht) {
+            draw_color(YELLOW);
+            draw_text(xc - draw_text_width(str)/2, yc + r/3, str);
+        }
+    }
+
+    void render_history() {
+        render_text(sensors[sensor].label, "");
+        std::string str = sensor_text(sensor);
+        int lh = h/5;
+        draw_color(WHITE);
+        if(fit_font(str, w/2, lh))
+            draw_text(x + w/2, y+1, str);
+
+        std::list<history_point> &data = history[sensor];
+        if(data.empty())
+            return;
+        float high = -INFINITY, low = INFINITY;
+        for(history_point &p : data) {
+            high = fmaxf(high, p.value);
+            low = fminf(low, p.value);
+        }
+        float range = high - low + 1e-3f;
+
+        // plot below the label
+        int py = y + lh + 2, ph = h - lh - 4;
+        int lxp = -1, lyp = 0;
+        draw_color(ORANGE);
+        for(history_point &p : data) {
+            int xp = w - 2 - (int)((sim_ms - p.time) * (w - 4) / 300000);
+            if(xp < 2)
+                break;
+            int yp = ph - 1 - (int)((p.value - low) * (ph - 1) / range);
+            if(lxp >= 0)
+                draw_line(x + lxp, py + lyp, x + xp, py + yp);
+            lxp = xp, lyp = yp;
+        }
+    }
+
+    // rings sized by a range that changes every 5 seconds and a target
+    // crossing them, the way the ais page redraws as its range is changed
+    void render_rings() {
+        int r = (w < h ? w : h)/2 - 3, xc = x + w/2, yc = y + h/2;
+        int range = sim_ms / 5000 % 8;
+        draw_color(GREY);
+        for(int j=1; j<=5; j++)
+            draw_circle(xc, yc, 20 + (r - 20) * (j*8 + range) / 48, 2);
+
+        int s = sim_ms / 1000 % 60;
+        draw_color(GREEN);
+        draw_circle(xc - r/2 + s * r / 60, yc, 4, 2);
+    }
+
+    void render() {
+        switch(type) {
+        case TEXT: render_text(sensors[sensor].label, sensor_text(sensor)); break;
+        case GAUGE: render_gauge(); break;
+        case CLOCK: {
+            uint64_t s = sim_ms / 1000;
+            char buf[16];
+            snprintf(buf, sizeof buf, "%02d:%02d:%02d", (int)(s/3600%24), (int)(s/60%60), (int)(s%60));
+            render_text("TIME", buf);
+        } break;
+        case HISTORY: render_history(); break;
+        case RINGS: render_rings(); break;
+        }
+    }
+};
+
+struct page_t {
+    const char *name;
+    std::vector<widget> widgets;
+};
+
+static int page_width, page_height;
+
+static void add(page_t &p, widget_e type, int sensor, float x, float y, float w, float h)
+{
+    p.widgets.push_back({type, sensor, (int)(x*page_width), (int)(y*page_height),
+                         (int)(w*page_width), (int)(h*page_height), 0});
+}
+
+static std::vector<page_t> make_pages()
+{
+    std::vector<page_t> pages(4);
+
+    // every sensor as text, like the all data pages
+    page_t &a = pages[0];
+    a.name = "sensor grid";
+    const int grid[] = {AWA, AWS, HDG, SOG, COG, DEPTH, WTEMP, BARO};
+    for(int i=0; i<9; i++)
+        add(a, i < 8 ? TEXT : CLOCK, i < 8 ? grid[i] : 0, i%3/3.0f, i/3/3.0f, 1/3.0f, 1/3.0f);
+
+    // wind gauges with text
+    page_t &b = pages[1];
+    b.name = "wind gauges";
+    add(b, GAUGE, AWA, 0, 0, .4, 1);
+    add(b, GAUGE, AWS, .4, 0, .4, 1);
+    add(b, TEXT, HDG, .8, 0, .2, 1/3.0f);
+    add(b, TEXT, SOG, .8, 1/3.0f, .2, 1/3.0f);
+    add(b, TEXT, DEPTH, .8, 2/3.0f, .2, 1/3.0f);
+
+    // a speed gauge over history
+    page_t &c = pages[2];
+    c.name = "gauge and history";
+    add(c, GAUGE, SOG, 0, 0, .4, 1);
+    add(c, HISTORY, SOG, .4, 0, .6, .5);
+    add(c, HISTORY, DEPTH, .4, .5, .6, .5);
+
+    // ais range rings, more sizes than the circle cache holds
+    page_t &d = pages[3];
+    d.name = "ais rings";
+    add(d, RINGS, 0, 0, 0, 1, 1);
+
+    return pages;
+}
+
+static void render_page(page_t &p)
+{
+    int rx, ry, rw, rh;
+    for(int i=0; draw_clip(i, rx, ry, rw, rh); i++)
+        for(widget &w : p.widgets)
+            if(w.x < rx + rw && rx < w.x + w.w && w.y < ry + rh && ry < w.y + w.h) {
+                draw_color(WHITE);
+                w.render();
+            }
+}
+
+static void usage()
+{
+    printf("usage: testdirty [options]\n");
+    printf("  -t  seconds to run each page (default 300)\n");
+    printf("  -f  frames per second (default 10)\n");
+    printf("  -c  check against a full render every n frames (default 50, 0 never)\n");
+    printf("  -r  rotation 0-3 (default 0)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = 300, fps = 10, check = 50, rotation = 0;
+    int c;
+    while((c = getopt(argc, argv, "t:f:c:r:h")) != -1) {
+        switch(c) {
+        case 't': seconds = atoi(optarg); break;
+        case 'f': fps = atoi(optarg); break;
+        case 'c': check = atoi(optarg); break;
+        case 'r': rotation = atoi(optarg) & 3; break;
+        default: usage(); return 1;
+        }
+    }
+    if(optind != argc || seconds < 1 || fps < 1) {
+        usage();
+        return 1;
+    }
+
+    draw_setup(rotation);
+    bool portrait = rotation == 1 || rotation == 3;
+    page_width = portrait ? DRAW_LCD_V_RES : DRAW_LCD_H_RES;
+    page_height = portrait ? DRAW_LCD_H_RES : DRAW_LCD_V_RES;
+
+    uint8_t *partial = framebuffer;
+    uint8_t *full = (uint8_t*)malloc(FRAMEBUFFER_SIZE);
+    const int screen = DRAW_LCD_H_RES*DRAW_LCD_V_RES;
+
+    printf("%dx%d at %d fps for %d s a page\n", page_width, page_height, fps, seconds);
+    printf("%-18s %8s %8s %10s %8s %10s %10s\n", "page", "frames", "sent", "px/frame", "screen",
+           "regions", "us/frame");
+
+    int failures = 0;
+    std::vector<page_t> pages = make_pages();
+    for(page_t &p : pages) {
+        srand(1);
+        sim_ms = 0;
+        for(int i=0; i<SENSOR_COUNT; i++) {
+            sensors[i].next = 0;
+            history[i].clear();
+        }
+        // preload history so the plots are full
+        for(sim_ms = 0; sim_ms < 300000; sim_ms += 1000)
+            update_sensors();
+
+        // the page is shown, everything is drawn
+        framebuffer = partial;
+        draw_invalidate_all();
+        for(widget &w : p.widgets)
+            w.shown = w.state();
+        draw_clear(true);
+        render_page(p);
+        draw_send_buffer();
+
+        int frames = seconds * fps, sent = 0, mismatches = 0;
+        uint64_t pixels = 0, regions = 0, partial_us = 0, full_us = 0;
+        for(int f=0; f<frames; f++) {
+            sim_ms += 1000 / fps;
+            update_sensors();
+
+            uint64_t t0 = now_us();
+            for(widget &w : p.widgets)
+                w.invalidate();
+            if(draw_regions()) {
+                sent++;
+                regions += draw_regions();
+                pixels += draw_dirty_pixels();
+                draw_clear(true);
+                render_page(p);
+                draw_send_buffer();
+            }
+            uint64_t t1 = now_us();
+            partial_us += t1 - t0;
+
+            if(!check || f % check)
+                continue;
+
+            // the same frame drawn whole
+            framebuffer = full;
+            t0 = now_us();
+            draw_invalidate_all();
+            draw_clear(true);
+            render_page(p);
+            draw_send_buffer();
+            full_us += now_us() - t0;
+            framebuffer = partial;
+
+            if(memcmp(partial, full, FRAMEBUFFER_SIZE)) {
+                if(!mismatches)
+                    printf("%s: frame %d differs from a full render\n", p.name, f);
+                mismatches++;
+            }
+        }
+
+        double px = (double)pixels / frames;
+        printf("%-18s %8d %8d %10.0f %7.1f%% %10.2f %10.1f\n", p.name, frames, sent, px,
+               100 * px / screen, sent ? (double)regions / sent : 0, (double)partial_us / frames);
+        if(check)
+            printf("%-18s %8d %8s %10d %7.1f%% %10d %10.1f\n", "  full redraw", frames / check, "",
+                   screen, 100.0, 1, (double)full_us / ((frames + check - 1) / check));
+        failures += mismatches;
+    }
+
+    draw_print_stats();
+
+    if(failures) {
+        printf("FAILED: %d frames differ from a full render\n", failures);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
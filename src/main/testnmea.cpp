@@ -0,0 +1,1088 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/tcp.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+#include "settings.h"
+#include "display.h"
+#include "nmea.h"
+#include "nmea_output.h"
+
+// g++ -std=c++20 -O2 -g -o testnmea testnmea.cpp nmea.cpp nmea_output.cpp capture.cpp && ./testnmea
+
+// stubs for what nmea.cpp needs from the rest of the firmware
+settings_t settings;
+bool force_wifi_ap_mode;
+bool wifi_connected;
+int signalk_discovered, pypilot_discovered;
+route_info_t route_info;
+const char *source_name[] = { "ESP", "USB", "RS422", "C", "W" };
+
+static float data[DISPLAY_COUNT];
+static int updates;
+void display_data_update(display_item_e item, float value, data_source_e source)
+{
+    data[item] = value;
+    updates++;
+}
+
+void history_set_time(uint32_t date, int hour, int minute, float second) {}
+bool ais_parse_line(const char *line, data_source_e source) { return false; }
+void ais_print_stats() {}
+void serial_write_nmea(const char *buf) {}
+
+// the output scheduler tests step time themselves
+static uint64_t virtual_time;
+uint64_t esp_timer_get_time()
+{
+    if(virtual_time)
+        return virtual_time;
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000ULL + ts.tv_nsec/1000;
+}
+
+// count the send, sendto and recv calls made by nmea.cpp
+static int send_calls, sendto_calls, recv_calls;
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+    send_calls++;
+    return syscall(SYS_sendto, fd, buf, len, flags, NULL, 0);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags, const sockaddr *addr, socklen_t addrlen)
+{
+    sendto_calls++;
+    return syscall(SYS_sendto, fd, buf, len, flags, addr, addrlen);
+}
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+    recv_calls++;
+    return recvfrom(fd, buf, len, flags, NULL, NULL);
+}
+
+static uint8_t checksum(const char *buf, int len=-1)
+{
+    uint8_t cksum = 0;
+    int i=0;
+    while(*buf) {
+        cksum ^= *buf++;
+        if(++i == len)
+            break;
+    }
+    return cksum;
+}
+
+// the sscanf based parser this replaced, kept to compare speed
+// (with the buffer overflow in RMB and the null walk in APB fixed so it can run)
+static bool prefix(const char *line, const char *prefix)
+{
+    return line[3] == prefix[0] && line[4] == prefix[1] && line[5] == prefix[2];
+}
+
+static const char *comma(const char *start, int count)
+{
+    while(count) {
+        start++;
+        if(*start == ',')
+            count--;
+        if(!*start)
+            return 0;
+    }
+    return start;
+}
+
+static float convert_decimal_ll(float decll)
+{
+    float degrees;
+    float minutes = modff(decll/100, &degrees)*100;
+    return degrees + minutes / 60;
+}
+
+static bool legacy_parse_line(const char *line, data_source_e source)
+{
+    int len=strlen(line);
+    if(len < 10 || len > 180)
+        return false;
+    if(line[0] != '$' && line[0] != '!')
+        return false;
+    int indstar=len-1;
+    while(line[indstar]!='*')
+        if(--indstar == 0)
+            return false;
+    int cksum = strtol(line+indstar+1, 0, 16);
+    if(cksum != checksum(line+1, indstar-1))
+        return false;
+
+    const char *c1 = line+6;
+    if(prefix(line, "MWV")) {
+        float dir, spd;
+        char ref;
+        if(sscanf(c1, ",%f,%c,%f,N", &dir, &ref, &spd) != 3)
+            return false;
+        display_data_update(WIND_ANGLE, dir, source);
+        display_data_update(WIND_SPEED, spd, source);
+    } else if(prefix(line, "MDA")) {
+        float pressure, temperature;
+        char unit;
+        const char *c3 = comma(c1, 2);
+        if(!c3 || sscanf(c3, ",%f,%c", &pressure, &unit) != 2 || unit != 'B')
+            return false;
+        display_data_update(BAROMETRIC_PRESSURE, pressure, source);
+        const char *c5 = comma(c3, 2);
+        if(!c5 || sscanf(c5, ",%f,%c", &temperature, &unit) != 2 || unit != 'C')
+            return false;
+        display_data_update(AIR_TEMPERATURE, temperature, source);
+        const char *c7 = comma(c5, 2);
+        if(!c7 || sscanf(c7, ",%f,%c", &temperature, &unit) != 2 || unit != 'C')
+            return false;
+        display_data_update(WATER_TEMPERATURE, temperature, source);
+    } else if(prefix(line, "RMB")) {
+        float xte, wpt_lat, wpt_lon, rng, brg, vel;
+        char xte_dir, wpt_lat_sign, wpt_lon_sign, status;
+        char from_wpt[16], to_wpt[16];
+        sscanf(c1, ",A,%f,%c,%15[^,],%15[^,],%f,%c,%f,%c,%f,%f,%f,%c,A,",
+               &xte, &xte_dir, from_wpt, to_wpt,
+               &wpt_lat, &wpt_lat_sign, &wpt_lon, &wpt_lon_sign, &rng, &brg, &vel, &status);
+        display_data_update(ROUTE_INFO, 0, source);
+    } else if(prefix(line, "RMC")) {
+        int hour, minute;
+        float second, latitude, longitude, speed, track;
+        char status, lat_sign, lon_sign;
+        unsigned long date;
+        if(sscanf(c1, ",%02d%02d%f,%c", &hour, &minute, &second, &status) == 4)
+            display_data_update(TIME, (hour*60+minute)*60+second, source);
+        const char *c3 = comma(c1, 2);
+        if(sscanf(c3, ",%f,%c,%f,%c", &latitude, &lat_sign, &longitude, &lon_sign) == 4) {
+            display_data_update(LATITUDE, convert_decimal_ll(latitude), source);
+            display_data_update(LONGITUDE, convert_decimal_ll(longitude), source);
+        }
+        const char *c7 = comma(c3, 4);
+        if(sscanf(c7, ",%f", &speed) == 1)
+            display_data_update(GPS_SPEED, speed, source);
+        const char *c8 = comma(c7, 1);
+        if(sscanf(c8, ",%f", &track) == 1)
+            display_data_update(GPS_HEADING, track, source);
+        const char *c9 = comma(c8, 1);
+        sscanf(c9, ",%lu", &date);
+    } else if(prefix(line, "VHW")) {
+        const char *c5 = comma(c1, 4);
+        float speed;
+        char unit;
+        if(!c5 || sscanf(c5, ",%f,%c", &speed, &unit) != 2 || unit != 'N')
+            return false;
+        display_data_update(WATER_SPEED, speed, source);
+    } else if(prefix(line, "HDM")) {
+        float heading;
+        char unit;
+        if(sscanf(c1, ",%f,%c", &heading, &unit) != 2 || unit != 'M')
+            return false;
+        display_data_update(COMPASS_HEADING, heading, source);
+    } else if(prefix(line, "XDR")) {
+        float value;
+        char unit;
+        const char *c4 = comma(c1, 3);
+        if(!c4 || sscanf(c1, ",A,%f,%c", &value, &unit) != 2)
+            return false;
+        if(strncmp(c4, ",ROLL", 5) == 0)
+            display_data_update(HEEL, value, source);
+        else if(strncmp(c4, ",PTCH", 5) == 0)
+            display_data_update(PITCH, value, source);
+    } else if(prefix(line, "ROT") || prefix(line, "RSA")) {
+        float rate;
+        char unit;
+        if(sscanf(c1, ",%f,%c", &rate, &unit) != 2 || unit != 'A')
+            return false;
+        display_data_update(line[3] == 'R' && line[4] == 'O' ? RATE_OF_TURN : RUDDER_ANGLE, rate, source);
+    } else if(prefix(line, "APB")) {
+        const char *c3 = comma(c1, 2);
+        float xte, brg;
+        char dir, unit;
+        if(sscanf(c3, ",%f,%c,", &xte, &dir) != 2)
+            return false;
+        const char *c8 = comma(c3, 5);
+        if(sscanf(c8, ",%f,%c,", &brg, &unit) != 2)
+            return false;
+        const char *c10 = comma(c8, 2);
+        const char *c11 = c10 ? comma(c10, 1) : 0;
+        if(!c11 || sscanf(c11, ",%f,%c,", &brg, &unit) != 2)
+            return false;
+    } else
+        return false;
+    return true;
+}
+
+static const char *sentences[] = {
+    "$WIMWV,214.8,R,12.40,N,A",
+    "$GPRMC,123519.00,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W",
+    "$WIMDA,29.92,I,1.0132,B,18.5,C,16.2,C,,,,,,,,,,,,",
+    "$VWVHW,,T,,M,6.42,N,11.89,K",
+    "$HCHDM,238.5,M",
+    "$IIXDR,A,-3.2,D,ROLL,A,1.5,D,PTCH",
+    "$TIROT,-2.4,A",
+    "$AGRSA,4.5,A,,",
+    "$GPAPB,A,A,0.10,R,N,V,V,011,T,DEST,011,T,012,T",
+    "$GPRMB,A,0.66,L,003,004,4917.24,N,12309.57,W,001.3,052.5,000.5,V",
+};
+#define SENTENCE_COUNT ((sizeof sentences) / (sizeof *sentences))
+static char corpus[SENTENCE_COUNT][128];
+
+static bool near(float a, float b)
+{
+    return fabsf(a - b) < 1e-4f*fmaxf(1, fabsf(b));
+}
+
+#define CHECK(x) if(!(x)) { printf("FAILED %s:%d %s\n", __FILE__, __LINE__, #x); failures++; }
+
+static int test_parse()
+{
+    int failures = 0;
+    for(unsigned i=0; i<SENTENCE_COUNT; i++)
+        CHECK(nmea_parse_line(corpus[i], USB_DATA));
+
+    CHECK(near(data[WIND_ANGLE], 214.8));
+    CHECK(near(data[WIND_SPEED], 12.4));
+    CHECK(near(data[TIME], (12*60+35)*60+19));
+    CHECK(near(data[LATITUDE], 48 + 7.038/60));
+    CHECK(near(data[LONGITUDE], 11 + 31.0/60));
+    CHECK(near(data[GPS_SPEED], 22.4));
+    CHECK(near(data[GPS_HEADING], 84.4));
+    CHECK(near(data[BAROMETRIC_PRESSURE], 1.0132));
+    CHECK(near(data[AIR_TEMPERATURE], 18.5));
+    CHECK(near(data[WATER_TEMPERATURE], 16.2));
+    CHECK(near(data[WATER_SPEED], 6.42));
+    CHECK(near(data[COMPASS_HEADING], 238.5));
+    CHECK(near(data[HEEL], -3.2));
+    CHECK(near(data[PITCH], 1.5));
+    CHECK(near(data[RATE_OF_TURN], -2.4));
+    CHECK(near(data[RUDDER_ANGLE], 4.5));
+    CHECK(near(route_info.target_bearing, 12));
+    CHECK(near(route_info.xte, -0.66));
+    CHECK(route_info.to_wpt == "004");
+    CHECK(near(route_info.wpt_lat, 49 + 17.24/60));
+    CHECK(near(route_info.wpt_lon, -(123 + 9.57/60)));
+
+    // bad checksum, truncated and malformed lines are rejected
+    CHECK(!nmea_parse_line("$HCHDM,238.5,M*00", USB_DATA));
+    CHECK(!nmea_parse_line("$HCHDM,238.5,M", USB_DATA));
+    CHECK(!nmea_parse_line("$HCHDM,23x.5,M*2B", USB_DATA));
+
+    // a line framed in place ends at len, not at the checksum after it
+    const char *framed = "$HCHDM,238.5,M*2B";
+    CHECK(!nmea_parse_line(framed, 14, USB_DATA));
+
+    // more decimals than the minutes can be scaled by
+    char rmc[80] = "$GPRMC,,A,0.12345678,N,01131.000,E,,,";
+    snprintf(rmc + strlen(rmc), 4, "*%02X", checksum(rmc+1));
+    data[LATITUDE] = 99;
+    nmea_parse_line(rmc, USB_DATA);
+    CHECK(data[LATITUDE] == 99);
+
+    // sentences without a handler are rejected before the fields are parsed
+    CHECK(!nmea_parse_line("$GPGSV,3,1,11,03,03,111,00*74", USB_DATA));
+    CHECK(!nmea_parse_line("$GPGS", USB_DATA));
+    CHECK(!nmea_parse_line("$GPMWX,214.8,R,12.40,N,A*00", USB_DATA));
+
+    // each outcome is counted against the source, and only valid sentences against their type
+    const nmea_stats_t &stats = nmea_source_stats[RS422_DATA];
+    nmea_stats_t hdm_before = {}, hdm_after = {};
+    int hdm = 0;
+    while(strcmp(nmea_sentence_stats(hdm, hdm_before), "HDM"))
+        hdm++;
+    nmea_parse_line(corpus[0], RS422_DATA);
+    nmea_parse_line("$HCHDM,238.5,M*00", RS422_DATA);
+    nmea_parse_line("$GPGSV,3,1,11,03,03,111,00*74", RS422_DATA);
+    char invalid[64] = "$WIMWV,214.8,X,12.40,N,A";
+    snprintf(invalid + strlen(invalid), 4, "*%02X", checksum(invalid+1));
+    CHECK(!nmea_parse_line(invalid, RS422_DATA));
+    CHECK(stats.sentences == 4);
+    CHECK(stats.bytes == strlen(corpus[0]) + 17 + 29 + strlen(invalid));
+    CHECK(stats.bad == 1);
+    CHECK(stats.unknown == 1);
+    CHECK(stats.parse_failed == 1);
+    nmea_sentence_stats(hdm, hdm_after);
+    CHECK(hdm_after.sentences == hdm_before.sentences);
+    CHECK(hdm_after.bytes == hdm_before.bytes);
+    CHECK(hdm_after.bad == 0);
+    return failures;
+}
+
+static void poll_for(int ms)
+{
+    for(int i=0; i<ms; i++) {
+        usleep(1000);
+        nmea_poll();
+    }
+}
+
+// feed the tcp server through a loopback socket in awkward pieces
+static int test_tcp_framing()
+{
+    int failures = 0;
+    force_wifi_ap_mode = true;
+    settings.input_nmea_tcp_server = true;
+    settings.nmea_tcp_server_port = 17114;
+    poll_for(5);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(settings.nmea_tcp_server_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(connect(sock, (sockaddr*)&addr, sizeof addr) == 0);
+    poll_for(5);
+
+    char line[1024];
+    // a sentence split across segments
+    snprintf(line, sizeof line, "%s\r\n", corpus[4]); // HDM
+    data[COMPASS_HEADING] = 0;
+    send(sock, line, 5, 0);
+    poll_for(5);
+    send(sock, line+5, strlen(line+5), 0);
+    poll_for(5);
+    CHECK(near(data[COMPASS_HEADING], 238.5));
+
+    // an overlong sentence is dropped without losing the next one
+    memset(line, 'A', sizeof line);
+    line[0] = '$';
+    send(sock, line, sizeof line, 0);
+    snprintf(line, sizeof line, "\r\n%s\r\n", corpus[0]); // MWV
+    data[WIND_ANGLE] = 0;
+    send(sock, line, strlen(line), 0);
+    poll_for(5);
+    CHECK(near(data[WIND_ANGLE], 214.8));
+
+    // a truncated sentence is dropped when the next one starts
+    snprintf(line, sizeof line, "$TIROT,-2%s\r\n", corpus[7]); // RSA
+    data[RATE_OF_TURN] = data[RUDDER_ANGLE] = 0;
+    send(sock, line, strlen(line), 0);
+    poll_for(5);
+    CHECK(data[RATE_OF_TURN] == 0);
+    CHECK(near(data[RUDDER_ANGLE], 4.5));
+
+    close(sock);
+    poll_for(5);
+    return failures;
+}
+
+// nmea.cpp connects out to a local peer and only reads when data arrives
+static int test_tcp_client()
+{
+    int failures = 0;
+    force_wifi_ap_mode = true;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof opt);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(17117);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(listener, (sockaddr*)&addr, sizeof addr) == 0);
+    listen(listener, 1);
+
+    settings.input_nmea_tcp_client = true;
+    settings.nmea_tcp_client_addr = "127.0.0.1";
+    settings.nmea_tcp_client_port = 17117;
+    poll_for(5);
+    int peer = accept(listener, NULL, NULL);
+    CHECK(peer >= 0);
+    poll_for(5);
+
+    // idle sockets cost no reads
+    recv_calls = 0;
+    poll_for(100);
+    printf("tcp client idle: %d recv calls in 100 polls\n", recv_calls);
+    CHECK(recv_calls == 0);
+
+    char line[sizeof *corpus + 2];
+    snprintf(line, sizeof line, "%s\r\n", corpus[6]); // ROT
+    data[RATE_OF_TURN] = 0;
+    send(peer, line, strlen(line), 0);
+    poll_for(2);
+    CHECK(near(data[RATE_OF_TURN], -2.4));
+
+    close(peer);
+    close(listener);
+    poll_for(5);
+    settings.input_nmea_tcp_client = false;
+    return failures;
+}
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int drain(int sock)
+{
+    char buf[4096];
+    int total = 0, ret;
+    while((ret = recv(sock, buf, sizeof buf, MSG_DONTWAIT)) > 0)
+        total += ret;
+    return total;
+}
+
+// one wind and one water packet worth of output each tick
+static const char *output_sentences[] = {"MWV,214.80,R,12.40,N,A", "VHW,,,,,6.42,N,,",
+                                         "DBT,,,12.34567,M,,", "MTW,16.20,C"};
+static void output_tick(bool poll_each)
+{
+    for(const char *sentence : output_sentences) {
+        nmea_send(sentence);
+        if(poll_each)
+            nmea_poll();
+    }
+    nmea_poll();
+}
+
+// compare sending each sentence as written to one send per tick
+static int test_tcp_output()
+{
+    int failures = 0;
+    force_wifi_ap_mode = true;
+    settings.output_nmea_tcp_server = true;
+    settings.nmea_tcp_server_port = 17115;
+    poll_for(5);
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(settings.nmea_tcp_server_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(connect(sock, (sockaddr*)&addr, sizeof addr) == 0);
+    poll_for(5);
+    drain(sock);
+
+    const int ticks = 100000;
+    const char *names[] = {"sentence", "tick"};
+    int bytes[2];
+    for(int mode = 0; mode < 2; mode++) {
+        tcp_info info;
+        socklen_t len = sizeof info;
+        getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len);
+        uint32_t segs = info.tcpi_segs_in;
+        send_calls = 0;
+        bytes[mode] = 0;
+
+        double t0 = now();
+        for(int i=0; i<ticks; i++) {
+            output_tick(mode == 0);
+            bytes[mode] += drain(sock);
+        }
+        double dt = now() - t0;
+        usleep(10000);
+        bytes[mode] += drain(sock);
+
+        getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len);
+        segs = info.tcpi_segs_in - segs;
+        printf("flush per %-8s %6.2f sends/tick %6.2f segments/tick %9.0f sends/s %9.0f segments/s\n",
+               names[mode], (float)send_calls/ticks, (float)segs/ticks, send_calls/dt, segs/dt);
+        if(mode == 1)
+            CHECK(send_calls == ticks);
+    }
+    CHECK(bytes[0] == bytes[1]);
+    int tick_bytes = 0;
+    for(const char *sentence : output_sentences)
+        tick_bytes += strlen("$QY*xx\r\n") + strlen(sentence);
+    CHECK(bytes[1] == ticks*tick_bytes);
+
+    close(sock);
+    poll_for(5);
+    settings.output_nmea_tcp_server = false;
+    return failures;
+}
+
+static int connect_server(int rcvbuf = 0)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(rcvbuf)
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(settings.nmea_tcp_server_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(sock, (sockaddr*)&addr, sizeof addr))
+        return -1;
+    poll_for(5);
+    return sock;
+}
+
+// the last value of the sentence starting with prefix in what a client received
+static int last_value(const char *received, const char *prefix)
+{
+    const char *s = strstr(received, prefix), *m;
+    while(s && (m = strstr(s+1, prefix)))
+        s = m;
+    return s ? atoi(s + strlen(prefix)) : -1;
+}
+
+// a client that stops reading must not hold up the loop or a client that reads
+static int test_slow_reader(const char *policy)
+{
+    int failures = 0;
+    force_wifi_ap_mode = true;
+    settings.output_nmea_tcp_server = true;
+    settings.nmea_tcp_server_port = 17116;
+    settings.nmea_tcp_drop_policy.set(policy);
+    poll_for(5);
+
+    int fast = connect_server(), slow = connect_server(1024);
+    CHECK(fast >= 0 && slow >= 0);
+    drain(fast);
+
+    const int ticks = 100000;
+    int fast_bytes = 0, slow_bytes = 0;
+    double max_tick = 0;
+    char last[64];
+    for(int i=0; i<ticks; i++) {
+        double t0 = now();
+        snprintf(last, sizeof last, "MWV,%d.0,R,12.40,N,A", i);
+        nmea_send(last);
+        for(int j=1; j<4; j++)
+            nmea_send(output_sentences[j]);
+        nmea_poll();
+        max_tick = fmax(max_tick, now() - t0);
+        fast_bytes += drain(fast);
+    }
+
+    // let the slow client catch up, keeping the end of what it got
+    char received[4096];
+    int len = 0;
+    for(double t0 = now(); now() - t0 < .2;) {
+        if(len > 2048) {
+            memmove(received, received + len - 256, 256);
+            len = 256;
+        }
+        int ret = recv(slow, received + len, sizeof received - len - 1, MSG_DONTWAIT);
+        if(ret > 0) {
+            slow_bytes += ret;
+            len += ret;
+            t0 = now();
+        } else
+            usleep(100);
+        nmea_poll();
+    }
+    received[len] = '\0';
+
+    int last_mwv = last_value(received, "$QYMWV,");
+    printf("drop %-6s fast %8d bytes slow %8d bytes last MWV %6d max tick %.0fus\n",
+           policy, fast_bytes, slow_bytes, last_mwv, max_tick*1e6);
+    nmea_print_stats();
+
+    int tick_bytes = 0;
+    for(const char *sentence : output_sentences)
+        tick_bytes += strlen("$QY*xx\r\n") + strlen(sentence);
+    CHECK(fast_bytes > ticks*(tick_bytes-10));
+    CHECK(slow_bytes < fast_bytes / 2);
+    // dropping by type drops the longest sentence, MWV, first
+    if(strcmp(policy, "type"))
+        CHECK(last_mwv == ticks-1);
+
+    close(fast);
+    close(slow);
+    poll_for(5);
+    settings.output_nmea_tcp_server = false;
+    return failures;
+}
+
+// relative and true wind replace only their own kind when a client falls behind
+static int test_latest_variants()
+{
+    int failures = 0;
+    force_wifi_ap_mode = true;
+    settings.output_nmea_tcp_server = true;
+    settings.nmea_tcp_server_port = 17117;
+    settings.nmea_tcp_drop_policy.set("latest");
+    poll_for(5);
+
+    int slow = connect_server(1024);
+    CHECK(slow >= 0);
+
+    const int ticks = 100000;
+    char line[64];
+    for(int i=0; i<ticks; i++) {
+        if(i % 10 == 0) { // true wind less often
+            snprintf(line, sizeof line, "MWV,%d.0,T,10.10,N,A", i);
+            nmea_send(line);
+        }
+        snprintf(line, sizeof line, "MWV,%d.0,R,12.40,N,A", i);
+        nmea_send(line);
+        nmea_poll();
+    }
+
+    char received[4096];
+    int len = 0;
+    for(double t0 = now(); now() - t0 < .2;) {
+        if(len > 2048) {
+            memmove(received, received + len - 256, 256);
+            len = 256;
+        }
+        int ret = recv(slow, received + len, sizeof received - len - 1, MSG_DONTWAIT);
+        if(ret > 0) {
+            len += ret;
+            t0 = now();
+        } else
+            usleep(100);
+        nmea_poll();
+    }
+    received[len] = '\0';
+
+    // both kinds arrive up to date, each having replaced only itself
+    char id[NMEA_ID_LENGTH];
+    nmea_sentence_id("$QYMWV,1.0,T,10.10,N,A*00", id);
+    CHECK(!strcmp(id, "QYMWV,T"));
+    int r = -1, t = -1;
+    for(const char *s = received; (s = strstr(s, "$QYMWV,")); s++) {
+        int v = atoi(s + 7);
+        const char *comma = strchr(s + 7, ',');
+        if(comma && comma[1] == 'R') r = v;
+        if(comma && comma[1] == 'T') t = v;
+    }
+    CHECK(r == ticks-1);
+    CHECK(t == ticks-10);
+
+    close(slow);
+    poll_for(5);
+    settings.output_nmea_tcp_server = false;
+    return failures;
+}
+
+// what an nmea_output_t under test wrote
+static char output_last[4][NMEA_OUTPUT_LINE];
+static int output_bytes, output_vdm;
+static void output_write(const char *buf, int len)
+{
+    output_bytes += len;
+    if(!memcmp(buf+3, "VDM", 3))
+        output_vdm++;
+    for(int i=0; i<4; i++)
+        if(!memcmp(buf+3, output_sentences[i], 3))
+            strcpy(output_last[i], buf);
+}
+
+static nmea_output_t test_output("test", output_write);
+
+static void output_step(int ms)
+{
+    virtual_time += ms*1000;
+    nmea_output_poll(test_output);
+}
+
+// each sentence type is limited to its interval and the latest is what gets sent
+static int test_output_interval()
+{
+    int failures = 0;
+    virtual_time = 1000000;
+    settings.nmea_output_intervals = "MWV:100,MTW:1000";
+    test_output.bytes_per_second = 0;
+    output_step(0);
+
+    char last[64];
+    for(int i=0; i<1000; i++) {
+        snprintf(last, sizeof last, "$QYMWV,%d.0,R,12.40,N,A*00\r\n", i);
+        nmea_output_write(test_output, last);
+        nmea_output_write(test_output, "$QYMTW,16.20,C*00\r\n");
+        nmea_output_write(test_output, "$QYVHW,,,,,6.42,N,,*00\r\n");
+        output_step(10);
+    }
+    output_step(100);
+
+    printf("interval sent %u replaced %u\n", (unsigned)test_output.sent, (unsigned)test_output.replaced);
+    // 10 seconds of 100hz input: mwv at 10hz, mtw at 1hz and vhw unlimited
+    CHECK(test_output.sent >= 100+10+1000 && test_output.sent <= 101+11+1000);
+    CHECK(!strcmp(output_last[0], last));
+    CHECK(test_output.dropped == 0);
+    return failures;
+}
+
+// a slow serial port gets no more than its baud rate and still gets the latest of each
+static int test_output_budget()
+{
+    int failures = 0;
+    virtual_time = 1000000;
+    settings.nmea_output_intervals = "";
+    test_output.bytes_per_second = 3840; // 38400 baud
+    output_step(1000);
+    output_bytes = output_vdm = 0;
+    test_output.sent = test_output.replaced = test_output.dropped = 0;
+
+    const int seconds = 10;
+    char last[4][64];
+    int vdm_written = 0;
+    for(int i=0; i<seconds*100; i++) {
+        for(int j=0; j<4; j++) {
+            // about 12000 bytes/s in, so 3 times what fits
+            snprintf(last[j], sizeof last[j], "$QY%s,%d*00\r\n", output_sentences[j], i);
+            nmea_output_write(test_output, last[j]);
+        }
+        if(i % 10 == 0) {
+            nmea_output_write(test_output, "!AIVDM,1,1,,A,13aEOK?P00PD2wVMdLDRhgvL289?,0*26\r\n");
+            vdm_written++;
+        }
+        output_step(10);
+    }
+    int busy_bytes = output_bytes;
+    printf("budget %d bytes/s utilisation %.0f%% sent %u replaced %u dropped %u ais %d/%d\n",
+           busy_bytes/seconds, test_output.utilisation*100, (unsigned)test_output.sent,
+           (unsigned)test_output.replaced, (unsigned)test_output.dropped, output_vdm, vdm_written);
+    nmea_output_print_stats();
+    CHECK(test_output.utilisation > .9);
+
+    // once the input stops what was held back goes out
+    for(int i=0; i<100; i++)
+        output_step(10);
+
+    // the burst allowance and one overdrawn line on top of the baud rate
+    CHECK(busy_bytes <= 3840*seconds + 384 + NMEA_OUTPUT_LINE);
+    CHECK(busy_bytes > 3840*seconds * 9 / 10);
+    CHECK(output_vdm + (int)test_output.dropped == vdm_written);
+    for(int j=0; j<4; j++)
+        CHECK(!strcmp(output_last[j], last[j]));
+
+    virtual_time = 0;
+    return failures;
+}
+
+// counts of relative and true wind written by an nmea_output_t under test
+static int variant_r, variant_t;
+static void variant_write(const char *buf, int len)
+{
+    if(!memcmp(buf+3, "MWV", 3)) {
+        const char *comma = strchr(buf+7, ',');
+        variant_r += comma && comma[1] == 'R';
+        variant_t += comma && comma[1] == 'T';
+    }
+}
+
+static nmea_output_t variant_output("variant", variant_write);
+
+// relative and true wind each get their own interval rather than sharing one
+static int test_output_variants()
+{
+    int failures = 0;
+    virtual_time = 1000000;
+    settings.nmea_output_intervals = "MWV:100";
+    variant_output.bytes_per_second = 0;
+    nmea_output_poll(variant_output);
+
+    for(int i=0; i<100; i++) {
+        nmea_output_write(variant_output, "$WIMWV,214.8,R,12.40,N,A*00\r\n");
+        nmea_output_write(variant_output, "$WIMWV,200.1,T,10.10,N,A*00\r\n");
+        virtual_time += 10000;
+        nmea_output_poll(variant_output);
+    }
+
+    printf("variants relative %d true %d\n", variant_r, variant_t);
+    CHECK(variant_r >= 10 && variant_r <= 11);
+    CHECK(variant_t >= 10 && variant_t <= 11);
+    CHECK(variant_output.dropped == 0);
+
+    // with every slot busy, wind waiting out its interval keeps its slot
+    variant_r = 0;
+    virtual_time += 1000000;
+    variant_output.bytes_per_second = 3840;
+    nmea_output_poll(variant_output);
+    nmea_output_write(variant_output, "$WIMWV,214.8,R,12.40,N,A*00\r\n");
+    char line[64];
+    for(int i=0; i<2*NMEA_OUTPUT_SLOTS; i++) {
+        snprintf(line, sizeof line, "$QYX%02d,%d*00\r\n", i, i);
+        nmea_output_write(variant_output, line);
+    }
+    for(int i=0; i<9; i++) {
+        virtual_time += 10000;
+        nmea_output_poll(variant_output);
+        nmea_output_write(variant_output, "$WIMWV,214.8,R,12.40,N,A*00\r\n");
+    }
+    CHECK(variant_r == 1);
+
+    virtual_time = 0;
+    settings.nmea_output_intervals = "";
+    return failures;
+}
+
+// the snprintf formatting sensors.cpp used before nmea_builder, the body
+// leaves room for the talker, checksum and line end
+#define LEGACY_SENTENCE 96
+static const char *legacy_send(char (&out)[LEGACY_SENTENCE], const char *fmt, float a, float b=0)
+{
+    char buf[LEGACY_SENTENCE - 8];
+    snprintf(buf, sizeof buf, fmt, a, b);
+    snprintf(out, sizeof out, "$QY%s*%02x\r\n", buf, 0x08^checksum(buf));
+    return out;
+}
+
+static const char *build_water(int i, float speed, float depth, float temperature)
+{
+    static nmea_builder b("");
+    switch(i) {
+    case 0:
+        b = nmea_builder("VHW");
+        b.empty(4);
+        b.decimal(speed, 2);
+        b.text("N");
+        b.empty(2);
+        break;
+    case 1:
+        b = nmea_builder("DBT");
+        b.empty(2);
+        b.decimal(depth, 5);
+        b.text("M");
+        b.empty(2);
+        break;
+    default:
+        b = nmea_builder("MTW");
+        b.decimal(temperature, 2);
+        b.text("C");
+    }
+    return b.finish();
+}
+
+static const char *legacy_water(int i, float speed, float depth, float temperature)
+{
+    static char out[LEGACY_SENTENCE];
+    switch(i) {
+    case 0: return legacy_send(out, "VHW,,,,,%.2f,N,,", speed);
+    case 1: return legacy_send(out, "DBT,,,%.5f,M,,", depth);
+    default: return legacy_send(out, "MTW,%.2f,C", temperature);
+    }
+}
+
+// the builder writes the same sentences snprintf did
+static int test_builder()
+{
+    int failures = 0;
+    const float values[][3] = {{6.42, 12.34567, 16.2}, {0, 0.5, -1.5}, {0.004, 1234.5, -0.25},
+                               {12.999, 0.00001, 40}};
+    for(auto &v : values)
+        for(int i=0; i<3; i++) {
+            const char *built = build_water(i, v[0], v[1], v[2]);
+            const char *legacy = legacy_water(i, v[0], v[1], v[2]);
+            if(strcmp(built, legacy))
+                printf("builder %s legacy %s", built, legacy);
+            CHECK(!strcmp(built, legacy));
+        }
+
+    char legacy[LEGACY_SENTENCE];
+    nmea_builder mda("MDA");
+    mda.empty(2);
+    mda.decimal(1.01325, 5);
+    mda.text("B");
+    mda.empty(4);
+    mda.decimal(55.5, 2);
+    mda.empty(11);
+    CHECK(!strcmp(mda.finish(), legacy_send(legacy, "MDA,,,%.5f,B,,,,,%.2f,,,,,,,,,,,", 1.01325, 55.5)));
+
+    nmea_builder mwv("MWV");
+    mwv.decimal(NAN, 2);
+    mwv.text("R");
+    mwv.integer(-12);
+    CHECK(!strcmp(mwv.finish(), legacy_send(legacy, "MWV,,R,%.0f", -12)));
+
+    // out of range decimals leave a fixed field empty and round a decimal to 7 places
+    nmea_builder xdr("XDR");
+    xdr.fixed(123456789, 9);
+    xdr.fixed(-5, -1);
+    xdr.decimal(0.123456789, 9);
+    CHECK(!strcmp(xdr.finish(), legacy_send(legacy, "XDR,,,%.7f", 0.123456789)));
+    return failures;
+}
+
+static uint64_t cycles()
+{
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void bench_format(const char *name, const char *(*format)(int, float, float, float))
+{
+    const int iterations = 1000000;
+    int total = 0;
+    double t0 = now();
+    uint64_t c0 = cycles();
+    for(int i=0; i<iterations; i++)
+        total += format(i%3, i*.001f, i*.01f, i*.0001f)[5];
+    uint64_t c = cycles() - c0;
+    double dt = now() - t0;
+    printf("%-8s %10.0f sentences/s %6.0f ns %6.0f cycles per sentence (%d)\n", name,
+           iterations/dt, dt*1e9/iterations, (double)c/iterations, total & 1);
+}
+
+static double thread_cpu()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static int udp_socket(int port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(port && bind(sock, (sockaddr*)&addr, sizeof addr))
+        return -1;
+    return sock;
+}
+
+// udp sends each tick as one datagram and ignores its own sentences coming back
+static int test_udp()
+{
+    int failures = 0;
+    force_wifi_ap_mode = true;
+    settings.input_nmea_udp = settings.output_nmea_udp = true;
+    settings.nmea_udp_addr = "127.0.0.1"; // to ourselves, so everything echoes
+    settings.nmea_udp_port = 17118;
+    poll_for(5);
+
+    const nmea_stats_t &stats = nmea_source_stats[WIFI_DATA];
+    uint32_t sentences = stats.sentences;
+    sendto_calls = 0;
+    output_tick(false);
+    CHECK(sendto_calls == 1);
+    poll_for(5);
+    CHECK(stats.sentences == sentences);
+
+    // another sender on the same port is heard
+    int other = udp_socket(0);
+    char lines[2 * (sizeof *corpus + 2)];
+    snprintf(lines, sizeof lines, "%s\r\n%s\r\n", corpus[0], corpus[6]); // MWV and ROT
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(settings.nmea_udp_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    data[RATE_OF_TURN] = 0;
+    sendto(other, lines, strlen(lines), 0, (sockaddr*)&addr, sizeof addr);
+    poll_for(5);
+    CHECK(stats.sentences == sentences + 2);
+    CHECK(near(data[RATE_OF_TURN], -2.4));
+
+    // even when it repeats a sentence we just sent
+    output_tick(false);
+    snprintf(lines, sizeof lines, "$QY%s*%02x\r\n", output_sentences[0], checksum(output_sentences[0]) ^ 'Q' ^ 'Y');
+    sendto(other, lines, strlen(lines), 0, (sockaddr*)&addr, sizeof addr);
+    poll_for(5);
+    CHECK(stats.sentences == sentences + 3);
+    close(other);
+
+    settings.input_nmea_udp = settings.output_nmea_udp = false;
+    poll_for(5);
+    return failures;
+}
+
+// cpu time to write each tick to n tcp clients compared to one udp datagram
+static double output_cpu(int ticks, int *clients, int n)
+{
+    double cpu = 0;
+    for(int i=0; i<ticks; i++) {
+        double t0 = thread_cpu();
+        output_tick(false);
+        cpu += thread_cpu() - t0;
+        for(int j=0; j<n; j++)
+            drain(clients[j]);
+    }
+    return cpu;
+}
+
+static void bench_fanout()
+{
+    const int ticks = 20000, count = (sizeof output_sentences) / (sizeof *output_sentences);
+    force_wifi_ap_mode = true;
+    settings.output_nmea_tcp_server = true;
+    settings.nmea_tcp_server_port = 17119;
+    poll_for(5);
+
+    int clients[5];
+    for(int n=1; n<=5; n++) {
+        clients[n-1] = connect_server();
+        drain(clients[n-1]);
+        if(n % 2 == 0)
+            continue;
+        double cpu = output_cpu(ticks, clients, n);
+        printf("tcp %d clients %6.0f ns cpu per sentence\n", n, cpu*1e9/(ticks*count));
+    }
+    for(int n=0; n<5; n++)
+        close(clients[n]);
+    poll_for(5);
+    settings.output_nmea_tcp_server = false;
+
+    // listeners do not change what is sent, any number get the same datagram
+    settings.output_nmea_udp = true;
+    settings.nmea_udp_addr = "127.0.0.1";
+    settings.nmea_udp_port = 17118;
+    poll_for(5);
+    sendto_calls = 0;
+    double cpu = output_cpu(ticks, NULL, 0);
+    printf("udp any listeners %6.0f ns cpu per sentence, %.2f datagrams per tick\n",
+           cpu*1e9/(ticks*count), (double)sendto_calls/ticks);
+    settings.output_nmea_udp = false;
+    poll_for(5);
+}
+
+static void bench(const char *name, bool (*parse)(const char*, data_source_e))
+{
+    const int iterations = 200000;
+    double t0 = now();
+    for(int i=0; i<iterations; i++)
+        for(unsigned j=0; j<SENTENCE_COUNT; j++)
+            parse(corpus[j], USB_DATA);
+    double dt = now() - t0;
+    printf("%-8s %10.0f sentences/s\n", name, iterations*SENTENCE_COUNT/dt);
+}
+
+int main()
+{
+    signal(SIGPIPE, SIG_IGN); // lwip has no SIGPIPE
+    for(unsigned i=0; i<SENTENCE_COUNT; i++)
+        snprintf(corpus[i], sizeof corpus[i], "%s*%02X", sentences[i], checksum(sentences[i]+1));
+
+    int failures = test_parse();
+    failures += test_builder();
+    failures += test_output_interval();
+    failures += test_output_budget();
+    failures += test_output_variants();
+
+    // the tcp tests send every sentence every tick
+    settings.nmea_output_intervals = "";
+    failures += test_tcp_framing();
+    failures += test_tcp_output();
+    failures += test_tcp_client();
+    failures += test_udp();
+    failures += test_slow_reader("oldest");
+    failures += test_slow_reader("type");
+    failures += test_slow_reader("latest");
+    failures += test_latest_variants();
+
+    bench("sscanf", legacy_parse_line);
+    bench("fields", nmea_parse_line);
+    bench("unknown", [](const char *line, data_source_e source) {
+        return nmea_parse_line("$GPGSV,3,1,11,03,03,111,00*74", source); });
+    nmea_print_stats();
+
+    bench_fanout();
+    bench_format("snprintf", legacy_water);
+    bench_format("builder", build_water);
+
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures != 0;
+}
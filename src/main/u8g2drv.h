@@ -124,6 +124,15 @@ int draw_text_width(const std::string &str)
     return u8g2.getStrWidth(str.c_str());
 }
 
+// without width tables only the same string has the same shape
+int draw_text_shape(const std::string &str, uint8_t *shape, int size)
+{
+    if((int)str.length() > size)
+        return -1;
+    memcpy(shape, str.data(), str.length());
+    return str.length();
+}
+
 void draw_text(int x, int y, const std::string &str)
 {
     u8g2.drawUTF8(x, y, str.c_str());
@@ -160,3 +169,46 @@ void draw_send_buffer()
 {
     u8g2.sendBuffer();
 }
+
+// the whole buffer is always redrawn and sent
+void draw_invalidate(int x, int y, int w, int h)
+{
+}
+
+void draw_invalidate_all()
+{
+}
+
+int draw_regions()
+{
+    return 1;
+}
+
+bool draw_clip(int i, int &x, int &y, int &w, int &h)
+{
+    if(i > 0)
+        return false;
+    x = y = 0;
+    w = u8g2.getDisplayWidth();
+    h = u8g2.getDisplayHeight();
+    return true;
+}
+
+int draw_dirty_pixels()
+{
+    return u8g2.getDisplayWidth() * u8g2.getDisplayHeight();
+}
+
+// u8g2 renders glyphs from its fonts directly
+bool draw_glyph_warmup(int count)
+{
+    return false;
+}
+
+void draw_unpin_circles()
+{
+}
+
+void draw_print_stats()
+{
+}
@@ -9,7 +9,12 @@
 #include <string>
 #include <math.h>
 
+#ifdef __linux__
+#include <stdint.h>
+uint64_t esp_timer_get_time();
+#else
 #include <esp_timer.h>
+#endif
 
 #include "utils.h"
 
@@ -31,6 +31,8 @@
 #include "data.h"
 #include "utils.h"
 #include "zeroconf.h"
+#include "capture.h"
+#include "nmea.h"
 
 // TODO: fix these to put in separate header or file
 void settings_read(rapidjson::Document &s);
@@ -396,6 +398,68 @@ static esp_err_t canonical_handler(httpd_req_t *req)
     return httpd_resp_send(req, NULL, 0);
 }
 
+// download the file written by the serial "capture" command
+static esp_err_t capture_handler(httpd_req_t *req)
+{
+    FILE *f = fopen(CAPTURE_FILE, "rb");
+    if(!f) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "no capture");
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    char buf[1024];
+    int len;
+    while((len = fread(buf, 1, sizeof buf, f)) > 0)
+        httpd_resp_send_chunk(req, buf, len);
+    fclose(f);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void json_stats(rapidjson::Writer<rapidjson::StringBuffer> &writer, const nmea_stats_t &s)
+{
+    writer.StartObject();
+    writer.Key("bytes");        writer.Uint(s.bytes);
+    writer.Key("sentences");    writer.Uint(s.sentences);
+    writer.Key("bad");          writer.Uint(s.bad);
+    writer.Key("unknown");      writer.Uint(s.unknown);
+    writer.Key("parse_failed"); writer.Uint(s.parse_failed);
+    writer.Key("accepted");     writer.Uint(s.accepted);
+    writer.Key("rejected");     writer.Uint(s.rejected);
+    writer.EndObject();
+}
+
+// nmea input counters by source and by sentence type
+static esp_err_t stats_handler(httpd_req_t *req)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+
+    writer.StartObject();
+    writer.Key("sources");
+    writer.StartObject();
+    for(int i=0; i<DATA_SOURCE_COUNT; i++) {
+        writer.Key(source_name[i]);
+        json_stats(writer, nmea_source_stats[i]);
+    }
+    writer.EndObject();
+#ifdef CONFIG_IDF_TARGET_ESP32S3
+    writer.Key("sentences");
+    writer.StartObject();
+    nmea_stats_t stats;
+    const char *name;
+    for(int i=0; (name = nmea_sentence_stats(i, stats)); i++) {
+        writer.Key(name);
+        json_stats(writer, stats);
+    }
+    writer.EndObject();
+#endif
+    writer.EndObject();
+
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, buffer.GetString());
+}
+
 static esp_err_t root_handler(httpd_req_t *req)
 {
     char path[128];
@@ -460,6 +524,7 @@ void web_setup() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
     config.lru_purge_enable = true;
+    config.max_uri_handlers = 12;
 
     ESP_LOGI(TAG, "Starting server on port %d", config.server_port);
     if (httpd_start(&server, &config) != ESP_OK) {
@@ -523,7 +588,29 @@ void web_setup() {
         .supported_subprotocol = NULL
     };
     httpd_register_uri_handler(server, &canonical);
+
+    static const httpd_uri_t capture = {
+        .uri       = "/capture.bin",
+        .method    = (httpd_method_t)HTTP_GET,
+        .handler   = capture_handler,
+        .user_ctx  = NULL,
+        .is_websocket = false,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+    };
+    httpd_register_uri_handler(server, &capture);
     
+    static const httpd_uri_t stats = {
+        .uri       = "/stats.json",
+        .method    = (httpd_method_t)HTTP_GET,
+        .handler   = stats_handler,
+        .user_ctx  = NULL,
+        .is_websocket = false,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = NULL
+    };
+    httpd_register_uri_handler(server, &stats);
+
     static const httpd_uri_t root = {
         .uri       = "/*",
         .method    = (httpd_method_t)HTTP_GET,
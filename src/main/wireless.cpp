@@ -11,22 +11,37 @@
 
 #include <map>
 
+#ifdef __linux__
+// allow building on the host to replay captured packets
+#include <stdio.h>
+#include <stdint.h>
+#define ESP_LOGW(tag, fmt, ...) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+uint64_t esp_timer_get_time();
+#else
 #include <esp_now.h>
 #include <esp_wifi.h>
 #include <esp_timer.h>
 #include <esp_log.h>
+#endif
 
 #include "settings.h"
 #include "wireless.h"
 #include "display.h"
+#ifndef __linux__
 #include "zeroconf.h"
+#endif
 #include "sensors.h"
 #include "utils.h"
+#include "capture.h"
+#ifndef __linux__
 #include "web.h"
+#endif
 
 #define TAG "wireless"
 
+#ifndef __linux__
 static void setup_wifi(void);
+#endif
 
 bool wifi_connected;
 int wireless_message_count;
@@ -39,7 +54,9 @@ struct esp_now_data_t {
 } esp_now_rb[256];
 
 volatile uint8_t rb_start, rb_end;
+#ifndef __linux__
 volatile SemaphoreHandle_t esp_now_sem;
+#endif
 
 // crc is not really needed with espnow, however it adds a layer of protection against code changes
 #define WIND_ID 0xB179
@@ -92,6 +109,7 @@ typedef struct __attribute__((packed)) {
 } info_packet_t;
 
 
+#ifndef __linux__
 // callback when data is recv from Master
 // This function is run from the wifi thread, so post to a queue
 static void on_espnow_data(const esp_now_recv_info *recv_info, const uint8_t *data, int data_len) {
@@ -383,6 +401,7 @@ void wireless_scan()
     if (err != ESP_OK)
         ESP_LOGE(TAG, "scan start failed: %s", esp_err_to_name(err));
 }
+#endif
 
 #if 0
 static uint16_t crc16(const uint8_t *data_p, int length) {
@@ -500,6 +519,39 @@ static void DataRecvInfo(struct esp_now_data_t &data) {
     sensors_info_update(data.mac, packet->runtime, packet->packet_count);
 }
 
+static void receive_packet(esp_now_data_t &packet) {
+    if (packet.len > MAX_DATA_LEN) {
+        ESP_LOGW(TAG, "espnow wrong packet size %d", packet.len);
+        return;
+    }
+
+    capture_esp_now(packet.mac, packet.data, packet.len);
+    wireless_message_count++;
+
+    uint16_t id = *(uint16_t *)packet.data;
+    switch (id) {
+    case WIND_ID: DataRecvWind(packet); break;
+    case AIR_ID: DataRecvAir(packet); break;
+    case WATER_ID: DataRecvWater(packet); break;
+    case LIGHTNING_UV_ID: DataRecvLightningUV(packet); break;
+    case INFO_ID: DataRecvInfo(packet); break;
+    default:
+        ESP_LOGW(TAG, "espnow packet ID mismatch %x", id);
+    }
+}
+
+// decode a packet as if received over esp-now, used to replay captures
+void wireless_receive_packet(const uint8_t mac[6], const uint8_t *data, int len) {
+    if (len > MAX_DATA_LEN)
+        return;
+    esp_now_data_t packet;
+    memcpy(packet.mac, mac, 6);
+    packet.len = len;
+    memcpy(packet.data, data, len);
+    receive_packet(packet);
+}
+
+#ifndef __linux__
 static void receive_esp_now() {
     //printf("receive_esp_now %d %d\n", rb_start, rb_end);
     uint64_t t0 = esp_timer_get_time();
@@ -510,23 +562,7 @@ static void receive_esp_now() {
         xSemaphoreGive(esp_now_sem);
         rb_end+=1;
 
-        if (first.len > MAX_DATA_LEN) {
-            ESP_LOGW(TAG, "espnow wrong packet size %d", first.len);
-            continue;
-        }
-
-        wireless_message_count++;
-
-        uint16_t id = *(uint16_t *)first.data;
-        switch (id) {
-        case WIND_ID: DataRecvWind(first); break;
-        case AIR_ID: DataRecvAir(first); break;
-        case WATER_ID: DataRecvWater(first); break;
-        case LIGHTNING_UV_ID: DataRecvLightningUV(first); break;
-        case INFO_ID: DataRecvInfo(first); break;
-        default:
-            ESP_LOGW(TAG, "espnow packet ID mismatch %x", id);
-        }
+        receive_packet(first);
 
         if(esp_timer_get_time() - t0 > 20e6) { // taking too long
             ESP_LOGW(TAG, "espnow receive failed to keep up");
@@ -605,3 +641,4 @@ void wireless_setup() {
 
     setup_wifi();
 }
+#endif
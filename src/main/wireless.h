@@ -13,6 +13,7 @@ bool wireless_unlock_channel(const std::string &mac);
 void wireless_toggle_mode();
 void wireless_setup();
 void wireless_poll();
+void wireless_receive_packet(const uint8_t mac[6], const uint8_t *data, int len);
 
 extern int wireless_message_count;
 extern bool wifi_connected;